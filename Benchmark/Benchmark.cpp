@@ -0,0 +1,1425 @@
+/*
+* FILE : Benchmark.cpp
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   Microbenchmarks for the transport and file slicing hot paths: packet
+*   queues, ack processing, header encoding, send scheduling, file slicing
+*   and MD5, and the round trip of a small message over loopback in each
+*   polling mode. Each benchmark runs for at least a minimum time and
+*   results are printed as a table and optionally written as JSON so they
+*   can be tracked over releases. With --check-allocations it instead runs
+*   paced channel and file slice transfers and fails if either packet path
+*   still allocates once it has warmed up, with --check-wrap it fails if channel messages are lost
+*   once their ids wrap, and with --check-slow-reader it fails if a reader
+*   slower than its sender loses messages or the connection.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <filesystem>
+#include <atomic>
+#include <thread>
+#include <new>
+#include <cstdint>
+#include <algorithm>
+
+#include "../ReliableUDP/Net.h"
+#include "../ReliableUDP/Utilities.h"
+#include "../ReliableUDP/Channels.h"
+#include "../ReliableUDP/Coalescer.h"
+#include "../ReliableUDP/Scheduler.h"
+#include "../ReliableUDP/ReadAhead.h"
+
+using namespace net;
+
+/*
+ * Struct : BenchResult
+ * Description :
+ *   The measurements of one benchmark run.
+ */
+struct BenchResult
+{
+	std::string name;
+	unsigned long long iterations;
+	double seconds;
+	double bytesPerOp;      // 0 when throughput is not meaningful
+};
+
+/*
+ * Class : BenchRunner
+ * Description :
+ *   Times a benchmark body, doubling the batch size until the minimum run
+ *   time is reached, and collects the results.
+ */
+class BenchRunner
+{
+public:
+	BenchRunner(double minTime, const char* filter)
+		: m_minTime(minTime), m_filter(filter)
+	{
+	}
+
+	/*
+	 * Function : Run
+	 * Description :
+	 *   Runs a benchmark whose body performs the given number of operations.
+	 * Parameters :
+	 *   const std::string& name - The benchmark name.
+	 *   double bytesPerOp - Bytes processed by one operation, 0 if not applicable.
+	 *   std::function<void(unsigned long long)> body - Performs that many operations.
+	 * Return :
+	 *   void
+	 */
+	void Run(const std::string& name, double bytesPerOp, const std::function<void(unsigned long long)>& body)
+	{
+		if (IsFiltered(name))
+		{
+			return;
+		}
+
+		unsigned long long batch = 1;
+		double seconds = 0.0;
+		while (true)
+		{
+			auto start = std::chrono::steady_clock::now();
+			body(batch);
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (seconds >= m_minTime || batch >= (1ull << 40))
+			{
+				break;
+			}
+			// aim straight for the minimum time once the batch is long enough to measure
+			batch = seconds > m_minTime / 100.0 ? (unsigned long long)(batch * m_minTime * 1.2 / seconds) + 1 : batch * 10;
+		}
+
+		BenchResult result = { name, batch, seconds, bytesPerOp };
+		m_results.push_back(result);
+
+		double nsPerOp = seconds * 1e9 / batch;
+		if (bytesPerOp > 0.0)
+		{
+			printf("%-40s %12.1f ns/op %14.0f ops/s %10.1f MB/s\n", name.c_str(), nsPerOp, batch / seconds,
+				bytesPerOp * batch / seconds / 1e6);
+		}
+		else
+		{
+			printf("%-40s %12.1f ns/op %14.0f ops/s\n", name.c_str(), nsPerOp, batch / seconds);
+		}
+		fflush(stdout);
+	}
+
+	/*
+	 * Function : IsFiltered
+	 * Description :
+	 *   Tells whether the filter excludes a benchmark, so costly setup can be skipped.
+	 * Parameters :
+	 *   const std::string& name - The benchmark name.
+	 * Return :
+	 *   bool - Returns true if the benchmark will not run.
+	 */
+	bool IsFiltered(const std::string& name) const
+	{
+		return m_filter != nullptr && name.find(m_filter) == std::string::npos;
+	}
+
+	/*
+	 * Function : WriteJson
+	 * Description :
+	 *   Writes every result as a JSON document.
+	 * Parameters :
+	 *   const char* path - The output file.
+	 * Return :
+	 *   bool - Returns true if the file was written.
+	 */
+	bool WriteJson(const char* path) const
+	{
+		FILE* file = fopen(path, "w");
+		if (file == nullptr)
+		{
+			return false;
+		}
+		fprintf(file, "{\n  \"benchmarks\": [\n");
+		for (size_t i = 0; i < m_results.size(); i++)
+		{
+			const BenchResult& r = m_results[i];
+			fprintf(file, "    {\"name\": \"%s\", \"iterations\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"ops_per_second\": %.1f",
+				r.name.c_str(), r.iterations, r.seconds, r.seconds * 1e9 / r.iterations, r.iterations / r.seconds);
+			if (r.bytesPerOp > 0.0)
+			{
+				fprintf(file, ", \"bytes_per_second\": %.1f", r.bytesPerOp * r.iterations / r.seconds);
+			}
+			fprintf(file, "}%s\n", i + 1 < m_results.size() ? "," : "");
+		}
+		fprintf(file, "  ]\n}\n");
+		fclose(file);
+		return true;
+	}
+
+private:
+	double m_minTime;
+	const char* m_filter;
+	std::vector<BenchResult> m_results;
+};
+
+// Counts heap allocations, for the steady state check. Every replaceable
+// form of operator new is counted, plain, array, aligned and nothrow, and
+// each delete frees the way its new allocated.
+static std::atomic<unsigned long long> g_allocations(0);
+
+// GCC pairs an inlined free below with the library's operator new that the
+// standard allocators call, not knowing that operator new is this malloc
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+static void* Allocate(size_t size) noexcept
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size > 0 ? size : 1);
+}
+
+// Over-aligned blocks keep the pointer malloc returned just before the aligned one
+static void* AllocateAligned(size_t size, std::align_val_t alignment) noexcept
+{
+	const size_t align = std::max((size_t)alignment, sizeof(void*));
+	void* block = Allocate(size + align + sizeof(void*));
+	if (block == nullptr)
+		return nullptr;
+	const uintptr_t aligned = ((uintptr_t)block + sizeof(void*) + align - 1) & ~(uintptr_t)(align - 1);
+	((void**)aligned)[-1] = block;
+	return (void*)aligned;
+}
+
+static void FreeAligned(void* pointer) noexcept
+{
+	if (pointer != nullptr)
+		free(((void**)pointer)[-1]);
+}
+
+void* operator new(size_t size)
+{
+	if (void* pointer = Allocate(size))
+		return pointer;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return Allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	if (void* pointer = AllocateAligned(size, alignment))
+		return pointer;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return AllocateAligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+	free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+	free(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+	FreeAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t) noexcept
+{
+	FreeAligned(pointer);
+}
+
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept
+{
+	FreeAligned(pointer);
+}
+
+void operator delete[](void* pointer, size_t, std::align_val_t) noexcept
+{
+	FreeAligned(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	FreeAligned(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	FreeAligned(pointer);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Keeps the optimizer from discarding benchmark results
+static volatile unsigned long long g_sink;
+
+static void Consume(unsigned long long value)
+{
+	g_sink = g_sink + value;
+}
+
+// Exposes the protected header codec of ReliableConnection
+class HeaderCodec : public ReliableConnection
+{
+public:
+	HeaderCodec() : ReliableConnection(0x11223344, 10.0f) {}
+	using ReliableConnection::WriteHeader;
+	using ReliableConnection::ReadHeader;
+};
+
+static void BenchPacketQueue(BenchRunner& runner, int window)
+{
+	const unsigned int maxSequence = 0xFFFFFFFF;
+
+	runner.Run("PacketQueue/insert_sorted/append/" + std::to_string(window), 0.0, [&](unsigned long long ops)
+	{
+		PacketQueue queue;
+		unsigned int sequence = 0;
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			PacketData data = { sequence++, 0.0f, 256 };
+			queue.insert_sorted(data, maxSequence);
+			if ((int)queue.size() > window)
+				queue.pop_front();
+		}
+		Consume(queue.size());
+	});
+
+	runner.Run("PacketQueue/insert_sorted/reordered/" + std::to_string(window), 0.0, [&](unsigned long long ops)
+	{
+		// acks arrive out of order within the window, as process_ack inserts them
+		PacketQueue queue;
+		std::mt19937 random(1);
+		unsigned int base = 0;
+		for (unsigned long long i = 0; i < ops; i += 8)
+		{
+			unsigned int order[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+			std::shuffle(order, order + 8, random);
+			for (int j = 0; j < 8; j++)
+			{
+				PacketData data = { base + order[j], 0.0f, 256 };
+				queue.insert_sorted(data, maxSequence);
+			}
+			base += 8;
+			while ((int)queue.size() > window)
+				queue.pop_front();
+		}
+		Consume(queue.size());
+	});
+
+	runner.Run("PacketQueue/exists/" + std::to_string(window), 0.0, [&](unsigned long long ops)
+	{
+		PacketQueue queue;
+		for (int i = 0; i < window; i++)
+		{
+			PacketData data = { (unsigned int)i, 0.0f, 256 };
+			queue.push_back(data);
+		}
+		unsigned long long found = 0;
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			found += queue.exists((unsigned int)(i % (window * 2))) ? 1 : 0;
+		}
+		Consume(found);
+	});
+}
+
+static void BenchReliabilitySystem(BenchRunner& runner, int window)
+{
+	runner.Run("ReliabilitySystem/ProcessAck/" + std::to_string(window), 0.0, [&](unsigned long long ops)
+	{
+		// keep "window" packets in flight and ack the oldest one each step
+		ReliabilitySystem reliability;
+		for (int i = 0; i < window; i++)
+			reliability.PacketSent(256);
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			unsigned int ack = reliability.GetLocalSequence() - window;
+			reliability.ProcessAck(ack, 0xFFFFFFFF);
+			reliability.PacketSent(256);
+			// an occasional update keeps the acked queue and ack list bounded, as the frame loop does
+			if ((i & 255) == 255)
+				reliability.Update(0.01f);
+		}
+		Consume(reliability.GetAckedPackets());
+	});
+
+	runner.Run("ReliabilitySystem/Update/" + std::to_string(window), 0.0, [&](unsigned long long ops)
+	{
+		ReliabilitySystem reliability;
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			reliability.PacketSent(256);
+			reliability.PacketReceived((unsigned int)i, 256);
+			if (i >= (unsigned long long)window)
+				reliability.ProcessAck(reliability.GetLocalSequence() - window, 0xFFFFFFFF);
+			reliability.Update(0.0001f);
+		}
+		Consume(reliability.GetSentPackets());
+	});
+}
+
+static void BenchHeader(BenchRunner& runner)
+{
+	HeaderCodec codec;
+	unsigned char header[12];
+
+	runner.Run("Header/WriteHeader", 12.0, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			codec.WriteHeader(header, (unsigned int)i, (unsigned int)i - 3, 0xFFFF0F0F);
+			Consume(header[3]);
+		}
+	});
+
+	runner.Run("Header/ReadHeader", 12.0, [&](unsigned long long ops)
+	{
+		codec.WriteHeader(header, 1234, 1200, 0xFFFF0F0F);
+		unsigned int sequence, ack, ackBits;
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			header[3] = (unsigned char)i;
+			codec.ReadHeader(header, sequence, ack, ackBits);
+			Consume(sequence + ack + ackBits);
+		}
+	});
+
+	// the compact header with a 2 byte packet number, and with and without the ack fields
+	unsigned char compact[CompactHeader::MaxSize];
+
+	runner.Run("Header/CompactHeader::Write", 0.0, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			const unsigned int sequence = (unsigned int)i;
+			const int length = CompactHeader::PacketNumberLength(sequence, sequence - 300, true);
+			const int size = CompactHeader::Write(compact, sequence, length, false, (i & 3) == 0, sequence - 3, (i & 7) ? 0xFFFFFFFF : 0xFFFF0F0F);
+			Consume(compact[1] + size);
+		}
+	});
+
+	runner.Run("Header/CompactHeader::Read", 0.0, [&](unsigned long long ops)
+	{
+		const int size = CompactHeader::Write(compact, 1234, 2, false, true, 1200, 0xFFFF0F0F);
+		unsigned int sequence = 0, ack = 0, ackBits = 0;
+		bool ackOnly = false, withAck = false;
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			compact[2] = (unsigned char)i;
+			const int read = CompactHeader::Read(compact, size, 1200 + (unsigned int)(i & 63), 1300, sequence, ackOnly, withAck, ack, ackBits);
+			Consume(sequence + ack + ackBits + read);
+		}
+	});
+}
+
+static void BenchScheduler(BenchRunner& runner)
+{
+	// a control stream above three always-busy bulk streams of weights 1, 2 and 4 with mixed message sizes
+	const int sizes[] = { 12, 250, 60, 180 };
+	SendScheduler scheduler;
+	scheduler.AddStream(0, 1);
+	scheduler.AddStream(1, 1);
+	scheduler.AddStream(1, 2);
+	scheduler.AddStream(1, 4);
+	unsigned long long control = 0;
+	runner.Run("Scheduler/Pick/1+3streams", 0.0, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			// the control stream has a message every 16 picks
+			const bool controlWaiting = (i & 15) == 0;
+			const int stream = scheduler.Pick([&](int index) { return index > 0 || controlWaiting ? sizes[index] : 0; });
+			control += stream == 0;
+		}
+	});
+	const double bulk = (double)scheduler.GetSentBytes(1);
+	if (bulk > 0.0)
+		printf("%-40s control picks %llu, bulk shares 1 : %.2f : %.2f\n", "", control,
+			scheduler.GetSentBytes(2) / bulk, scheduler.GetSentBytes(3) / bulk);
+}
+
+static void BenchFileSlices(BenchRunner& runner, size_t fileSize)
+{
+	std::filesystem::path source = std::filesystem::temp_directory_path() / "rudp_bench_source.bin";
+	std::filesystem::path target = std::filesystem::temp_directory_path() / "rudp_bench_target.bin";
+	{
+		std::vector<char> content(fileSize);
+		std::mt19937 random(7);
+		for (size_t i = 0; i < fileSize; i++)
+			content[i] = (char)random();
+		std::ofstream file(source, std::ios::binary);
+		file.write(content.data(), content.size());
+	}
+
+	const std::string suffix = "/" + std::to_string(fileSize >> 20) + "MB";
+	std::string sourceName = source.string();
+	std::string targetName = target.string();
+	FileSlices slices;
+
+	runner.Run("FileSlices/Load" + suffix, (double)fileSize, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			slices.Reset();
+			slices.Load(sourceName.c_str());
+		}
+	});
+
+	FileSlices streamed;
+	runner.Run("FileSlices/LoadStreamed" + suffix, (double)fileSize, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			streamed.Reset();
+			streamed.Load(sourceName.c_str(), true);
+		}
+	});
+
+	// the send loop's side of a streamed file, taking every slice as soon as the reader thread has it
+	SliceReadAhead readAhead;
+	uint8_t packet[PACKET_SIZE];
+	runner.Run("FileSlices/ReadAhead" + suffix, (double)fileSize, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			readAhead.Start(streamed);
+			for (size_t id = 0; id < streamed.GetTotal(); )
+				if (readAhead.Take(id, packet) != 0)
+					id++;
+			Consume(packet[1]);
+		}
+	});
+	readAhead.Stop();
+
+	runner.Run("FileSlices/Verify" + suffix, (double)fileSize, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+			Consume(slices.Verify() ? 1 : 0);
+	});
+
+	runner.Run("FileSlices/Save" + suffix, (double)fileSize, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+			slices.Save(targetName.c_str());
+	});
+
+	std::error_code error;
+	std::filesystem::remove(source, error);
+	std::filesystem::remove(target, error);
+}
+
+static void BenchMd5(BenchRunner& runner, size_t size)
+{
+	std::vector<uint8_t> buffer(size);
+	for (size_t i = 0; i < size; i++)
+		buffer[i] = (uint8_t)(i * 131);
+
+	runner.Run("md5/Update/" + std::to_string(size), (double)size, [&](unsigned long long ops)
+	{
+		for (unsigned long long i = 0; i < ops; i++)
+		{
+			MD5Context ctx;
+			md5Init(&ctx);
+			md5Update(&ctx, buffer.data(), buffer.size());
+			md5Finalize(&ctx);
+			Consume(ctx.digest[0]);
+		}
+	});
+}
+
+/*
+ * Struct : LatencyMode
+ * Description :
+ *   How both ends of the latency benchmark wait for their next message.
+ */
+struct LatencyMode
+{
+	const char* name;
+	unsigned long long tickNs;      // sleep this long between polls, 0 to use a BusyPoller
+	unsigned int spinNs;            // the poller's spin budget, 0 blocks at once
+	int busyPollUs;                 // SO_BUSY_POLL, 0 to leave it off
+	bool pin;                       // pin each end to its own cpu
+};
+
+static const int LatencyMessageSize = 32;
+static const unsigned long long LatencyUpdateNs = 33333333;
+static const unsigned long long LatencyResendNs = 100000000;
+
+/*
+ * Function : LatencyIdle
+ * Description :
+ *   Waits for the next datagram the way the mode prescribes.
+ * Parameters :
+ *   const LatencyMode& mode - The waiting mode.
+ *   BusyPoller& poller - The poller of this end.
+ *   ReliableConnection& connection - The connection to wait on.
+ *   unsigned long long deadline - When to give up waiting.
+ * Return :
+ *   void
+ */
+static void LatencyIdle(const LatencyMode& mode, BusyPoller& poller, ReliableConnection& connection, unsigned long long deadline)
+{
+	if (mode.tickNs > 0)
+		sleep_until_ns(time_now_ns() + mode.tickNs);
+	else
+		poller.Idle(connection, deadline);
+}
+
+/*
+ * Function : LatencyUpdate
+ * Description :
+ *   Advances a connection's clocks at the 30 Hz of the frame loop; only the polling runs faster.
+ * Parameters :
+ *   ReliableConnection& connection - The connection to update.
+ *   unsigned long long& last - When it was last updated.
+ * Return :
+ *   void
+ */
+static void LatencyUpdate(ReliableConnection& connection, unsigned long long& last)
+{
+	const unsigned long long now = time_now_ns();
+	if (now - last >= LatencyUpdateNs)
+	{
+		connection.Update((float)((now - last) / 1e9));
+		last = now;
+	}
+}
+
+static void BenchLatency(BenchRunner& runner)
+{
+	// the frame loop sleeps a 30 Hz tick between polls, latency mode spins and then blocks on the socket
+	const LatencyMode modes[] = {
+		{ "tick", 33333333, 0, 0, false },
+		{ "block", 0, 0, 0, false },
+		{ "spin", 0, 50000, 0, true },
+		{ "spin+busy_poll", 0, 50000, 50, true },
+	};
+	const unsigned short serverPort = 30180;
+	const unsigned short clientPort = 30181;
+	const unsigned int cpus = std::max(1u, std::thread::hardware_concurrency());
+
+	for (const LatencyMode& mode : modes)
+	{
+		const std::string name = std::string("Latency/RoundTrip/") + mode.name;
+		if (runner.IsFiltered(name))
+			continue;
+
+		ReliableConnection server(0x11223344, 10.0f);
+		ReliableConnection client(0x11223344, 10.0f);
+		for (ReliableConnection* connection : { &server, &client })
+		{
+			connection->SetImmediate(true);
+			connection->SetAckFrequency(1, 0.0f);
+		}
+		if (!server.Start(serverPort) || !client.Start(clientPort))
+		{
+			printf("%-40s skipped, ports %d and %d are busy\n", name.c_str(), serverPort, clientPort);
+			continue;
+		}
+		if (mode.busyPollUs > 0 && (!server.SetBusyPoll(mode.busyPollUs, true) || !client.SetBusyPoll(mode.busyPollUs, true)))
+			printf("%-40s busy polling unavailable, measuring without it\n", name.c_str());
+		server.Listen();
+		client.Connect(Address(127, 0, 0, 1, serverPort));
+
+		// the server echoes every message from its own thread
+		std::atomic<bool> stop(false);
+		std::thread echo([&]()
+		{
+			if (mode.pin)
+				pin_thread(1 % cpus);
+			BusyPoller poller(mode.spinNs);
+			unsigned long long last = time_now_ns();
+			unsigned char message[LatencyMessageSize];
+			while (!stop.load(std::memory_order_relaxed))
+			{
+				bool received = false;
+				int bytes;
+				while ((bytes = server.ReceivePacket(message, sizeof(message))) > 0)
+				{
+					server.SendPacket(message, bytes);
+					received = true;
+				}
+				LatencyUpdate(server, last);
+				if (received)
+					poller.Ready();
+				else
+					LatencyIdle(mode, poller, server, last + LatencyUpdateNs);
+			}
+		});
+		if (mode.pin)
+			pin_thread(0);
+
+		BusyPoller poller(mode.spinNs);
+		unsigned long long last = time_now_ns();
+		unsigned int counter = 0;
+		// one message and its echo, sent again should either be lost
+		auto roundTrip = [&]()
+		{
+			unsigned char message[LatencyMessageSize] = { 0 };
+			const unsigned int id = ++counter;
+			memcpy(message, &id, sizeof(id));
+			client.SendPacket(message, sizeof(message));
+			unsigned long long sent = time_now_ns();
+			while (true)
+			{
+				unsigned char reply[LatencyMessageSize];
+				bool received = false;
+				int bytes;
+				while ((bytes = client.ReceivePacket(reply, sizeof(reply))) > 0)
+				{
+					received = true;
+					unsigned int echoed;
+					memcpy(&echoed, reply, sizeof(echoed));
+					if (bytes == LatencyMessageSize && echoed == id)
+						return;
+				}
+				LatencyUpdate(client, last);
+				if (time_now_ns() - sent >= LatencyResendNs)
+				{
+					client.SendPacket(message, sizeof(message));
+					sent = time_now_ns();
+				}
+				if (received)
+					poller.Ready();
+				else
+					LatencyIdle(mode, poller, client, last + LatencyUpdateNs);
+			}
+		};
+		// the first message opens the connection
+		roundTrip();
+
+		runner.Run(name, 0.0, [&](unsigned long long ops)
+		{
+			for (unsigned long long i = 0; i < ops; i++)
+				roundTrip();
+			Consume(counter);
+		});
+
+		stop = true;
+		echo.join();
+	}
+}
+
+static const int TransferBytes = 64 * 1024;
+static const unsigned long long TransferUpdateNs = 1000000;
+static const int TransferBurst = 32;            // packets sent before the receiver drains its socket
+
+/*
+ * Function : TransferUpdate
+ * Description :
+ *   Advances a connection's clocks every millisecond, so acks free the send
+ *   window well before it fills.
+ * Parameters :
+ *   const std::function<void(float)>& update - Updates the connection.
+ *   unsigned long long& last - When it was last updated.
+ * Return :
+ *   void
+ */
+static void TransferUpdate(const std::function<void(float)>& update, unsigned long long& last)
+{
+	const unsigned long long now = time_now_ns();
+	if (now - last >= TransferUpdateNs)
+	{
+		update((float)((now - last) / 1e9));
+		last = now;
+	}
+}
+
+static void BenchTransfer(BenchRunner& runner)
+{
+	// the same 64 KB, once as one message and once as the file slices the download loop sends
+	const std::string messageName = "Transfer/Message/64KB";
+	const std::string slicesName = "Transfer/FileSlices/64KB";
+	const unsigned short serverPort = 30182;
+	const unsigned short clientPort = 30183;
+
+	std::vector<unsigned char> content(TransferBytes);
+	std::mt19937 random(11);
+	for (unsigned char& byte : content)
+		byte = (unsigned char)random();
+
+	if (!runner.IsFiltered(messageName))
+	{
+		ReliableConnection server(0x11223344, 10.0f);
+		ReliableConnection client(0x11223344, 10.0f);
+		if (!server.Start(serverPort) || !client.Start(clientPort))
+		{
+			printf("%-40s skipped, ports %d and %d are busy\n", messageName.c_str(), serverPort, clientPort);
+			return;
+		}
+		server.Listen();
+		client.Connect(Address(127, 0, 0, 1, serverPort));
+
+		MessageChannels receiver(server);
+		MessageChannels sender(client);
+		ChannelConfig config;
+		config.type = ChannelType::ReliableOrdered;
+		config.sendQueueSize = 8192;
+		config.maxMessageSize = TransferBytes;
+		receiver.AddChannel(config);
+		sender.AddChannel(config);
+
+		unsigned long long last = time_now_ns();
+		auto update = [&](float deltaTime)
+		{
+			sender.Update(deltaTime);
+			receiver.Update(deltaTime);
+		};
+		runner.Run(messageName, (double)TransferBytes, [&](unsigned long long ops)
+		{
+			for (unsigned long long i = 0; i < ops; i++)
+			{
+				while (!sender.Send(0, content.data(), TransferBytes))
+				{
+					sender.ReceivePackets();
+					TransferUpdate(update, last);
+				}
+				while (sender.Flush(TransferBurst) == TransferBurst)
+				{
+					receiver.ReceivePackets();
+					sender.ReceivePackets();
+				}
+				while (true)
+				{
+					receiver.ReceivePackets();
+					MessageView view;
+					if (receiver.Receive(0, view))
+					{
+						Consume(view.data[view.size - 1]);
+						break;
+					}
+					sender.ReceivePackets();
+					TransferUpdate(update, last);
+				}
+				TransferUpdate(update, last);
+			}
+		});
+	}
+
+	if (!runner.IsFiltered(slicesName))
+	{
+		std::filesystem::path source = std::filesystem::temp_directory_path() / "rudp_bench_transfer.bin";
+		{
+			std::ofstream file(source, std::ios::binary);
+			file.write((const char*)content.data(), content.size());
+		}
+		FileSlices slices;
+		const bool loaded = slices.Load(source.string().c_str());
+		std::error_code error;
+		std::filesystem::remove(source, error);
+		if (!loaded)
+			return;
+
+		ReliableConnection server(0x11223344, 10.0f);
+		ReliableConnection client(0x11223344, 10.0f);
+		if (!server.Start(serverPort) || !client.Start(clientPort))
+		{
+			printf("%-40s skipped, ports %d and %d are busy\n", slicesName.c_str(), serverPort, clientPort);
+			return;
+		}
+		server.Listen();
+		client.Connect(Address(127, 0, 0, 1, serverPort));
+
+		// the receiving end starts from the sender's metadata, as a download does
+		FileSlices received;
+		received.Deserialize((const unsigned char*)slices.GetMeta(), sizeof(PacketMeta));
+
+		unsigned long long last = time_now_ns();
+		auto update = [&](float deltaTime)
+		{
+			client.Update(deltaTime);
+			server.Update(deltaTime);
+		};
+		unsigned char packet[PACKET_SIZE];
+		runner.Run(slicesName, (double)TransferBytes, [&](unsigned long long ops)
+		{
+			for (unsigned long long i = 0; i < ops; i++)
+			{
+				// each slice once, in bursts the receiver drains as it goes since there is no resend here
+				for (size_t id = 0; id < slices.GetTotal(); id++)
+				{
+					client.SendPacket(packet, (int)slices.EncodeSlice(id, packet));
+					if ((id + 1) % TransferBurst != 0 && id + 1 < slices.GetTotal())
+						continue;
+					int bytes;
+					while ((bytes = server.ReceivePacket(packet, sizeof(packet))) > 0)
+						received.Deserialize(packet, bytes);
+					while (client.ReceivePacket(packet, sizeof(packet)) > 0)
+						;
+					TransferUpdate(update, last);
+				}
+			}
+			Consume(received.GetSlice(slices.GetTotal() - 1)->data[0]);
+		});
+	}
+}
+
+static const int CoalesceMessageSize = 32;
+
+static void BenchCoalescer(BenchRunner& runner)
+{
+	// small messages as fast as they come, each in its own datagram and then coalesced
+	const float deadlines[] = { 0.0f, 0.001f };
+	const unsigned short serverPort = 30184;
+	const unsigned short clientPort = 30185;
+
+	for (float deadline : deadlines)
+	{
+		const std::string name = "Coalescer/Send/" + std::to_string(CoalesceMessageSize) + "B/deadline_" + std::to_string((int)(deadline * 1000.0f)) + "ms";
+		if (runner.IsFiltered(name))
+			continue;
+
+		ReliableConnection server(0x11223344, 10.0f);
+		ReliableConnection client(0x11223344, 10.0f);
+		if (!server.Start(serverPort) || !client.Start(clientPort))
+		{
+			printf("%-40s skipped, ports %d and %d are busy\n", name.c_str(), serverPort, clientPort);
+			continue;
+		}
+		server.Listen();
+		client.Connect(Address(127, 0, 0, 1, serverPort));
+
+		MessageCoalescer coalescer(client, deadline);
+		unsigned long long received = 0;
+		unsigned long long datagrams = 0;
+		unsigned long long maxDelay = 0;
+		auto handle = [&](const unsigned char* message, int size)
+		{
+			unsigned long long sent;
+			memcpy(&sent, message + 1, sizeof(sent));
+			maxDelay = std::max(maxDelay, time_now_ns() - sent);
+			received += size == CoalesceMessageSize;
+		};
+		unsigned long long last = time_now_ns();
+		auto update = [&](float deltaTime)
+		{
+			client.Update(deltaTime);
+			server.Update(deltaTime);
+		};
+		unsigned char message[CoalesceMessageSize] = { TYPE_KEEPALIVE };
+		unsigned char packet[PACKET_SIZE];
+		runner.Run(name, (double)CoalesceMessageSize, [&](unsigned long long ops)
+		{
+			for (unsigned long long i = 0; i < ops; i++)
+			{
+				const unsigned long long now = time_now_ns();
+				memcpy(message + 1, &now, sizeof(now));
+				coalescer.Send(message, sizeof(message));
+				coalescer.Poll();
+				if (i % TransferBurst != 0)
+					continue;
+				int bytes;
+				while ((bytes = server.ReceivePacket(packet, sizeof(packet))) > 0)
+				{
+					MessageCoalescer::Split(packet, bytes, handle);
+					datagrams++;
+				}
+				while (client.ReceivePacket(packet, sizeof(packet)) > 0)
+					;
+				TransferUpdate(update, last);
+			}
+		});
+		if (coalescer.GetPackets() > 0)
+			printf("%-40s %.1f messages per datagram, %llu of %llu received in %llu datagrams, added delay up to %.2f ms\n", "",
+				(double)coalescer.GetMessages() / coalescer.GetPackets(), received, coalescer.GetMessages(), datagrams, maxDelay / 1e6);
+	}
+}
+
+static const float SteadyWarmUp = 2.0f;         // seconds, longer than the stats window plus an rto
+static const float SteadyRun = 3.0f;
+static const float SteadyRate = 768.0f * 1024.0f; // per stream, keeps a second of sent packets well inside a doubled pool
+static const size_t SteadyFileBytes = 4u << 20;  // more slices than the run sends, so each arrives once
+
+/*
+ * Function : CheckAllocations
+ * Description :
+ *   Streams messages between two channel sets and file slices between a
+ *   second pair of connections over loopback at a steady rate, as a long
+ *   transfer does, and counts the heap allocations made after the warm-up,
+ *   once every queue and pool has reached its working size. Sending,
+ *   receiving, acking and updating should then make none on either path.
+ * Parameters :
+ *   None
+ * Return :
+ *   bool - Returns true if nothing was allocated after the warm-up.
+ */
+static bool CheckAllocations()
+{
+	const unsigned short serverPort = 30186;
+	const unsigned short clientPort = 30187;
+	const unsigned short fileServerPort = 30192;
+	const unsigned short fileClientPort = 30193;
+	ReliableConnection server(0x11223344, 10.0f);
+	ReliableConnection client(0x11223344, 10.0f);
+	ReliableConnection fileServer(0x11223344, 10.0f);
+	ReliableConnection fileClient(0x11223344, 10.0f);
+	if (!server.Start(serverPort) || !client.Start(clientPort) ||
+		!fileServer.Start(fileServerPort) || !fileClient.Start(fileClientPort))
+	{
+		fprintf(stderr, "Error: Ports %d to %d or %d to %d are busy\n", serverPort, clientPort, fileServerPort, fileClientPort);
+		return false;
+	}
+	server.Listen();
+	client.Connect(Address(127, 0, 0, 1, serverPort));
+	fileServer.Listen();
+	fileClient.Connect(Address(127, 0, 0, 1, fileServerPort));
+
+	MessageChannels receiver(server);
+	MessageChannels sender(client);
+	ChannelConfig config;
+	config.type = ChannelType::ReliableOrdered;
+	config.sendQueueSize = 1024;
+	config.receiveQueueSize = 1024;
+	receiver.AddChannel(config);
+	sender.AddChannel(config);
+
+	// the file side loads from disk and starts from the sender's metadata, as a download does
+	std::filesystem::path source = std::filesystem::temp_directory_path() / "rudp_check_allocations.bin";
+	{
+		std::vector<char> content(SteadyFileBytes, 0x3C);
+		std::ofstream file(source, std::ios::binary);
+		file.write(content.data(), content.size());
+	}
+	FileSlices slices;
+	const bool loaded = slices.Load(source.string().c_str());
+	std::error_code error;
+	std::filesystem::remove(source, error);
+	if (!loaded)
+	{
+		fprintf(stderr, "Error: Failed loading %s\n", source.string().c_str());
+		return false;
+	}
+	FileSlices slicesReceived;
+	slicesReceived.Deserialize((const unsigned char*)slices.GetMeta(), sizeof(PacketMeta));
+
+	Pacer pacer(SteadyRate, MessageChannels::DefaultPacketBytes * 4);
+	Pacer filePacer(SteadyRate, PACKET_SIZE * 4);
+	std::vector<unsigned char> message(sender.GetMaxMessageSize(), 0x5A);
+	unsigned char packet[PACKET_SIZE];
+	unsigned long long last = time_now_ns();
+	// wrapped once here, four captures no longer fit the small buffer a per-call conversion would use
+	const std::function<void(float)> update = [&](float deltaTime)
+	{
+		sender.Update(deltaTime);
+		receiver.Update(deltaTime);
+		fileClient.Update(deltaTime);
+		fileServer.Update(deltaTime);
+	};
+	unsigned long long received = 0;
+	unsigned long long slicesArrived = 0;
+	size_t nextSlice = 0;
+	unsigned long long warmAllocations = 0;
+	unsigned long long warmReceived = 0;
+	unsigned long long warmSlices = 0;
+	const unsigned long long start = time_now_ns();
+	const unsigned long long warm = start + (unsigned long long)(SteadyWarmUp * 1e9);
+	const unsigned long long end = warm + (unsigned long long)(SteadyRun * 1e9);
+	bool warmedUp = false;
+	unsigned long long now;
+	while ((now = time_now_ns()) < end)
+	{
+		if (!warmedUp && now >= warm)
+		{
+			warmedUp = true;
+			warmAllocations = g_allocations.load();
+			warmReceived = received;
+			warmSlices = slicesArrived;
+		}
+		// one message per packet the pacer allows, so the queues settle at the rate's working size
+		while (sender.GetPendingCount(0) < config.sendQueueSize / 2 && pacer.TryConsume(MessageChannels::DefaultPacketBytes))
+			sender.Send(0, message.data(), (int)message.size());
+		sender.Flush();
+		receiver.ReceivePackets();
+		MessageView view;
+		while (receiver.Receive(0, view))
+			received++;
+		sender.ReceivePackets();
+
+		// the file slices go straight over the connection, as the download loop sends them
+		while (filePacer.TryConsume(PACKET_SIZE))
+		{
+			fileClient.SendPacket(packet, (int)slices.EncodeSlice(nextSlice, packet));
+			nextSlice = (nextSlice + 1) % slices.GetTotal();
+		}
+		int bytes;
+		while ((bytes = fileServer.ReceivePacket(packet, sizeof(packet))) > 0)
+			if (slicesReceived.Deserialize(packet, bytes))
+				slicesArrived++;
+		while (fileClient.ReceivePacket(packet, sizeof(packet)) > 0)
+			;
+		TransferUpdate(update, last);
+	}
+	const unsigned long long allocations = g_allocations.load() - warmAllocations;
+	printf("Steady state: %llu allocations while %llu messages and %llu file slices arrived after a %.1f s warm-up\n",
+		allocations, received - warmReceived, slicesArrived - warmSlices, SteadyWarmUp);
+	return allocations == 0 && received > warmReceived && slicesArrived > warmSlices;
+}
+
+static const int WrapMessages = 1100;
+static const int WrapMessageSize = 16 * 1024;
+static const float WrapTimeOut = 60.0f;
+
+// fills a message whose first four bytes are its index and whose rest follows from it and its channel
+static int WrapMessage(int channel, int index, unsigned char* data)
+{
+	const int size = WrapMessageSize - index % 97;
+	memcpy(data, &index, sizeof(index));
+	for (int i = (int)sizeof(index); i < size; i++)
+		data[i] = (unsigned char)(index * 31 + i * 7 + channel);
+	return size;
+}
+
+/*
+ * Function : CheckChannelWrap
+ * Description :
+ *   Sends enough fragmented messages over loopback, on an ordered and an
+ *   unordered channel, for both to use more than 65536 message ids, so the
+ *   16 bit ids wrap while messages are in flight. Queue sizes that are not
+ *   powers of two are asked for, the channels have to round them.
+ * Parameters :
+ *   None
+ * Return :
+ *   bool - Returns true if every message arrived once, intact and, on the
+ *   ordered channel, in order.
+ */
+static bool CheckChannelWrap()
+{
+	const unsigned short serverPort = 30188;
+	const unsigned short clientPort = 30189;
+	ReliableConnection server(0x11223344, 10.0f);
+	ReliableConnection client(0x11223344, 10.0f);
+	if (!server.Start(serverPort) || !client.Start(clientPort))
+	{
+		fprintf(stderr, "Error: Ports %d and %d are busy\n", serverPort, clientPort);
+		return false;
+	}
+	server.Listen();
+	client.Connect(Address(127, 0, 0, 1, serverPort));
+
+	MessageChannels receiver(server);
+	MessageChannels sender(client);
+	ChannelConfig config;
+	config.sendQueueSize = 300;
+	config.receiveQueueSize = 300;
+	config.maxMessageSize = WrapMessageSize;
+	const ChannelType types[] = { ChannelType::ReliableOrdered, ChannelType::ReliableUnordered };
+	for (ChannelType type : types)
+	{
+		config.type = type;
+		if (receiver.AddChannel(config) < 0 || sender.AddChannel(config) < 0)
+		{
+			fprintf(stderr, "Error: Failed adding the channels\n");
+			return false;
+		}
+	}
+
+	unsigned long long last = time_now_ns();
+	auto update = [&](float deltaTime)
+	{
+		sender.Update(deltaTime);
+		receiver.Update(deltaTime);
+	};
+	std::vector<unsigned char> message(WrapMessageSize);
+	std::vector<unsigned char> expected(WrapMessageSize);
+	int sent[2] = { 0, 0 };
+	int received[2] = { 0, 0 };
+	unsigned long long fragments = 0;
+	std::vector<bool> seen(WrapMessages, false);
+	bool intact = true;
+	const unsigned long long end = time_now_ns() + (unsigned long long)(WrapTimeOut * 1e9);
+	while (intact && (received[0] < WrapMessages || received[1] < WrapMessages) && time_now_ns() < end)
+	{
+		for (int channel = 0; channel < 2; channel++)
+		{
+			while (sent[channel] < WrapMessages)
+			{
+				const int size = WrapMessage(channel, sent[channel], message.data());
+				if (!sender.Send(channel, message.data(), size))
+					break;
+				fragments += (size + sender.GetMaxMessageSize() - 5) / (sender.GetMaxMessageSize() - 4);
+				sent[channel]++;
+			}
+		}
+		// a burst at a time, so the receiver drains its socket before it fills
+		sender.Flush(TransferBurst);
+		receiver.ReceivePackets();
+		MessageView view;
+		for (int channel = 0; channel < 2; channel++)
+		{
+			while (intact && receiver.Receive(channel, view))
+			{
+				int index = -1;
+				if (view.size >= (int)sizeof(index))
+					memcpy(&index, view.data, sizeof(index));
+				const bool known = index >= 0 && index < WrapMessages;
+				const int size = known ? WrapMessage(channel, index, expected.data()) : 0;
+				intact = known && view.size == size && memcmp(view.data, expected.data(), size) == 0 &&
+					(channel == 0 ? index == received[0] : !seen[index]);
+				if (!intact)
+					fprintf(stderr, "Error: Message %d of channel %d arrived damaged, twice or out of order\n", index, channel);
+				else if (channel == 1)
+					seen[index] = true;
+				received[channel]++;
+			}
+		}
+		sender.ReceivePackets();
+		TransferUpdate(update, last);
+	}
+	printf("Id wrap: %d + %d of %d messages arrived intact, %llu fragments sent on the two channels\n",
+		received[0], received[1], WrapMessages * 2, fragments);
+	return intact && received[0] == WrapMessages && received[1] == WrapMessages && fragments > 2 * 65536;
+}
+
+static const int SlowMessages = 2000;
+static const int SlowMessageSize = 600;         // larger than a packet, some messages go as fragments
+static const unsigned long long SlowReadNs = 200000;
+static const float SlowTimeOut = 30.0f;
+
+/*
+ * Function : CheckSlowReader
+ * Description :
+ *   Sends as fast as the channels take messages, on an ordered and an
+ *   unordered channel with small queues, while the receiver reads only one
+ *   message of each channel every SlowReadNs. The windows the receiver
+ *   gives have to hold the sender back.
+ * Parameters :
+ *   None
+ * Return :
+ *   bool - Returns true if every message arrived once, intact and, on the
+ *   ordered channel, in order, without the connection dropping.
+ */
+static bool CheckSlowReader()
+{
+	const unsigned short serverPort = 30190;
+	const unsigned short clientPort = 30191;
+	ReliableConnection server(0x11223344, 10.0f);
+	ReliableConnection client(0x11223344, 10.0f);
+	if (!server.Start(serverPort) || !client.Start(clientPort))
+	{
+		fprintf(stderr, "Error: Ports %d and %d are busy\n", serverPort, clientPort);
+		return false;
+	}
+	server.Listen();
+	client.Connect(Address(127, 0, 0, 1, serverPort));
+
+	MessageChannels receiver(server);
+	MessageChannels sender(client);
+	ChannelConfig config;
+	config.sendQueueSize = 32;
+	config.receiveQueueSize = 32;
+	config.maxMessageSize = SlowMessageSize;
+	const ChannelType types[] = { ChannelType::ReliableOrdered, ChannelType::ReliableUnordered };
+	for (ChannelType type : types)
+	{
+		config.type = type;
+		if (receiver.AddChannel(config) < 0 || sender.AddChannel(config) < 0)
+		{
+			fprintf(stderr, "Error: Failed adding the channels\n");
+			return false;
+		}
+	}
+
+	unsigned long long last = time_now_ns();
+	auto update = [&](float deltaTime)
+	{
+		sender.Update(deltaTime);
+		receiver.Update(deltaTime);
+	};
+	unsigned char message[SlowMessageSize];
+	int sent[2] = { 0, 0 };
+	int received[2] = { 0, 0 };
+	std::vector<bool> seen(SlowMessages, false);
+	bool intact = true;
+	unsigned long long nextRead = time_now_ns();
+	const unsigned long long end = time_now_ns() + (unsigned long long)(SlowTimeOut * 1e9);
+	while (intact && (received[0] < SlowMessages || received[1] < SlowMessages) && time_now_ns() < end &&
+		!receiver.IsFailed() && !sender.IsFailed())
+	{
+		for (int channel = 0; channel < 2; channel++)
+		{
+			while (sent[channel] < SlowMessages)
+			{
+				const int size = 8 + sent[channel] * 37 % (SlowMessageSize - 8);
+				memcpy(message, &sent[channel], sizeof(int));
+				memset(message + sizeof(int), channel + sent[channel], size - sizeof(int));
+				if (!sender.Send(channel, message, size))
+					break;
+				sent[channel]++;
+			}
+		}
+		sender.Flush(TransferBurst);
+		receiver.ReceivePackets();
+		if (time_now_ns() >= nextRead)
+		{
+			nextRead += SlowReadNs;
+			MessageView view;
+			for (int channel = 0; channel < 2; channel++)
+			{
+				if (!receiver.Receive(channel, view))
+					continue;
+				int index = -1;
+				if (view.size >= (int)sizeof(index))
+					memcpy(&index, view.data, sizeof(index));
+				const bool known = index >= 0 && index < SlowMessages;
+				intact = known && view.size == 8 + index * 37 % (SlowMessageSize - 8) &&
+					view.data[view.size - 1] == (unsigned char)(channel + index) &&
+					(channel == 0 ? index == received[0] : !seen[index]);
+				if (!intact)
+				{
+					fprintf(stderr, "Error: Message %d of channel %d arrived damaged, twice or out of order\n", index, channel);
+					break;
+				}
+				if (channel == 1)
+					seen[index] = true;
+				received[channel]++;
+			}
+		}
+		sender.ReceivePackets();
+		TransferUpdate(update, last);
+	}
+	const bool connected = !receiver.IsFailed() && !sender.IsFailed() && server.IsConnected() && client.IsConnected();
+	printf("Slow reader: %d + %d of %d messages arrived intact, connection %s\n",
+		received[0], received[1], SlowMessages * 2, connected ? "kept" : "dropped");
+	return intact && connected && received[0] == SlowMessages && received[1] == SlowMessages;
+}
+
+int main(int argc, char* argv[])
+{
+	double minTime = 0.5;
+	const char* filter = nullptr;
+	const char* jsonPath = nullptr;
+	size_t fileSize = 64u << 20;
+	bool checkAllocations = false;
+	bool checkWrap = false;
+	bool checkSlowReader = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+			minTime = atof(argv[++i]);
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+			jsonPath = argv[++i];
+		else if (strcmp(argv[i], "--file-size") == 0 && i + 1 < argc)
+			fileSize = (size_t)atoi(argv[++i]) << 20;
+		else if (strcmp(argv[i], "--check-allocations") == 0)
+			checkAllocations = true;
+		else if (strcmp(argv[i], "--check-wrap") == 0)
+			checkWrap = true;
+		else if (strcmp(argv[i], "--check-slow-reader") == 0)
+			checkSlowReader = true;
+		else
+		{
+			printf("Usage: %s [--min-time seconds] [--filter substring] [--json file] [--file-size MB] [--check-allocations] [--check-wrap] [--check-slow-reader]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (checkAllocations || checkWrap || checkSlowReader)
+	{
+		if (!InitializeSockets())
+		{
+			fprintf(stderr, "Error: Failed initializing sockets\n");
+			return EXIT_FAILURE;
+		}
+		const bool clean = checkAllocations ? CheckAllocations() : checkWrap ? CheckChannelWrap() : CheckSlowReader();
+		ShutdownSockets();
+		return clean ? 0 : EXIT_FAILURE;
+	}
+
+	BenchRunner runner(minTime, filter);
+
+	const int windows[] = { 32, 256, 1024 };
+	for (int window : windows)
+		BenchPacketQueue(runner, window);
+	for (int window : windows)
+		BenchReliabilitySystem(runner, window);
+	BenchHeader(runner);
+	BenchScheduler(runner);
+	BenchMd5(runner, 1u << 20);
+	// writing the test file takes a while, skip it when the filter excludes every FileSlices benchmark
+	if (filter == nullptr || std::string(filter).find("FileSlices") == 0 || std::string("FileSlices/").find(filter) != std::string::npos)
+		BenchFileSlices(runner, fileSize);
+	// the socket benchmarks go last, since the spinning latency modes pin this thread
+	if (!InitializeSockets())
+	{
+		fprintf(stderr, "Error: Failed initializing sockets\n");
+		return EXIT_FAILURE;
+	}
+	BenchTransfer(runner);
+	BenchCoalescer(runner);
+	BenchLatency(runner);
+	ShutdownSockets();
+
+	if (jsonPath != nullptr && !runner.WriteJson(jsonPath))
+	{
+		fprintf(stderr, "Error: Failed writing %s\n", jsonPath);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
@@ -0,0 +1,1054 @@
+/*
+* FILE : Channels.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides message channels on top of a `ReliableConnection`,
+*   which by itself only numbers and acknowledges packets. Each channel is
+*   reliable-ordered, reliable-unordered or unreliable-sequenced, and the
+*   messages of all channels share the connection's packets. A reliable
+*   message is sent again until a packet carrying it is acknowledged, and
+*   each channel keeps its own message numbers and buffers, so a lost
+*   packet only holds back the ordered channel it carried messages for.
+*   Reliable channels also take messages larger than a packet: they are
+*   split into fragments, one per packet, and gathered again on arrival.
+*   Each end tells the other how far its reliable channels have room,
+*   and a sender holds back the messages past that, so a slow reader
+*   only slows the sender down. A message that still finds its channel
+*   full breaks that rule and drops the connection.
+*   When the send budget is short, channels on a higher priority level go
+*   first and channels on the same level share it by weight.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+
+#include "Net.h"
+#include "Scheduler.h"
+
+/*
+ * Enum : ChannelType
+ * Description :
+ *   The delivery guarantee of a channel.
+ */
+enum class ChannelType
+{
+	ReliableOrdered,        // every message, in the order sent
+	ReliableUnordered,      // every message, as soon as it arrives
+	UnreliableSequenced     // newest messages only, older late arrivals are dropped
+};
+
+/*
+ * Struct : ChannelConfig
+ * Description :
+ *   The settings of one channel. Both ends must add the same channels in
+ *   the same order, and the receive queue must be at least as large as the
+ *   peer's send queue. Queue sizes are rounded up to a power of two.
+ */
+struct ChannelConfig
+{
+	ChannelType type = ChannelType::ReliableOrdered;
+	int sendQueueSize = 256;        // messages (or fragments) waiting to be sent or acknowledged
+	int receiveQueueSize = 256;     // messages (or fragments) received but not yet read
+	int maxMessageSize = 0;         // reliable channels: largest message, 0 for what fits in one packet
+	int priority = 0;               // strict level, lower levels send before any higher one
+	int weight = 1;                 // share of its level's sends against the other channels there
+};
+
+/*
+ * Struct : MessageView
+ * Description :
+ *   A received message, left where the channel holds it: in the slot it
+ *   arrived in, or in the channel's reassembly buffer if it came in
+ *   fragments. It stays valid until the next ReceivePackets or Receive.
+ */
+struct MessageView
+{
+	const unsigned char* data = nullptr;
+	int size = 0;
+};
+
+/*
+ * Class : MessageChannels
+ * Description :
+ *   Sends and receives messages on several channels over one connection.
+ *   Call ReceivePackets, then Receive on each channel, then Send, then
+ *   Update in place of the connection's own Update. Each packet holds as
+ *   many queued messages as fit, every one prefixed by its channel, its
+ *   message id and its size. A window entry in the same format, with no
+ *   data, gives the first id a reliable channel has no room for yet.
+ */
+class MessageChannels
+{
+public:
+	static const int MaxChannels = 64;
+	static const int DefaultPacketBytes = 256;
+	static const int MaxPacketBytes = net::PacketSizeHack - 12;   // room left by the reliable header
+	static const int MessageHeader = 5;                            // channel, id and size
+	static const int FragmentHeader = 4;                           // fragment index and count
+	static const int MaxQueueSize = 32768;                         // half the 16 bit id space
+
+	/*
+	 * Function : MessageChannels
+	 * Description :
+	 *   Attaches the channels to a connection, which must outlive them.
+	 * Parameters :
+	 *   net::ReliableConnection& connection - The connection to send on.
+	 *   int packetBytes - The largest payload of a packet.
+	 */
+	MessageChannels(net::ReliableConnection& connection, int packetBytes = DefaultPacketBytes)
+		: m_connection(connection), m_packetBytes(std::min(packetBytes, (int)MaxPacketBytes)), m_sent(SentHistory)
+	{
+		assert(packetBytes > MessageHeader);
+	}
+
+	/*
+	 * Function : AddChannel
+	 * Description :
+	 *   Adds a channel and allocates its queues. A channel for large
+	 *   messages gets queues that hold at least one whole message, and a
+	 *   receive queue that also covers the fragments of a message still
+	 *   being gathered, plus a reassembly buffer of maxMessageSize. Both
+	 *   queues are rounded up to a power of two, at most MaxQueueSize.
+	 * Parameters :
+	 *   const ChannelConfig& config - The channel's settings.
+	 * Return :
+	 *   int - The channel's index, or -1 if there are too many channels or
+	 *   the settings are invalid.
+	 */
+	int AddChannel(const ChannelConfig& config)
+	{
+		if ((int)m_channels.size() >= MaxChannels || config.sendQueueSize <= 0 || config.receiveQueueSize <= 0 || config.weight <= 0)
+		{
+			return -1;
+		}
+		const int fragments = config.maxMessageSize > GetMaxMessageSize() ? FragmentCount(config.maxMessageSize) : 1;
+		if (fragments > 1 && config.type == ChannelType::UnreliableSequenced)
+		{
+			return -1;
+		}
+		// slots are found by id modulo the queue size, which only maps the same way after the
+		// 16 bit ids wrap when the size divides 65536
+		ChannelConfig sized = config;
+		sized.sendQueueSize = RoundUpToPowerOfTwo(std::max(config.sendQueueSize, fragments));
+		sized.receiveQueueSize = RoundUpToPowerOfTwo(std::max(config.receiveQueueSize, sized.sendQueueSize + fragments - 1));
+		if (sized.receiveQueueSize > MaxQueueSize)
+		{
+			return -1;
+		}
+		m_channels.emplace_back();
+		Channel& channel = m_channels.back();
+		channel.config = sized;
+		channel.fragments = fragments;
+		channel.send.resize(sized.sendQueueSize);
+		channel.receive.resize(sized.receiveQueueSize);
+		// until the peer's first window, its receive queue is at least as large as this send queue
+		channel.sendLimit = (uint16_t)sized.sendQueueSize;
+		for (Message& message : channel.send)
+		{
+			message.data.resize(GetMaxMessageSize());
+		}
+		for (Message& message : channel.receive)
+		{
+			message.data.resize(GetMaxMessageSize());
+		}
+		// only the unordered channel needs to remember which ids it has delivered
+		if (config.type == ChannelType::ReliableUnordered)
+		{
+			channel.seen.assign(sized.receiveQueueSize, 0);
+			channel.ready.assign(sized.receiveQueueSize, 0);
+		}
+		if (fragments > 1)
+		{
+			channel.assembly.resize(config.maxMessageSize);
+		}
+		m_scheduler.AddStream(config.priority, config.weight);
+		return (int)m_channels.size() - 1;
+	}
+
+	/*
+	 * Function : GetMaxMessageSize
+	 * Description :
+	 *   Returns the largest message that fits in one packet. Channels with a
+	 *   larger maxMessageSize split bigger ones.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   int - The size in bytes.
+	 */
+	int GetMaxMessageSize() const
+	{
+		return m_packetBytes - MessageHeader;
+	}
+
+	/*
+	 * Function : Send
+	 * Description :
+	 *   Queues a message, which leaves with the next Flush or Update. A
+	 *   message larger than a packet is queued as fragments with consecutive
+	 *   ids. A full unreliable channel drops its oldest queued message to
+	 *   make room.
+	 * Parameters :
+	 *   int index - The channel.
+	 *   const void* data - The message.
+	 *   int size - Its size in bytes, from 1 to GetMaxMessageSize or the
+	 *   channel's maxMessageSize.
+	 * Return :
+	 *   bool - Returns false if the message is too large or a reliable
+	 *   channel has no room for all of its fragments.
+	 */
+	bool Send(int index, const void* data, int size)
+	{
+		assert(index >= 0 && index < (int)m_channels.size());
+		Channel& channel = m_channels[index];
+		const int fragments = size > GetMaxMessageSize() ? FragmentCount(size) : 1;
+		if (size <= 0 || fragments > channel.fragments || (fragments > 1 && size > channel.config.maxMessageSize))
+		{
+			return false;
+		}
+		const int capacity = (int)channel.send.size();
+		if (IsReliable(channel))
+		{
+			if ((uint16_t)(channel.sendNext - channel.sendOldest) + fragments > capacity)
+			{
+				return false;
+			}
+		}
+		else if (channel.sendCount == capacity)
+		{
+			channel.sendOldest++;
+			channel.sendCount--;
+		}
+		const unsigned char* bytes = (const unsigned char*)data;
+		const int fragmentSize = fragments > 1 ? GetFragmentSize() : size;
+		for (int fragment = 0; fragment < fragments; fragment++)
+		{
+			Message& message = channel.send[channel.sendNext % capacity];
+			message.id = channel.sendNext++;
+			message.used = true;
+			message.lastSent = -1.0f;
+			message.fragment = (uint16_t)fragment;
+			message.fragments = (uint16_t)fragments;
+			message.size = std::min(fragmentSize, size - fragment * fragmentSize);
+			memcpy(message.data.data(), bytes + fragment * fragmentSize, message.size);
+			channel.sendCount++;
+		}
+		return true;
+	}
+
+	/*
+	 * Function : Receive
+	 * Description :
+	 *   Takes the next message of a channel that is ready for delivery,
+	 *   without copying it: a message that came in one packet is returned
+	 *   where it arrived, one that came in fragments is gathered once into
+	 *   the channel's reassembly buffer.
+	 * Parameters :
+	 *   int index - The channel.
+	 *   MessageView& view - Receives the message.
+	 * Return :
+	 *   bool - Returns false if no message is ready.
+	 */
+	bool Receive(int index, MessageView& view)
+	{
+		assert(index >= 0 && index < (int)m_channels.size());
+		Channel& channel = m_channels[index];
+		const int capacity = (int)channel.receive.size();
+		switch (channel.config.type)
+		{
+		case ChannelType::ReliableOrdered:
+		{
+			// the next id in order, or nothing while it or one of its fragments is missing
+			const Message& first = channel.receive[channel.receiveNext % capacity];
+			if (!first.used || first.id != channel.receiveNext || first.fragment != 0 ||
+				(first.fragments > 1 && Arrivals(channel, channel.receiveNext) < first.fragments))
+			{
+				return false;
+			}
+			Take(channel, channel.receiveNext, view);
+			channel.receiveNext += first.fragments;
+			return true;
+		}
+
+		case ChannelType::ReliableUnordered:
+			if (channel.readyCount == 0)
+			{
+				return false;
+			}
+			Take(channel, channel.ready[channel.readyHead], view);
+			channel.readyHead = (channel.readyHead + 1) % capacity;
+			channel.readyCount--;
+			return true;
+
+		case ChannelType::UnreliableSequenced:
+		{
+			if (channel.readyCount == 0)
+			{
+				return false;
+			}
+			Message& message = channel.receive[channel.readyHead];
+			channel.readyHead = (channel.readyHead + 1) % capacity;
+			channel.readyCount--;
+			message.used = false;
+			view.data = message.data.data();
+			view.size = message.size;
+			return true;
+		}
+		}
+		return false;
+	}
+
+	/*
+	 * Function : Receive
+	 * Description :
+	 *   Copies out the next message of a channel that is ready for delivery.
+	 * Parameters :
+	 *   int index - The channel.
+	 *   void* data - Receives the message.
+	 *   int size - Room in data, a longer message is cut short.
+	 * Return :
+	 *   int - The number of bytes copied, 0 if no message is ready.
+	 */
+	int Receive(int index, void* data, int size)
+	{
+		MessageView view;
+		if (!Receive(index, view))
+		{
+			return 0;
+		}
+		const int length = std::min(view.size, size);
+		memcpy(data, view.data, length);
+		return length;
+	}
+
+	/*
+	 * Function : ReceivePackets
+	 * Description :
+	 *   Reads every waiting packet from the connection, files its messages
+	 *   into their channels, and releases the reliable messages the peer
+	 *   has acknowledged, and takes the peer's windows. A reliable message
+	 *   with no room left for it drops the connection, see IsFailed.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   int - The number of packets read.
+	 */
+	int ReceivePackets()
+	{
+		unsigned char packet[MaxPacketBytes];
+		int packets = 0;
+		int bytes;
+		while (!m_failed && (bytes = m_connection.ReceivePacket(packet, sizeof(packet))) > 0)
+		{
+			packets++;
+			int offset = 0;
+			while (!m_failed && offset + MessageHeader <= bytes)
+			{
+				const int index = packet[offset] & ~(FragmentFlag | WindowFlag);
+				const bool fragmented = (packet[offset] & FragmentFlag) != 0;
+				const bool window = (packet[offset] & WindowFlag) != 0;
+				const uint16_t id = (uint16_t)(packet[offset + 1] << 8 | packet[offset + 2]);
+				const int size = packet[offset + 3] << 8 | packet[offset + 4];
+				offset += MessageHeader;
+				if (window)
+				{
+					if (index < (int)m_channels.size() && IsReliable(m_channels[index]) && IsAhead(id, m_channels[index].sendLimit))
+					{
+						m_channels[index].sendLimit = id;
+					}
+					continue;
+				}
+				int fragment = 0;
+				int fragments = 1;
+				if (fragmented)
+				{
+					if (offset + FragmentHeader > bytes)
+					{
+						break;
+					}
+					fragment = packet[offset] << 8 | packet[offset + 1];
+					fragments = packet[offset + 2] << 8 | packet[offset + 3];
+					offset += FragmentHeader;
+				}
+				if (size <= 0 || size > GetMaxMessageSize() || offset + size > bytes)
+				{
+					break;
+				}
+				if (index < (int)m_channels.size() && fragment < fragments && fragments <= m_channels[index].fragments)
+				{
+					Deliver(m_channels[index], id, fragment, fragments, packet + offset, size);
+				}
+				offset += size;
+			}
+		}
+		// a large message can send more packets between updates than the history remembers
+		ProcessAcks();
+		return packets;
+	}
+
+	/*
+	 * Function : Flush
+	 * Description :
+	 *   Sends every queued message and every reliable message whose
+	 *   previous copy has gone unacknowledged for a retransmission timeout,
+	 *   packed into as few packets as they fit in. The channels take turns
+	 *   by priority and weight, so a budget keeps both a large message from
+	 *   leaving as one burst bigger than the peer's socket buffer and a bulk
+	 *   channel from holding back the others; what does not fit waits for
+	 *   the next Flush.
+	 * Parameters :
+	 *   int maxPackets - The most packets to send.
+	 * Return :
+	 *   int - The number of packets sent.
+	 */
+	int Flush(int maxPackets = INT_MAX)
+	{
+		return Flush(maxPackets, nullptr);
+	}
+
+	/*
+	 * Function : Flush
+	 * Description :
+	 *   Sends what the pacer allows now, a full packet's worth of its tokens
+	 *   per packet, with the channels taking turns as above.
+	 * Parameters :
+	 *   net::Pacer& pacer - The pacer holding the send budget of flow or
+	 *   congestion control.
+	 * Return :
+	 *   int - The number of packets sent.
+	 */
+	int Flush(net::Pacer& pacer)
+	{
+		return Flush(INT_MAX, &pacer);
+	}
+
+	/*
+	 * Function : Update
+	 * Description :
+	 *   Releases the reliable messages the peer has acknowledged, flushes,
+	 *   and updates the connection. Call it instead of the connection's own
+	 *   Update, which forgets the acknowledgements.
+	 * Parameters :
+	 *   float deltaTime - Seconds since the previous update.
+	 * Return :
+	 *   void
+	 */
+	void Update(float deltaTime)
+	{
+		m_time += deltaTime;
+		ProcessAcks();
+		Flush();
+		m_connection.Update(deltaTime);
+		m_acksSeen = 0;
+	}
+
+	/*
+	 * Function : Reset
+	 * Description :
+	 *   Empties every channel and restarts its message ids, as after a
+	 *   reconnect. The channels themselves are kept.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Reset()
+	{
+		for (Channel& channel : m_channels)
+		{
+			for (Message& message : channel.send)
+			{
+				message.used = false;
+			}
+			for (Message& message : channel.receive)
+			{
+				message.used = false;
+				message.arrivals = 0;
+			}
+			std::fill(channel.seen.begin(), channel.seen.end(), 0);
+			channel.sendNext = 0;
+			channel.sendOldest = 0;
+			channel.sendCount = 0;
+			channel.receiveNext = 0;
+			channel.readyHead = 0;
+			channel.readyCount = 0;
+			channel.lastReceived = 0;
+			channel.anyReceived = false;
+			channel.sendLimit = (uint16_t)channel.send.size();
+			channel.readOldest = 0;
+			channel.windowSent = 0;
+			channel.windowSentAt = -1.0f;
+			channel.windowAcked = 0;
+		}
+		m_failed = false;
+		m_scheduler.Reset();
+		for (SentPacket& sent : m_sent)
+		{
+			sent.count = 0;
+		}
+	}
+
+	/*
+	 * Function : GetPendingCount
+	 * Description :
+	 *   Returns how many messages of a channel are queued or waiting for
+	 *   their ack.
+	 * Parameters :
+	 *   int index - The channel.
+	 * Return :
+	 *   int - The number of messages.
+	 */
+	int GetPendingCount(int index) const
+	{
+		return m_channels[index].sendCount;
+	}
+
+	/*
+	 * Function : IsFailed
+	 * Description :
+	 *   Returns whether the peer sent a reliable message past the window
+	 *   this end gave it. The packet carrying it was already acknowledged,
+	 *   so it would never come again: the connection is dropped instead of
+	 *   losing it silently. Reset clears it.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - True once a reliable message had to be refused.
+	 */
+	bool IsFailed() const
+	{
+		return m_failed;
+	}
+
+	/*
+	 * Function : GetResentMessages
+	 * Description :
+	 *   Returns how many reliable messages were sent again.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The number of copies sent after the first.
+	 */
+	unsigned long long GetResentMessages() const
+	{
+		return m_resent;
+	}
+
+	/*
+	 * Function : GetSentBytes
+	 * Description :
+	 *   Returns how many bytes of messages a channel has put in packets,
+	 *   copies sent again included.
+	 * Parameters :
+	 *   int index - The channel.
+	 * Return :
+	 *   unsigned long long - The number of bytes, headers included.
+	 */
+	unsigned long long GetSentBytes(int index) const
+	{
+		return m_scheduler.GetSentBytes(index);
+	}
+
+private:
+	static const int SentHistory = 1024;        // packets remembered until acked, a 64 KB message in flight and then some
+	static const int MaxPacketMessages = 64;
+	static const int FragmentFlag = 0x80;       // in the channel byte, a fragment header follows the size
+	static const int WindowFlag = 0x40;         // in the channel byte, the id is the channel's window and no data follows
+	static constexpr float MinResendTime = 0.01f;
+
+	struct Message
+	{
+		uint16_t id = 0;
+		bool used = false;
+		float lastSent = -1.0f;                 // send side: time of the latest copy, -1 before the first
+		uint16_t fragment = 0;                  // index within its message
+		uint16_t fragments = 1;                 // 1 for a message sent whole
+		int size = 0;
+		std::vector<unsigned char> data;
+		uint16_t arrivalsFor = 0;               // receive side, in the slot of a message's first id:
+		int arrivals = 0;                       // how many of its fragments have arrived
+	};
+
+	struct Channel
+	{
+		ChannelConfig config;
+		std::vector<Message> send;              // by id for reliable channels, a FIFO for unreliable ones
+		uint16_t sendNext = 0;                  // id of the next message queued
+		uint16_t sendOldest = 0;                // oldest id queued or awaiting its ack
+		int sendCount = 0;
+		std::vector<Message> receive;           // by id when reliable, a FIFO of ready messages when unreliable
+		uint16_t receiveNext = 0;               // ordered: next id to deliver, unordered: oldest id not yet seen
+		int readyHead = 0;
+		int readyCount = 0;
+		std::vector<unsigned char> seen;        // unordered: ids received ahead of receiveNext
+		std::vector<uint16_t> ready;            // unordered: first ids of complete messages, a FIFO
+		uint16_t scan = 0;                      // Flush: next id to look at
+		int fragments = 1;                      // most fragments a message may have
+		std::vector<unsigned char> assembly;    // where fragmented messages are gathered
+		uint16_t lastReceived = 0;              // unreliable: newest id delivered
+		bool anyReceived = false;
+		uint16_t sendLimit = 0;                 // reliable: first id the peer has no room for yet
+		uint16_t readOldest = 0;                // unordered: oldest id whose slot may still be taken
+		uint16_t windowSent = 0;                // reliable: window in the latest packet that carried it
+		float windowSentAt = -1.0f;
+		uint16_t windowAcked = 0;               // reliable: window the peer is known to have, 0 before the first
+	};
+
+	struct SentPacket
+	{
+		unsigned int sequence = 0;
+		int count = 0;                          // messages in the packet, 0 once acked or forgotten
+		uint8_t channels[MaxPacketMessages];
+		uint16_t ids[MaxPacketMessages];
+	};
+
+	static int RoundUpToPowerOfTwo(int size)
+	{
+		int rounded = 1;
+		while (rounded < size && rounded <= MaxQueueSize)
+		{
+			rounded <<= 1;
+		}
+		return rounded;
+	}
+
+	static bool IsReliable(const Channel& channel)
+	{
+		return channel.config.type != ChannelType::UnreliableSequenced;
+	}
+
+	int GetFragmentSize() const
+	{
+		return GetMaxMessageSize() - FragmentHeader;
+	}
+
+	int FragmentCount(int size) const
+	{
+		return (size + GetFragmentSize() - 1) / GetFragmentSize();
+	}
+
+	int Flush(int maxPackets, net::Pacer* pacer)
+	{
+		const float resend = std::max(m_connection.GetReliabilitySystem().GetRetransmissionTimeout(), MinResendTime);
+		for (Channel& channel : m_channels)
+		{
+			channel.scan = channel.sendOldest;
+		}
+		m_packetSize = 0;
+		m_packetMessages = 0;
+		int packets = 0;
+		int index;
+		while ((index = m_scheduler.Pick([this, resend](int stream) { return NextDue(m_channels[stream], resend); })) >= 0)
+		{
+			Channel& channel = m_channels[index];
+			Message& message = channel.send[channel.scan % channel.send.size()];
+			if (m_packetSize + EntrySize(message) > m_packetBytes || m_packetMessages == MaxPacketMessages)
+			{
+				packets += SendPacket();
+			}
+			// each packet is paid for before the first message goes in, and carries the windows that are due
+			if (m_packetSize == 0)
+			{
+				if (packets >= maxPackets || (pacer != nullptr && !pacer->TryConsume(m_packetBytes)))
+				{
+					m_scheduler.Unpick(index, EntrySize(message));
+					break;
+				}
+				AppendWindows(m_packetBytes - EntrySize(message), resend);
+			}
+			if (message.lastSent >= 0.0f)
+			{
+				m_resent++;
+			}
+			Append(index, message);
+			message.lastSent = m_time;
+			channel.scan++;
+		}
+		if (m_packetSize > 0)
+		{
+			packets += SendPacket();
+		}
+		// a window that moved far enough goes on its own when no message had room for it
+		if (packets < maxPackets && IsWindowUrgent(resend) && (pacer == nullptr || pacer->TryConsume(m_packetBytes)))
+		{
+			AppendWindows(m_packetBytes, resend);
+			packets += SendPacket();
+		}
+		// unreliable messages go once, successful or not
+		for (Channel& channel : m_channels)
+		{
+			if (IsReliable(channel))
+			{
+				continue;
+			}
+			const int capacity = (int)channel.send.size();
+			for (; channel.sendOldest != channel.scan; channel.sendOldest++)
+			{
+				channel.send[channel.sendOldest % capacity].used = false;
+				channel.sendCount--;
+			}
+		}
+		return packets;
+	}
+
+	// size of the next message Flush should send from a channel, 0 when it has none
+	int NextDue(Channel& channel, float resend) const
+	{
+		const int capacity = (int)channel.send.size();
+		for (; channel.scan != channel.sendNext; channel.scan++)
+		{
+			const Message& message = channel.send[channel.scan % capacity];
+			// first copies go in id order, so none after one the peer has no room for can go either
+			if (message.used && message.lastSent < 0.0f && IsReliable(channel) && !IsAhead(channel.sendLimit, channel.scan))
+			{
+				return 0;
+			}
+			if (message.used && (message.lastSent < 0.0f || m_time - message.lastSent >= resend))
+			{
+				return EntrySize(message);
+			}
+		}
+		return 0;
+	}
+
+	static int EntrySize(const Message& message)
+	{
+		return MessageHeader + (message.fragments > 1 ? FragmentHeader : 0) + message.size;
+	}
+
+	// whether message id "a" is newer than "b", across the wrap of the 16 bit ids
+	static bool IsNewer(uint16_t a, uint16_t b)
+	{
+		return (int16_t)(a - b) > 0;
+	}
+
+	// whether "a" is ahead of "b" by at most a whole queue, as far as a window can lead an id
+	static bool IsAhead(uint16_t a, uint16_t b)
+	{
+		const uint16_t distance = (uint16_t)(a - b);
+		return distance != 0 && distance <= MaxQueueSize;
+	}
+
+	// first id a reliable channel has no room for yet
+	uint16_t ReceiveLimit(Channel& channel)
+	{
+		const int capacity = (int)channel.receive.size();
+		if (channel.config.type == ChannelType::ReliableUnordered)
+		{
+			// ids before receiveNext have all arrived, their slots free up as they are read
+			while (channel.readOldest != channel.receiveNext && !channel.receive[channel.readOldest % capacity].used)
+			{
+				channel.readOldest++;
+			}
+			return (uint16_t)(channel.readOldest + capacity);
+		}
+		return (uint16_t)(channel.receiveNext + capacity);
+	}
+
+	// whether a channel's window moved past what the peer has and is not already on its way
+	bool IsWindowDue(Channel& channel, float resend)
+	{
+		if (!IsReliable(channel))
+		{
+			return false;
+		}
+		const uint16_t limit = ReceiveLimit(channel);
+		return limit != channel.windowAcked &&
+			(limit != channel.windowSent || channel.windowSentAt < 0.0f || m_time - channel.windowSentAt >= resend);
+	}
+
+	// whether a due window has moved a quarter of its queue, worth a packet of its own
+	bool IsWindowUrgent(float resend)
+	{
+		for (Channel& channel : m_channels)
+		{
+			if (IsWindowDue(channel, resend) && (uint16_t)(ReceiveLimit(channel) - channel.windowAcked) >= (int)channel.receive.size() / 4)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void AppendWindows(int room, float resend)
+	{
+		for (int index = 0; index < (int)m_channels.size(); index++)
+		{
+			Channel& channel = m_channels[index];
+			if (m_packetSize + MessageHeader > room || m_packetMessages == MaxPacketMessages)
+			{
+				return;
+			}
+			if (!IsWindowDue(channel, resend))
+			{
+				continue;
+			}
+			const uint16_t limit = ReceiveLimit(channel);
+			unsigned char* entry = m_packet + m_packetSize;
+			entry[0] = (unsigned char)(index | WindowFlag);
+			entry[1] = (unsigned char)(limit >> 8);
+			entry[2] = (unsigned char)(limit & 0xFF);
+			entry[3] = 0;
+			entry[4] = 0;
+			m_packetSize += MessageHeader;
+			m_packetChannels[m_packetMessages] = (uint8_t)(index | WindowFlag);
+			m_packetIds[m_packetMessages] = limit;
+			m_packetMessages++;
+			channel.windowSent = limit;
+			channel.windowSentAt = m_time;
+		}
+	}
+
+	void Append(int index, const Message& message)
+	{
+		unsigned char* entry = m_packet + m_packetSize;
+		entry[0] = (unsigned char)(index | (message.fragments > 1 ? FragmentFlag : 0));
+		entry[1] = (unsigned char)(message.id >> 8);
+		entry[2] = (unsigned char)(message.id & 0xFF);
+		entry[3] = (unsigned char)(message.size >> 8);
+		entry[4] = (unsigned char)(message.size & 0xFF);
+		int header = MessageHeader;
+		if (message.fragments > 1)
+		{
+			entry[5] = (unsigned char)(message.fragment >> 8);
+			entry[6] = (unsigned char)(message.fragment & 0xFF);
+			entry[7] = (unsigned char)(message.fragments >> 8);
+			entry[8] = (unsigned char)(message.fragments & 0xFF);
+			header += FragmentHeader;
+		}
+		memcpy(entry + header, message.data.data(), message.size);
+		m_packetSize += header + message.size;
+		m_packetChannels[m_packetMessages] = (uint8_t)index;
+		m_packetIds[m_packetMessages] = message.id;
+		m_packetMessages++;
+	}
+
+	int SendPacket()
+	{
+		const unsigned int sequence = m_connection.GetReliabilitySystem().GetLocalSequence();
+		const bool sent = m_connection.SendPacket(m_packet, m_packetSize);
+		if (sent)
+		{
+			// remember the reliable messages and the windows so the packet's ack can release them
+			SentPacket& record = m_sent[sequence % SentHistory];
+			record.sequence = sequence;
+			record.count = 0;
+			for (int i = 0; i < m_packetMessages; i++)
+			{
+				if ((m_packetChannels[i] & WindowFlag) || IsReliable(m_channels[m_packetChannels[i]]))
+				{
+					record.channels[record.count] = m_packetChannels[i];
+					record.ids[record.count] = m_packetIds[i];
+					record.count++;
+				}
+			}
+		}
+		m_packetSize = 0;
+		m_packetMessages = 0;
+		return sent ? 1 : 0;
+	}
+
+	// the connection collects acks until its next Update, only the ones not seen yet are new
+	void ProcessAcks()
+	{
+		unsigned int* acks = nullptr;
+		int count = 0;
+		m_connection.GetReliabilitySystem().GetAcks(&acks, count);
+		if (count < m_acksSeen)
+		{
+			m_acksSeen = 0;
+		}
+		for (int i = m_acksSeen; i < count; i++)
+		{
+			SentPacket& record = m_sent[acks[i] % SentHistory];
+			if (record.count == 0 || record.sequence != acks[i])
+			{
+				continue;
+			}
+			for (int j = 0; j < record.count; j++)
+			{
+				if (record.channels[j] & WindowFlag)
+				{
+					Channel& channel = m_channels[record.channels[j] & ~WindowFlag];
+					if (channel.windowAcked == 0 || IsAhead(record.ids[j], channel.windowAcked))
+					{
+						channel.windowAcked = record.ids[j];
+					}
+				}
+				else
+				{
+					Acked(m_channels[record.channels[j]], record.ids[j]);
+				}
+			}
+			record.count = 0;
+		}
+		m_acksSeen = count;
+	}
+
+	void Acked(Channel& channel, uint16_t id)
+	{
+		const int capacity = (int)channel.send.size();
+		Message& message = channel.send[id % capacity];
+		if (!message.used || message.id != id)
+		{
+			return;
+		}
+		message.used = false;
+		channel.sendCount--;
+		while (channel.sendOldest != channel.sendNext && !channel.send[channel.sendOldest % capacity].used)
+		{
+			channel.sendOldest++;
+		}
+	}
+
+	// fragments arrived so far of the message starting at id, counted in its first slot
+	static int Arrivals(const Channel& channel, uint16_t start)
+	{
+		const Message& first = channel.receive[start % channel.receive.size()];
+		return first.arrivalsFor == start ? first.arrivals : 0;
+	}
+
+	static int CountArrival(Channel& channel, uint16_t start)
+	{
+		Message& first = channel.receive[start % channel.receive.size()];
+		if (first.arrivalsFor != start)
+		{
+			first.arrivalsFor = start;
+			first.arrivals = 0;
+		}
+		return ++first.arrivals;
+	}
+
+	// releases a complete reliable message, gathering its fragments if it has any
+	void Take(Channel& channel, uint16_t start, MessageView& view)
+	{
+		const int capacity = (int)channel.receive.size();
+		Message& first = channel.receive[start % capacity];
+		first.used = false;
+		if (first.fragments == 1)
+		{
+			view.data = first.data.data();
+			view.size = first.size;
+			return;
+		}
+		int size = 0;
+		for (int i = 0; i < first.fragments; i++)
+		{
+			Message& fragment = channel.receive[(uint16_t)(start + i) % capacity];
+			const int length = std::min(fragment.size, (int)channel.assembly.size() - size);
+			memcpy(channel.assembly.data() + size, fragment.data.data(), length);
+			size += length;
+			fragment.used = false;
+		}
+		if (first.arrivalsFor == start)
+		{
+			first.arrivals = 0;
+		}
+		view.data = channel.assembly.data();
+		view.size = size;
+	}
+
+	// a reliable message past the window this end gave is lost for good, so the connection goes with it
+	void Fail()
+	{
+		m_failed = true;
+		m_connection.Disconnect();
+	}
+
+	void Deliver(Channel& channel, uint16_t id, int fragment, int fragments, const unsigned char* data, int size)
+	{
+		const int capacity = (int)channel.receive.size();
+		const uint16_t start = (uint16_t)(id - fragment);
+		Message* message = nullptr;
+		switch (channel.config.type)
+		{
+		case ChannelType::ReliableOrdered:
+			// held by id until everything before it has been read
+			if (IsNewer(channel.receiveNext, start))
+			{
+				return;
+			}
+			if ((uint16_t)(id - channel.receiveNext) >= capacity)
+			{
+				Fail();
+				return;
+			}
+			message = &channel.receive[id % capacity];
+			if (message->used)
+			{
+				return;
+			}
+			break;
+
+		case ChannelType::ReliableUnordered:
+			// delivered once all of it is here, the seen window only filters out copies
+			if (IsNewer(channel.receiveNext, id) || channel.seen[id % capacity])
+			{
+				return;
+			}
+			if ((uint16_t)(id - channel.receiveNext) >= capacity || channel.receive[id % capacity].used)
+			{
+				Fail();
+				return;
+			}
+			channel.seen[id % capacity] = 1;
+			while (channel.seen[channel.receiveNext % capacity])
+			{
+				channel.seen[channel.receiveNext % capacity] = 0;
+				channel.receiveNext++;
+			}
+			message = &channel.receive[id % capacity];
+			break;
+
+		case ChannelType::UnreliableSequenced:
+			// a newer message makes older ones stale, and a full queue gives up its oldest
+			if (channel.anyReceived && !IsNewer(id, channel.lastReceived))
+			{
+				return;
+			}
+			channel.lastReceived = id;
+			channel.anyReceived = true;
+			if (channel.readyCount == capacity)
+			{
+				channel.readyHead = (channel.readyHead + 1) % capacity;
+				channel.readyCount--;
+			}
+			message = &channel.receive[(channel.readyHead + channel.readyCount++) % capacity];
+			break;
+		}
+		message->id = id;
+		message->used = true;
+		message->fragment = (uint16_t)fragment;
+		message->fragments = (uint16_t)fragments;
+		message->size = size;
+		memcpy(message->data.data(), data, size);
+
+		const bool complete = fragments == 1 || CountArrival(channel, start) == fragments;
+		if (complete && channel.config.type == ChannelType::ReliableUnordered)
+		{
+			channel.ready[(channel.readyHead + channel.readyCount++) % capacity] = start;
+		}
+	}
+
+	net::ReliableConnection& m_connection;
+	int m_packetBytes;
+	std::vector<Channel> m_channels;
+	std::vector<SentPacket> m_sent;             // by packet sequence
+	SendScheduler m_scheduler;                  // one stream per channel
+	float m_time = 0.0f;
+	unsigned long long m_resent = 0;
+	bool m_failed = false;                      // a reliable message was refused for lack of room
+	int m_acksSeen = 0;                         // acks of the connection already processed
+
+	unsigned char m_packet[MaxPacketBytes];     // packet being filled by Flush
+	int m_packetSize = 0;
+	int m_packetMessages = 0;
+	uint8_t m_packetChannels[MaxPacketMessages];
+	uint16_t m_packetIds[MaxPacketMessages];
+};
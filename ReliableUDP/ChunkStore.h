@@ -0,0 +1,342 @@
+/*
+* FILE : ChunkStore.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides content-defined chunking and a content-addressed
+*   chunk store. Files are cut into variable sized chunks at positions chosen
+*   by a rolling Gear hash, so identical regions in different files produce
+*   identical chunks regardless of their offset. The receiver keeps every
+*   chunk it has seen on disk, indexed by its MD5 digest, and can rebuild the
+*   parts of a new file it already holds without them being transferred.
+*/
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+
+#include "Protocol.h"
+#include "Log.h"
+#include "md5.h"
+
+#define CHUNK_MIN_SIZE      (2 * 1024)
+#define CHUNK_AVG_BITS      13          // 8 KiB average chunk
+#define CHUNK_MAX_SIZE      (64 * 1024)
+
+/*
+ * Struct : ChunkRef
+ * Description :
+ *   Location and identity of one chunk inside a file.
+ */
+struct ChunkRef
+{
+	uint64_t    offset;
+	uint32_t    size;
+	uint8_t     md5[MD5_HASH_LENGTH];
+	bool        present;    // receiver already holds this chunk
+};
+
+/*
+ * Class : Chunker
+ * Description :
+ *   Splits a buffer into content-defined chunks using a Gear rolling hash.
+ *   A boundary is declared where the low CHUNK_AVG_BITS bits of the hash are
+ *   zero, subject to the minimum and maximum chunk sizes.
+ */
+class Chunker
+{
+public:
+	/*
+	 * Function : Split
+	 * Description :
+	 *   Cuts the buffer into chunks and computes the MD5 digest of each one.
+	 * Parameters :
+	 *   const uint8_t* data - The buffer to split.
+	 *   size_t size - The number of bytes in the buffer.
+	 *   std::vector<ChunkRef>& chunks - Receives the chunk list, in offset order.
+	 * Return :
+	 *   void
+	 */
+	static void Split(const uint8_t* data, size_t size, std::vector<ChunkRef>& chunks)
+	{
+		chunks.clear();
+		Append(data, size, 0, true, chunks);
+	}
+
+	/*
+	 * Function : Append
+	 * Description :
+	 *   Cuts the chunks of one block of a file read piece by piece. A boundary
+	 *   only depends on the next CHUNK_MAX_SIZE bytes, so every chunk that
+	 *   starts at least that far from the end of the block is cut exactly as
+	 *   Split would; the rest is left for the next block.
+	 * Parameters :
+	 *   const uint8_t* data - The block, starting at the first byte not cut yet.
+	 *   size_t size - The number of bytes in the block.
+	 *   uint64_t offset - Where the block starts in the file.
+	 *   bool last - True if the block ends the file, so everything is cut.
+	 *   std::vector<ChunkRef>& chunks - Receives the new chunks, appended in offset order.
+	 * Return :
+	 *   size_t - The number of bytes cut, the block is to be resumed from there.
+	 */
+	static size_t Append(const uint8_t* data, size_t size, uint64_t offset, bool last, std::vector<ChunkRef>& chunks)
+	{
+		size_t done = 0;
+		while (done < size && (last || size - done >= CHUNK_MAX_SIZE))
+		{
+			size_t length = NextBoundary(data + done, size - done);
+
+			ChunkRef chunk = {};
+			chunk.offset = offset + done;
+			chunk.size = static_cast<uint32_t>(length);
+			Digest(data + done, length, chunk.md5);
+			chunks.push_back(chunk);
+
+			done += length;
+		}
+		return done;
+	}
+
+	/*
+	 * Function : Digest
+	 * Description :
+	 *   Computes the MD5 digest used as the chunk's content address.
+	 * Parameters :
+	 *   const uint8_t* data - The chunk bytes.
+	 *   size_t size - The chunk length.
+	 *   uint8_t* digest - Receives MD5_HASH_LENGTH bytes.
+	 * Return :
+	 *   void
+	 */
+	static void Digest(const uint8_t* data, size_t size, uint8_t* digest)
+	{
+		MD5Context ctx;
+		md5Init(&ctx);
+		md5Update(&ctx, const_cast<uint8_t*>(data), size);
+		md5Finalize(&ctx);
+		memcpy(digest, ctx.digest, MD5_HASH_LENGTH);
+	}
+
+private:
+	static size_t NextBoundary(const uint8_t* data, size_t size)
+	{
+		if (size <= CHUNK_MIN_SIZE)
+		{
+			return size;
+		}
+
+		const uint64_t* gear = GearTable();
+		const uint64_t mask = (1ull << CHUNK_AVG_BITS) - 1;
+		const size_t limit = size < CHUNK_MAX_SIZE ? size : CHUNK_MAX_SIZE;
+
+		uint64_t hash = 0;
+		for (size_t i = CHUNK_MIN_SIZE; i < limit; i++)
+		{
+			hash = (hash << 1) + gear[data[i]];
+			// Use the high bits of the hash, the low ones only depend on the last few bytes
+			if (((hash >> (64 - CHUNK_AVG_BITS)) & mask) == 0)
+			{
+				return i + 1;
+			}
+		}
+		return limit;
+	}
+
+	static const uint64_t* GearTable()
+	{
+		// Fixed seed so that every peer cuts identical data at identical positions
+		static uint64_t table[256];
+		static bool initialized = false;
+		if (!initialized)
+		{
+			uint64_t state = 0x9E3779B97F4A7C15ull;
+			for (int i = 0; i < 256; i++)
+			{
+				// splitmix64
+				uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+				z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+				z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+				table[i] = z ^ (z >> 31);
+			}
+			initialized = true;
+		}
+		return table;
+	}
+};
+
+/*
+ * Class : ChunkStore
+ * Description :
+ *   A directory of chunks named by the hex form of their MD5 digest. The set
+ *   of known digests is indexed in memory when the store is opened so that
+ *   lookups do not touch the disk.
+ */
+class ChunkStore
+{
+public:
+	/*
+	 * Function : Open
+	 * Description :
+	 *   Opens (creating if necessary) the store directory and indexes its chunks.
+	 * Parameters :
+	 *   const char* directory - The directory holding the chunk files.
+	 * Return :
+	 *   bool - Returns true if the store is usable, false otherwise.
+	 */
+	bool Open(const char* directory)
+	{
+		std::error_code error;
+		m_directory = directory;
+		std::filesystem::create_directories(m_directory, error);
+		if (error)
+		{
+			NET_ERROR("Error: Failed creating chunk store %s", directory);
+			return false;
+		}
+
+		m_index.clear();
+		for (const auto& entry : std::filesystem::directory_iterator(m_directory, error))
+		{
+			if (entry.is_regular_file() && entry.path().extension() == ".chunk")
+			{
+				m_index.insert(entry.path().stem().string());
+			}
+		}
+		m_open = true;
+		return true;
+	}
+
+	/*
+	 * Function : Has
+	 * Description :
+	 *   Checks whether a chunk with the given digest is stored.
+	 * Parameters :
+	 *   const uint8_t* md5 - The chunk digest.
+	 * Return :
+	 *   bool - Returns true if the chunk is in the store.
+	 */
+	bool Has(const uint8_t* md5) const
+	{
+		return m_open && m_index.count(ToHex(md5)) != 0;
+	}
+
+	/*
+	 * Function : Put
+	 * Description :
+	 *   Stores a chunk after checking that its content matches the digest.
+	 * Parameters :
+	 *   const uint8_t* md5 - The expected chunk digest.
+	 *   const uint8_t* data - The chunk bytes.
+	 *   size_t size - The chunk length.
+	 * Return :
+	 *   bool - Returns true if the chunk is stored (or already was), false otherwise.
+	 */
+	bool Put(const uint8_t* md5, const uint8_t* data, size_t size)
+	{
+		if (!m_open)
+		{
+			return false;
+		}
+
+		std::string name = ToHex(md5);
+		if (m_index.count(name) != 0)
+		{
+			return true;
+		}
+
+		uint8_t digest[MD5_HASH_LENGTH];
+		Chunker::Digest(data, size, digest);
+		if (memcmp(digest, md5, MD5_HASH_LENGTH) != 0)
+		{
+			return false;
+		}
+
+		// Write aside and rename so a crash never leaves a truncated chunk under its final name
+		std::filesystem::path path = m_directory / (name + ".chunk");
+		std::filesystem::path temp = m_directory / (name + ".tmp");
+		{
+			std::ofstream file(temp, std::ios::binary);
+			if (!file)
+			{
+				NET_ERROR("Error: Failed opening chunk to write! %s", temp.string().c_str());
+				return false;
+			}
+			file.write(reinterpret_cast<const char*>(data), size);
+		}
+		std::error_code error;
+		std::filesystem::rename(temp, path, error);
+		if (error)
+		{
+			return false;
+		}
+
+		m_index.insert(name);
+		return true;
+	}
+
+	/*
+	 * Function : Get
+	 * Description :
+	 *   Reads a stored chunk.
+	 * Parameters :
+	 *   const uint8_t* md5 - The chunk digest.
+	 *   uint8_t* data - Receives the chunk bytes.
+	 *   size_t size - The expected chunk length.
+	 * Return :
+	 *   bool - Returns true if exactly size bytes were read, false otherwise.
+	 */
+	bool Get(const uint8_t* md5, uint8_t* data, size_t size) const
+	{
+		if (!Has(md5))
+		{
+			return false;
+		}
+
+		std::ifstream file(m_directory / (ToHex(md5) + ".chunk"), std::ios::binary);
+		if (!file)
+		{
+			return false;
+		}
+		file.read(reinterpret_cast<char*>(data), size);
+		return static_cast<size_t>(file.gcount()) == size;
+	}
+
+	/*
+	 * Function : GetCount
+	 * Description :
+	 *   Returns the number of chunks in the store.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of indexed chunks.
+	 */
+	size_t GetCount() const
+	{
+		return m_index.size();
+	}
+
+private:
+	static std::string ToHex(const uint8_t* md5)
+	{
+		static const char digits[] = "0123456789abcdef";
+		std::string hex(MD5_HASH_LENGTH * 2, '0');
+		for (int i = 0; i < MD5_HASH_LENGTH; i++)
+		{
+			hex[i * 2] = digits[md5[i] >> 4];
+			hex[i * 2 + 1] = digits[md5[i] & 0x0F];
+		}
+		return hex;
+	}
+
+	bool m_open = false;
+	std::filesystem::path m_directory;
+	std::unordered_set<std::string> m_index;
+};
@@ -0,0 +1,267 @@
+/*
+* FILE : Coalescer.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides a send-side coalescer in the manner of Nagle's
+*   algorithm. Small messages handed to it wait in a batch datagram until
+*   the next one no longer fits or the oldest has waited the flush
+*   deadline, so a burst of small messages costs one datagram and one
+*   system call instead of one each. The receiver splits a batch back into
+*   its messages; a datagram that is not a batch is a single message.
+*/
+
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "Net.h"
+#include "Protocol.h"
+
+/*
+ * Class : MessageCoalescer
+ * Description :
+ *   Packs small messages sent over a ReliableConnection into batch
+ *   datagrams no larger than the packet size. A message too large to share
+ *   a datagram leaves on its own, after whatever is waiting, so messages
+ *   keep their order.
+ */
+class MessageCoalescer
+{
+public:
+	static constexpr float DefaultDeadline = 0.002f;
+	static const int MaxPacketBytes = net::PacketSizeHack - 12;   // room left by the reliable header
+
+	/*
+	 * Function : MessageCoalescer
+	 * Description :
+	 *   Sets up a coalescer for a connection.
+	 * Parameters :
+	 *   net::ReliableConnection& connection - The connection to send on.
+	 *   float deadline - Longest a message waits for company, 0 sends every message at once.
+	 *   int packetBytes - Largest datagram payload to build.
+	 * Return :
+	 *   None
+	 */
+	MessageCoalescer(net::ReliableConnection& connection, float deadline = DefaultDeadline, int packetBytes = PACKET_SIZE)
+		: m_connection(connection), m_packetBytes(std::min(packetBytes, (int)MaxPacketBytes))
+	{
+		SetDeadline(deadline);
+	}
+
+	/*
+	 * Function : SetDeadline
+	 * Description :
+	 *   Changes how long a message may wait for others to share its
+	 *   datagram. Messages already waiting leave at once when it is 0.
+	 * Parameters :
+	 *   float seconds - The flush deadline, 0 to turn coalescing off.
+	 * Return :
+	 *   void
+	 */
+	void SetDeadline(float seconds)
+	{
+		m_deadline = seconds > 0.0f ? (unsigned long long)(seconds * 1000000000.0f) : 0;
+		if (m_deadline == 0)
+		{
+			Flush();
+		}
+	}
+
+	/*
+	 * Function : Send
+	 * Description :
+	 *   Adds a message to the waiting batch, sending the batch first if the
+	 *   message does not fit in it.
+	 * Parameters :
+	 *   const void* data - The message, starting with its typeFlag.
+	 *   int size - Its size in bytes.
+	 * Return :
+	 *   bool - Returns false if the connection failed to send.
+	 */
+	bool Send(const void* data, int size)
+	{
+		if (size <= 0)
+		{
+			return false;
+		}
+		uint8_t length[MAX_VARINT_SIZE];
+		const int header = (int)WriteVarint(length, (uint64_t)size);
+		if (m_deadline == 0 || 1 + header + size > m_packetBytes)
+		{
+			// too large to share a datagram, or coalescing is off
+			bool sent = Flush() >= 0;
+			sent = m_connection.SendPacket((const unsigned char*)data, size) && sent;
+			m_messages++;
+			m_packets++;
+			return sent;
+		}
+		bool sent = true;
+		if (m_size + header + size > m_packetBytes)
+		{
+			sent = Flush() > 0;
+		}
+		if (m_count == 0)
+		{
+			m_packet[0] = TYPE_BATCH;
+			m_size = 1;
+			m_oldest = net::time_now_ns();
+		}
+		memcpy(m_packet + m_size, length, header);
+		memcpy(m_packet + m_size + header, data, size);
+		if (m_count == 0)
+		{
+			m_first = m_size + header;
+		}
+		m_size += header + size;
+		m_count++;
+		m_messages++;
+		return sent;
+	}
+
+	/*
+	 * Function : Poll
+	 * Description :
+	 *   Sends the waiting batch once its oldest message reaches the deadline.
+	 *   Call it at least as often as the deadline from the send loop.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   int - The number of datagrams sent, 0 or 1.
+	 */
+	int Poll()
+	{
+		if (m_count == 0 || net::time_now_ns() < m_oldest + m_deadline)
+		{
+			return 0;
+		}
+		return Flush();
+	}
+
+	/*
+	 * Function : Flush
+	 * Description :
+	 *   Sends the waiting batch now. A lone message goes without the batch
+	 *   framing.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   int - The number of datagrams sent, 0 or 1, or -1 if sending failed.
+	 */
+	int Flush()
+	{
+		if (m_count == 0)
+		{
+			return 0;
+		}
+		const bool sent = m_count == 1 ?
+			m_connection.SendPacket(m_packet + m_first, m_size - m_first) :
+			m_connection.SendPacket(m_packet, m_size);
+		m_packets++;
+		m_count = 0;
+		m_size = 0;
+		return sent ? 1 : -1;
+	}
+
+	/*
+	 * Function : GetNextFlush
+	 * Description :
+	 *   Returns when the waiting batch is due, for the send loop to wake up
+	 *   in time.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The time in nanoseconds, ~0 when nothing waits.
+	 */
+	unsigned long long GetNextFlush() const
+	{
+		return m_count > 0 ? m_oldest + m_deadline : ~0ULL;
+	}
+
+	/*
+	 * Function : GetMessages
+	 * Description :
+	 *   Returns how many messages were sent.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The number of messages.
+	 */
+	unsigned long long GetMessages() const
+	{
+		return m_messages;
+	}
+
+	/*
+	 * Function : GetPackets
+	 * Description :
+	 *   Returns how many datagrams carried those messages.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The number of datagrams.
+	 */
+	unsigned long long GetPackets() const
+	{
+		return m_packets;
+	}
+
+	/*
+	 * Function : Split
+	 * Description :
+	 *   Hands each message of a received datagram to a handler: every
+	 *   message of a batch, or the datagram itself if it is not one. A
+	 *   truncated batch stops at its last whole message.
+	 * Parameters :
+	 *   const unsigned char* packet - The datagram payload.
+	 *   int size - Its size in bytes.
+	 *   Handler&& handler - Called as handler(const unsigned char* message, int size).
+	 * Return :
+	 *   int - The number of messages handed out.
+	 */
+	template<typename Handler>
+	static int Split(const unsigned char* packet, int size, Handler&& handler)
+	{
+		if (size <= 0)
+		{
+			return 0;
+		}
+		if (packet[0] != TYPE_BATCH)
+		{
+			handler(packet, size);
+			return 1;
+		}
+		int count = 0;
+		int offset = 1;
+		while (offset < size)
+		{
+			uint64_t length = 0;
+			const int header = (int)ReadVarint(packet + offset, size - offset, length);
+			if (header == 0 || length == 0 || length > (uint64_t)(size - offset - header))
+			{
+				break;
+			}
+			handler(packet + offset + header, (int)length);
+			offset += header + (int)length;
+			count++;
+		}
+		return count;
+	}
+
+private:
+	net::ReliableConnection& m_connection;
+	int m_packetBytes;
+	unsigned long long m_deadline = 0;          // nanoseconds, 0 when coalescing is off
+
+	unsigned char m_packet[MaxPacketBytes];     // the batch being filled
+	int m_size = 0;
+	int m_count = 0;
+	int m_first = 0;                            // where the first message starts
+	unsigned long long m_oldest = 0;            // when the first message was added
+
+	unsigned long long m_messages = 0;
+	unsigned long long m_packets = 0;
+};
@@ -0,0 +1,1122 @@
+/*
+* FILE : Download.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides pull-based downloads. A `DownloadServer` answers many
+*   downloaders from one UDP socket: each peer gets its own
+*   `ReliableConnection` and pacer, and every peer asking for the same file
+*   is served from one shared `FileSlices` copy. A `Downloader` asks for a
+*   file by name and requests any number of byte ranges at once, which the
+*   server streams back in turn, or fetches and verifies the whole file. A
+*   download may run over several paths, each its own socket, which the
+*   server stripes the slices across, and from several servers holding
+*   the same file, which share the slices as the transfer proceeds.
+*/
+
+#pragma once
+
+#include <map>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <cstdio>
+#include <cstring>
+
+#include "Net.h"
+#include "NetEmulator.h"
+#include "Utilities.h"
+#include "Multipath.h"
+
+/*
+ * Struct : DownloadConfig
+ * Description :
+ *   Connection settings shared by both ends of a download.
+ */
+struct DownloadConfig
+{
+	unsigned int protocolId = 0;
+	float timeout = 10.0f;
+	float bytesPerSecond = 1250000.0f;  // paced slice rate, per downloader
+	bool compactHeader = false;
+	int ackEveryPackets = 1;
+	float ackMaxDelay = 0.0f;
+	bool offload = true;                // UDP segmentation and receive offload where available
+};
+
+/*
+ * Class : PeerSocket
+ * Description :
+ *   Transport for one peer of a DownloadServer. Sends go straight out of the
+ *   server's shared socket; datagrams the server received from this peer are
+ *   handed over with Deliver and read back by the peer's connection.
+ */
+class PeerSocket : public net::Socket
+{
+public:
+	PeerSocket(net::Socket& shared) : m_shared(shared)
+	{
+	}
+
+	~PeerSocket()
+	{
+		Close();
+	}
+
+	bool Open(unsigned short port)
+	{
+		m_open = true;
+		return true;
+	}
+
+	void Close()
+	{
+		m_open = false;
+		m_inbox.clear();
+	}
+
+	bool IsOpen() const
+	{
+		return m_open;
+	}
+
+	bool Send(const net::Address& destination, const void* data, int size)
+	{
+		return m_open && m_shared.Send(destination, data, size);
+	}
+
+	bool SendSegments(const net::Address& destination, const void* data, int size, int segment)
+	{
+		return m_open && m_shared.SendSegments(destination, data, size, segment);
+	}
+
+	int Receive(net::Address& sender, void* data, int size)
+	{
+		if (m_inbox.empty())
+		{
+			return 0;
+		}
+		std::vector<unsigned char>& datagram = m_inbox.front().second;
+		const int length = (int)datagram.size() < size ? (int)datagram.size() : size;
+		memcpy(data, datagram.data(), length);
+		sender = m_inbox.front().first;
+		m_inbox.pop_front();
+		return length;
+	}
+
+	bool SetPacingRate(unsigned int bytesPerSecond)
+	{
+		return false;
+	}
+
+	void Deliver(const net::Address& sender, const unsigned char* data, int size)
+	{
+		m_inbox.emplace_back(sender, std::vector<unsigned char>(data, data + size));
+	}
+
+private:
+	net::Socket& m_shared;
+	bool m_open = false;
+	std::deque<std::pair<net::Address, std::vector<unsigned char>>> m_inbox;
+};
+
+/*
+ * Class : DownloadServer
+ * Description :
+ *   Serves the files of one directory to any number of downloaders. A
+ *   downloader sends a PacketGet, receives the PacketMeta and then sends
+ *   PacketRanges; the slices of all its pending ranges are streamed one
+ *   range after the other, so parallel range requests progress together.
+ *   Connections whose PacketGet names the same session are the paths of
+ *   one transfer, and its slices are striped across them.
+ */
+class DownloadServer
+{
+public:
+	DownloadServer(const DownloadConfig& config, const char* root) : m_config(config), m_root(root)
+	{
+		m_transport = &m_socket;
+	}
+
+	/*
+	 * Function : SetTransport
+	 * Description :
+	 *   Replaces the UDP socket, e.g. with an impaired one. Set it before Start.
+	 * Parameters :
+	 *   net::Socket* transport - The transport to use, or NULL for the UDP socket.
+	 * Return :
+	 *   void
+	 */
+	void SetTransport(net::Socket* transport)
+	{
+		m_transport = transport != nullptr ? transport : &m_socket;
+	}
+
+	/*
+	 * Function : Start
+	 * Description :
+	 *   Opens the shared socket.
+	 * Parameters :
+	 *   unsigned short port - The port downloaders connect to.
+	 * Return :
+	 *   bool - Returns true if the socket is open.
+	 */
+	bool Start(unsigned short port)
+	{
+		m_transport->SetOffload(m_config.offload);
+		if (!m_transport->Open(port))
+		{
+			NET_ERROR("could not start download server on port %d", port);
+			return false;
+		}
+		m_buffer.resize(net::Socket::MaxTrainBytes);
+		NET_INFO("serving %s on port %d%s", m_root.c_str(), port,
+			m_transport->IsSendOffload() ? " with segmentation offload" : "");
+		return true;
+	}
+
+	/*
+	 * Function : Run
+	 * Description :
+	 *   Serves downloaders until the process ends.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Run()
+	{
+		unsigned long long last = net::time_now_ns();
+		while (true)
+		{
+			const unsigned long long now = net::time_now_ns();
+			Update((now - last) / 1e9f);
+			last = now;
+			net::sleep_until_ns(now + 200000);
+		}
+	}
+
+	/*
+	 * Function : Update
+	 * Description :
+	 *   Hands every received datagram to its peer, answers requests, streams the
+	 *   pending slices of each peer at its paced rate and drops peers that left.
+	 * Parameters :
+	 *   float deltaTime - Seconds since the previous update.
+	 * Return :
+	 *   void
+	 */
+	void Update(float deltaTime)
+	{
+		net::Address sender;
+		int bytes;
+		int segment;
+		while ((bytes = m_transport->ReceiveSegments(sender, m_buffer.data(), (int)m_buffer.size(), segment)) > 0 && segment > 0)
+		{
+			auto found = m_peers.find(sender);
+			if (found == m_peers.end())
+			{
+				found = m_peers.emplace(sender, std::make_unique<Peer>(*m_transport, m_config)).first;
+			}
+			// a coalesced train holds several datagrams of the same sender
+			for (int offset = 0; offset < bytes; offset += segment)
+			{
+				found->second->socket.Deliver(sender, m_buffer.data() + offset, std::min(segment, bytes - offset));
+			}
+		}
+
+		for (auto it = m_peers.begin(); it != m_peers.end();)
+		{
+			Peer& peer = *it->second;
+			unsigned char packet[net::PacketSizeHack - 12];    // room left by the reliable header
+			while ((bytes = peer.connection.ReceivePacket(packet, sizeof(packet))) > 0)
+			{
+				Handle(peer, it->first, packet, bytes);
+			}
+			peer.connection.Update(deltaTime);
+
+			// A source that never formed a connection, or a downloader that went quiet
+			if (!peer.connection.IsConnected())
+			{
+				Leave(peer);
+				it = m_peers.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		// Each transfer is sent once per update, over all of its paths
+		m_tick++;
+		for (auto& entry : m_peers)
+		{
+			Transfer* transfer = entry.second->transfer.get();
+			if (transfer != nullptr && transfer->tick != m_tick)
+			{
+				transfer->tick = m_tick;
+				transfer->paths.Update();
+				Send(*transfer);
+			}
+		}
+	}
+
+	/*
+	 * Function : GetPeerCount
+	 * Description :
+	 *   Returns the number of connected downloaders.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of peers.
+	 */
+	size_t GetPeerCount() const
+	{
+		return m_peers.size();
+	}
+
+private:
+	static constexpr int MaxTrain = 16;         // slices sent to one path in one syscall
+
+	// Slices picked for one path during an update, sent together as a segment train
+	struct Train
+	{
+		net::ReliableConnection* path = nullptr;
+		std::vector<unsigned char> data = std::vector<unsigned char>(MaxTrain * PACKET_SIZE);
+		int stride = 0;                         // every slice in a train has the same size
+		int count = 0;
+	};
+
+	struct Transfer
+	{
+		std::shared_ptr<const FileSlices> file;
+		std::vector<SliceRange> pending;        // advanced as slices leave
+		size_t cursor = 0;                      // next range to send from
+		PathScheduler paths;
+		unsigned long long tick = 0;            // last update that sent this transfer
+		std::vector<Train> trains;              // one per path
+	};
+
+	struct Peer
+	{
+		Peer(net::Socket& shared, const DownloadConfig& config)
+			: socket(shared), connection(config.protocolId, config.timeout), pacer(config.bytesPerSecond, Burst(config.bytesPerSecond))
+		{
+			connection.SetTransport(&socket);
+			connection.SetAckFrequency(config.ackEveryPackets, config.ackMaxDelay);
+			connection.SetCompactHeader(config.compactHeader);
+			connection.Start(0);
+			connection.Listen();
+		}
+
+		PeerSocket socket;                      // declared first, the connection closes it on destruction
+		net::ReliableConnection connection;
+		net::Pacer pacer;                       // the rate of this path
+		std::shared_ptr<Transfer> transfer;
+		uint64_t session = 0;
+
+		// about a millisecond of slices may leave at once, so a fast path fills whole trains
+		static int Burst(float bytesPerSecond)
+		{
+			return std::min(MaxTrain, std::max(4, (int)(bytesPerSecond / 1000.0f / PACKET_SIZE))) * PACKET_SIZE;
+		}
+	};
+
+	struct Entry
+	{
+		std::shared_ptr<const FileSlices> file;
+		std::filesystem::file_time_type modified;
+	};
+
+	void Handle(Peer& peer, const net::Address& address, const unsigned char* packet, int bytes)
+	{
+		if (packet[0] == TYPE_GET && bytes >= (int)sizeof(PacketGet))
+		{
+			const PacketGet* get = reinterpret_cast<const PacketGet*>(packet);
+			char name[MAX_FILENAME_LENGTH];
+			memcpy(name, get->filename, MAX_FILENAME_LENGTH);
+			name[MAX_FILENAME_LENGTH - 1] = '\0';
+
+			std::shared_ptr<const FileSlices> file = Find(name);
+			PacketMeta meta = { 0 };
+			meta.typeFlag = TYPE_META;
+			if (file != nullptr)
+			{
+				meta = *file->GetMeta();
+				strcpy_s(meta.filename, MAX_FILENAME_LENGTH, name);
+			}
+			// a repeated request changes nothing
+			if (peer.transfer == nullptr || peer.transfer->file != file || peer.session != get->session)
+			{
+				NET_INFO("%s %s for %d.%d.%d.%d:%d", file != nullptr ? "serving" : "no such file", name,
+					address.GetA(), address.GetB(), address.GetC(), address.GetD(), address.GetPort());
+				Leave(peer);
+				if (file != nullptr)
+				{
+					Join(peer, get->session, file);
+				}
+			}
+			peer.connection.SendPacket(reinterpret_cast<const unsigned char*>(&meta), sizeof(meta));
+		}
+		else if (packet[0] == TYPE_RANGES && bytes >= (int)sizeof(PacketRanges) && peer.transfer != nullptr)
+		{
+			Transfer& transfer = *peer.transfer;
+			const PacketRanges* request = reinterpret_cast<const PacketRanges*>(packet);
+			const uint64_t total = transfer.file->GetTotal();
+			if (request->flags & RANGES_REPLACE)
+			{
+				transfer.pending.clear();
+				transfer.cursor = 0;
+			}
+			for (size_t i = 0; i < request->count && i < RANGES_PER_PACKET; i++)
+			{
+				SliceRange range = request->ranges[i];
+				if (range.first >= total)
+				{
+					continue;
+				}
+				range.count = std::min(range.count, total - range.first);
+				if (range.count > 0 && !IsPending(transfer, range))
+				{
+					transfer.pending.push_back(range);
+				}
+			}
+		}
+	}
+
+	// Paths of one session share a transfer, as long as they ask for the same file
+	void Join(Peer& peer, uint64_t session, const std::shared_ptr<const FileSlices>& file)
+	{
+		std::shared_ptr<Transfer> transfer;
+		if (session != 0)
+		{
+			auto found = m_sessions.find(session);
+			if (found != m_sessions.end())
+			{
+				transfer = found->second.lock();
+			}
+		}
+		if (transfer == nullptr || transfer->file != file)
+		{
+			transfer = std::make_shared<Transfer>();
+			transfer->file = file;
+			if (session != 0)
+			{
+				m_sessions[session] = transfer;
+			}
+		}
+		transfer->paths.Add(&peer.connection, &peer.pacer);
+		peer.transfer = transfer;
+		peer.session = session;
+	}
+
+	void Leave(Peer& peer)
+	{
+		if (peer.transfer == nullptr)
+		{
+			return;
+		}
+		peer.transfer->paths.Remove(&peer.connection);
+		std::vector<Train>& trains = peer.transfer->trains;
+		trains.erase(std::remove_if(trains.begin(), trains.end(),
+			[&peer](const Train& train) { return train.path == &peer.connection; }), trains.end());
+		if (peer.transfer->paths.GetPathCount() == 0 && peer.session != 0)
+		{
+			m_sessions.erase(peer.session);
+		}
+		peer.transfer.reset();
+		peer.session = 0;
+	}
+
+	// A repeated request for a range that is still being streamed is ignored
+	static bool IsPending(const Transfer& transfer, const SliceRange& range)
+	{
+		for (const SliceRange& pending : transfer.pending)
+		{
+			if (pending.first + pending.count == range.first + range.count && pending.first >= range.first)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void Send(Transfer& transfer)
+	{
+		unsigned char packet[PACKET_SIZE];
+		net::ReliableConnection* path;
+		long long queued = 0;
+		for (const SliceRange& range : transfer.pending)
+		{
+			queued += (long long)range.count * PACKET_SIZE;
+		}
+		while (!transfer.pending.empty() && (path = transfer.paths.Pick(PACKET_SIZE, queued)) != nullptr)
+		{
+			queued -= PACKET_SIZE;
+			if (transfer.cursor >= transfer.pending.size())
+			{
+				transfer.cursor = 0;
+			}
+			SliceRange& range = transfer.pending[transfer.cursor];
+			const int bytes = (int)transfer.file->EncodeSlice(range.first, packet);
+			Train& train = TrainFor(transfer, path);
+			if (train.count == MaxTrain || (train.count > 0 && train.stride != bytes))
+			{
+				Flush(train);
+			}
+			memcpy(train.data.data() + train.count * bytes, packet, bytes);
+			train.stride = bytes;
+			train.count++;
+			range.first++;
+			if (--range.count == 0)
+			{
+				transfer.pending.erase(transfer.pending.begin() + transfer.cursor);
+			}
+			else
+			{
+				transfer.cursor++;
+			}
+		}
+		for (Train& train : transfer.trains)
+		{
+			Flush(train);
+		}
+	}
+
+	static Train& TrainFor(Transfer& transfer, net::ReliableConnection* path)
+	{
+		for (Train& train : transfer.trains)
+		{
+			if (train.path == path)
+			{
+				return train;
+			}
+		}
+		transfer.trains.emplace_back();
+		transfer.trains.back().path = path;
+		return transfer.trains.back();
+	}
+
+	static void Flush(Train& train)
+	{
+		if (train.count > 0)
+		{
+			train.path->SendPackets(train.data.data(), train.stride, train.count);
+			train.count = 0;
+		}
+	}
+
+	// Files are loaded once and shared by every peer, until the file on disk changes
+	std::shared_ptr<const FileSlices> Find(const char* name)
+	{
+		if (name[0] == '\0' || strchr(name, '/') != nullptr || strchr(name, '\\') != nullptr ||
+			strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		{
+			return nullptr;
+		}
+
+		std::error_code error;
+		const std::filesystem::path path = std::filesystem::path(m_root) / name;
+		if (!std::filesystem::is_regular_file(path, error))
+		{
+			m_files.erase(name);
+			return nullptr;
+		}
+		const std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+
+		Entry& entry = m_files[name];
+		if (entry.file == nullptr || entry.modified != modified)
+		{
+			std::shared_ptr<FileSlices> file = std::make_shared<FileSlices>();
+			if (!file->Load(path.string().c_str()))
+			{
+				m_files.erase(name);
+				return nullptr;
+			}
+			entry.file = file;
+			entry.modified = modified;
+		}
+		return entry.file;
+	}
+
+	DownloadConfig m_config;
+	std::string m_root;
+	net::Socket m_socket;
+	net::Socket* m_transport;
+	std::vector<unsigned char> m_buffer;        // room for one coalesced train
+	std::map<net::Address, std::unique_ptr<Peer>> m_peers;
+	std::map<uint64_t, std::weak_ptr<Transfer>> m_sessions;
+	std::map<std::string, Entry> m_files;
+	unsigned long long m_tick = 0;
+};
+
+/*
+ * Class : Downloader
+ * Description :
+ *   Fetches a file, or byte ranges of it, from one or more DownloadServers
+ *   holding the same file. Every source that answers is handed a disjoint
+ *   share of the slices; a source that runs out of work takes half of what
+ *   is left to the source expected to finish last, and near the end asks
+ *   for the last missing slices alongside it. Requests are repeated whenever
+ *   a source stalls, so lost requests and lost slices are asked for again.
+ *   Slices arriving from any source or path go into one FileSlices, which
+ *   is verified against the digest all sources agreed on.
+ */
+class Downloader
+{
+public:
+	Downloader(const DownloadConfig& config) : m_config(config)
+	{
+	}
+
+	/*
+	 * Function : AddSource
+	 * Description :
+	 *   Adds a server to download from. All sources must hold the same file.
+	 * Parameters :
+	 *   const net::Address& server - The download server.
+	 * Return :
+	 *   void
+	 */
+	void AddSource(const net::Address& server)
+	{
+		m_servers.push_back(server);
+	}
+
+	/*
+	 * Function : AddRange
+	 * Description :
+	 *   Asks for the bytes [offset, offset + size) only. Without any range the whole
+	 *   file is fetched and verified.
+	 * Parameters :
+	 *   uint64_t offset - The first byte.
+	 *   uint64_t size - The number of bytes.
+	 * Return :
+	 *   void
+	 */
+	void AddRange(uint64_t offset, uint64_t size)
+	{
+		m_byteRanges.emplace_back(offset, size);
+	}
+
+	/*
+	 * Function : AddPath
+	 * Description :
+	 *   Adds a path to every source: its own socket on a free source port, bound to
+	 *   one local interface or to all of them. Slices are striped across the paths.
+	 *   Without any path each source uses a single one.
+	 * Parameters :
+	 *   unsigned int localAddress - The local interface address, 0 for any.
+	 * Return :
+	 *   void
+	 */
+	void AddPath(unsigned int localAddress = 0)
+	{
+		m_locals.push_back(localAddress);
+	}
+
+	/*
+	 * Function : SetImpairment
+	 * Description :
+	 *   Runs every path through the network impairment emulator.
+	 * Parameters :
+	 *   const net::ImpairmentConfig& egress - Impairment of sent datagrams.
+	 *   const net::ImpairmentConfig& ingress - Impairment of received datagrams.
+	 * Return :
+	 *   void
+	 */
+	void SetImpairment(const net::ImpairmentConfig& egress, const net::ImpairmentConfig& ingress)
+	{
+		m_egress = egress;
+		m_ingress = ingress;
+	}
+
+	/*
+	 * Function : Run
+	 * Description :
+	 *   Connects, downloads and writes the result to a local file of the same name.
+	 * Parameters :
+	 *   const char* name - The file to fetch.
+	 * Return :
+	 *   bool - Returns true if every requested byte arrived and was written.
+	 */
+	bool Run(const char* name)
+	{
+		if (m_locals.empty())
+		{
+			m_locals.push_back(0);
+		}
+		m_sources.clear();
+		unsigned int seed = 1;
+		for (const net::Address& server : m_servers)
+		{
+			m_sources.emplace_back();
+			Source& source = m_sources.back();
+			source.address = server;
+			for (unsigned int local : m_locals)
+			{
+				source.paths.push_back(std::make_unique<Path>(m_config, m_egress, m_ingress, seed++));
+				Path& path = *source.paths.back();
+				path.socket.SetLocalAddress(local);
+				if (!path.connection.Start(0))
+				{
+					return false;
+				}
+				path.connection.Connect(server);
+			}
+		}
+
+		// every path names the same session so a server stripes one transfer over them
+		PacketGet get = { 0 };
+		get.typeFlag = TYPE_GET;
+		strcpy_s(get.filename, MAX_FILENAME_LENGTH, name);
+		get.session = m_locals.size() > 1 ? NewSession() : 0;
+
+		m_file = FileSlices();
+		m_haveMeta = false;
+		m_remaining = 0;
+		const unsigned long long start = net::time_now_ns();
+		unsigned long long nextGet = start;
+		unsigned long long last = start;
+
+		while (!m_haveMeta || m_remaining > 0)
+		{
+			unsigned long long now = net::time_now_ns();
+
+			// a path joins its source's transfer once the server answers it
+			if (now >= nextGet)
+			{
+				for (Source& source : m_sources)
+				{
+					for (std::unique_ptr<Path>& path : source.paths)
+					{
+						if (!path->connection.IsConnected() && !source.failed)
+						{
+							path->connection.SendPacket(reinterpret_cast<const unsigned char*>(&get), sizeof(get));
+						}
+					}
+				}
+				nextGet = now + RetryInterval;
+			}
+
+			for (size_t s = 0; s < m_sources.size(); s++)
+			{
+				for (std::unique_ptr<Path>& path : m_sources[s].paths)
+				{
+					unsigned char packet[net::PacketSizeHack - 12];    // room left by the reliable header
+					int bytes;
+					while (!m_sources[s].failed && (bytes = path->connection.ReceivePacket(packet, sizeof(packet))) > 0)
+					{
+						if (packet[0] == TYPE_META && bytes >= (int)sizeof(PacketMeta))
+						{
+							Accept((int)s, packet, bytes, name, now);
+						}
+						else if (packet[0] == TYPE_DATA && m_haveMeta && Deliver((int)s, packet, bytes, now))
+						{
+							path->slices++;
+						}
+					}
+				}
+			}
+
+			now = net::time_now_ns();
+			bool alive = false;
+			for (Source& source : m_sources)
+			{
+				if (source.failed)
+				{
+					source.paths.clear();
+				}
+				for (size_t i = 0; i < source.paths.size();)
+				{
+					net::ReliableConnection& connection = source.paths[i]->connection;
+					connection.Update((now - last) / 1e9f);
+					if (connection.ConnectFailed() || (!connection.IsConnected() && !connection.IsConnecting()))
+					{
+						source.paths.erase(source.paths.begin() + i);
+					}
+					else
+					{
+						i++;
+					}
+				}
+				if (source.paths.empty() && !source.failed)
+				{
+					NET_ERROR("lost source %d.%d.%d.%d:%d", source.address.GetA(), source.address.GetB(),
+						source.address.GetC(), source.address.GetD(), source.address.GetPort());
+					source.failed = true;
+					source.ready = false;
+				}
+				alive |= !source.failed;
+			}
+			last = now;
+			if (!alive)
+			{
+				NET_ERROR("no source could serve %s", name);
+				return false;
+			}
+
+			if (m_haveMeta)
+			{
+				Balance(now);
+			}
+			net::sleep_until_ns(now + 200000);
+		}
+
+		const double seconds = (net::time_now_ns() - start) / 1e9;
+		uint64_t bytes = 0;
+		if (m_byteRanges.empty())
+		{
+			if (!m_file.Verify() || !m_file.Save(name))
+			{
+				return false;
+			}
+			bytes = m_file.GetMeta()->fileSize;
+		}
+		else
+		{
+			for (const std::pair<uint64_t, uint64_t>& range : m_byteRanges)
+			{
+				if (!m_file.SaveRange(name, range.first, range.second))
+				{
+					return false;
+				}
+				bytes += range.second;
+			}
+		}
+		printf("downloaded %s: %llu bytes in %.3f s, %.2f Mbps\n", name, (unsigned long long)bytes, seconds,
+			seconds > 0.0 ? bytes * 8.0 / seconds / 1e6 : 0.0);
+		for (Source& source : m_sources)
+		{
+			if (m_sources.size() > 1)
+			{
+				printf("  source %d.%d.%d.%d:%d: %llu slices%s\n", source.address.GetA(), source.address.GetB(),
+					source.address.GetC(), source.address.GetD(), source.address.GetPort(), source.slices,
+					source.failed ? ", failed" : "");
+			}
+			for (size_t i = 0; i < source.paths.size() && m_locals.size() > 1; i++)
+			{
+				printf("  path %d: %llu slices, rtt %.1f ms\n", (int)i, source.paths[i]->slices,
+					source.paths[i]->connection.GetReliabilitySystem().GetRoundTripTime() * 1000.0f);
+			}
+		}
+		return true;
+	}
+
+private:
+	static const unsigned long long RetryInterval = 500000000ULL;   // stall before asking again
+	static const int MaxRangePackets = 16;                          // range packets per request
+	static const size_t MinSteal = 32;                              // smaller shares are shared, not split
+	static constexpr int Unassigned = -1;
+
+	struct Path
+	{
+		Path(const DownloadConfig& config, const net::ImpairmentConfig& egress, const net::ImpairmentConfig& ingress, unsigned int seed)
+			: socket(egress, ingress, seed), connection(config.protocolId, config.timeout)
+		{
+			socket.SetOffload(config.offload);
+			connection.SetTransport(&socket);
+			connection.SetAckFrequency(config.ackEveryPackets, config.ackMaxDelay);
+			connection.SetCompactHeader(config.compactHeader);
+		}
+
+		net::ImpairedSocket socket;             // passes straight through when not impaired
+		net::ReliableConnection connection;
+		unsigned long long slices = 0;
+	};
+
+	struct Source
+	{
+		net::Address address;
+		std::vector<std::unique_ptr<Path>> paths;
+		bool ready = false;                     // answered with the agreed file
+		bool failed = false;
+		size_t missing = 0;                     // slices it owns that have not arrived
+		unsigned long long slices = 0;          // slices that arrived from it
+		unsigned long long firstSlice = 0;      // time of its first slice
+		unsigned long long lastProgress = 0;    // time of its last slice or request
+	};
+
+	static uint64_t NewSession()
+	{
+		std::random_device random;
+		const uint64_t session = (uint64_t)random() << 32 ^ random() ^ net::time_now_ns();
+		return session != 0 ? session : 1;
+	}
+
+	// The first source to answer fixes the file, later ones must agree with its digest
+	void Accept(int index, const unsigned char* packet, int bytes, const char* name, unsigned long long now)
+	{
+		Source& source = m_sources[index];
+		const PacketMeta* meta = reinterpret_cast<const PacketMeta*>(packet);
+		if (source.ready || source.failed)
+		{
+			return;
+		}
+		if (bytes < (int)sizeof(PacketMeta) || meta->filename[0] == '\0')
+		{
+			NET_ERROR("source %d.%d.%d.%d:%d does not have %s", source.address.GetA(), source.address.GetB(),
+				source.address.GetC(), source.address.GetD(), source.address.GetPort(), name);
+			Drop(source);
+			return;
+		}
+		if (!m_haveMeta)
+		{
+			m_file.Deserialize(packet, bytes);
+			m_remaining = Plan();
+			m_haveMeta = true;
+		}
+		else if (meta->fileSize != m_file.GetMeta()->fileSize || memcmp(meta->md5, m_file.GetMeta()->md5, MD5_HASH_LENGTH) != 0)
+		{
+			NET_ERROR("source %d.%d.%d.%d:%d holds a different %s", source.address.GetA(), source.address.GetB(),
+				source.address.GetC(), source.address.GetD(), source.address.GetPort(), name);
+			Drop(source);
+			return;
+		}
+		source.ready = true;
+		source.lastProgress = now;
+	}
+
+	void Drop(Source& source)
+	{
+		// its paths are closed by the next update, they may still be receiving
+		source.failed = true;
+		source.ready = false;
+	}
+
+	// Stores a slice, whichever source sent it, returning true if it was new
+	bool Deliver(int index, const unsigned char* packet, int bytes, unsigned long long now)
+	{
+		uint64_t id = 0;
+		if (ReadVarint(packet + 1, bytes - 1, id) == 0 || id >= m_wanted.size() || !m_wanted[id] || m_file.HasSlice(id))
+		{
+			return false;
+		}
+		if (!m_file.Deserialize(packet, bytes))
+		{
+			return false;
+		}
+		m_remaining--;
+		const int owner = m_owner[id];
+		if (owner == Unassigned)
+		{
+			m_unassigned--;
+		}
+		else
+		{
+			m_sources[owner].missing--;
+		}
+		Source& source = m_sources[index];
+		if (source.slices++ == 0)
+		{
+			source.firstSlice = now;
+		}
+		source.lastProgress = now;
+		return true;
+	}
+
+	// Turns the byte ranges into the slices to fetch, returning how many there are
+	size_t Plan()
+	{
+		const uint64_t fileSize = m_file.GetMeta()->fileSize;
+		m_wanted.assign(m_file.GetTotal(), m_byteRanges.empty());
+		for (std::pair<uint64_t, uint64_t>& range : m_byteRanges)
+		{
+			range.second = range.first < fileSize ? std::min(range.second, fileSize - range.first) : 0;
+			if (range.second == 0)
+			{
+				continue;
+			}
+			const size_t last = (range.first + range.second - 1) / DATA_SIZE;
+			for (size_t id = range.first / DATA_SIZE; id <= last; id++)
+			{
+				m_wanted[id] = true;
+			}
+		}
+		m_owner.assign(m_file.GetTotal(), Unassigned);
+		m_unassigned = std::count(m_wanted.begin(), m_wanted.end(), true);
+		return m_unassigned;
+	}
+
+	// Hands work to idle sources and asks stalled ones again
+	void Balance(unsigned long long now)
+	{
+		for (size_t s = 0; s < m_sources.size(); s++)
+		{
+			Source& source = m_sources[s];
+			if (!source.ready)
+			{
+				continue;
+			}
+			if (source.missing == 0)
+			{
+				Steal((int)s, now);
+			}
+			else if (source.missing > 0 && now - source.lastProgress >= RetryInterval)
+			{
+				Request(source, (int)s, true);
+				source.lastProgress = now;
+			}
+		}
+	}
+
+	// Seconds a source still needs for its share at the rate it has delivered so far
+	double Remaining(const Source& source, unsigned long long now) const
+	{
+		if (source.failed)
+		{
+			return 1e30;
+		}
+		const double elapsed = std::max((now - source.firstSlice) / 1e9, 0.1);
+		const double rate = source.slices > 0 ? source.slices / elapsed : 0.0;
+		return rate > 0.0 ? source.missing / rate : 1e20 + source.missing;
+	}
+
+	void Steal(int thief, unsigned long long now)
+	{
+		// unassigned slices first, then the share of a lost source, else the source expected to finish last
+		int victim = Unassigned;
+		if (m_unassigned == 0)
+		{
+			double latest = 0.0;
+			victim = thief;
+			for (size_t s = 0; s < m_sources.size(); s++)
+			{
+				const double remaining = Remaining(m_sources[s], now);
+				if ((int)s != thief && m_sources[s].missing > 0 && remaining > latest)
+				{
+					victim = (int)s;
+					latest = remaining;
+				}
+			}
+			if (victim == thief)
+			{
+				return;
+			}
+		}
+
+		Source& source = m_sources[thief];
+		const size_t available = victim == Unassigned ? m_unassigned : m_sources[victim].missing;
+		if (victim != Unassigned && !m_sources[victim].failed && available < MinSteal)
+		{
+			// too little to split: ask for the same slices and keep whichever copy arrives first
+			if (now - source.lastProgress < RetryInterval)
+			{
+				return;
+			}
+			Request(source, victim, false);
+			source.lastProgress = now;
+			return;
+		}
+
+		// the whole pool, or the upper half of a live source's share
+		size_t take = victim == Unassigned || m_sources[victim].failed ? available : available / 2;
+		for (size_t id = m_owner.size(); id > 0 && take > 0; id--)
+		{
+			if (m_owner[id - 1] == victim && m_wanted[id - 1] && !m_file.HasSlice(id - 1))
+			{
+				m_owner[id - 1] = thief;
+				source.missing++;
+				if (victim == Unassigned)
+				{
+					m_unassigned--;
+				}
+				else
+				{
+					m_sources[victim].missing--;
+				}
+				take--;
+			}
+		}
+		Request(source, thief, true);
+		source.lastProgress = now;
+		if (victim != Unassigned && !m_sources[victim].failed)
+		{
+			Request(m_sources[victim], victim, true);
+		}
+	}
+
+	// Asks a source for the missing slices owned by owner, replacing what it still had to send
+	void Request(Source& source, int owner, bool replace)
+	{
+		net::ReliableConnection* connection = nullptr;
+		for (std::unique_ptr<Path>& path : source.paths)
+		{
+			if (path->connection.IsConnected())
+			{
+				connection = &path->connection;
+				break;
+			}
+		}
+		if (connection == nullptr)
+		{
+			return;
+		}
+
+		// a request too long for one round only adds, or the server would forget the ranges left out
+		std::vector<SliceRange> ranges;
+		const size_t limit = (size_t)MaxRangePackets * RANGES_PER_PACKET;
+		for (size_t id = 0; id < m_owner.size() && ranges.size() <= limit; id++)
+		{
+			if (IsMissing(id, owner))
+			{
+				SliceRange range = { id, 0 };
+				while (id < m_owner.size() && IsMissing(id, owner))
+				{
+					id++;
+				}
+				range.count = id - range.first;
+				ranges.push_back(range);
+			}
+		}
+		if (ranges.size() > limit)
+		{
+			ranges.resize(limit);
+			replace = false;
+		}
+
+		PacketRanges request = { 0 };
+		request.typeFlag = TYPE_RANGES;
+		request.flags = replace ? RANGES_REPLACE : 0;
+		for (size_t i = 0; i < ranges.size() || request.flags != 0; i++)
+		{
+			if (i < ranges.size())
+			{
+				request.ranges[request.count++] = ranges[i];
+			}
+			if (request.count == RANGES_PER_PACKET || i + 1 >= ranges.size())
+			{
+				connection->SendPacket(reinterpret_cast<const unsigned char*>(&request), sizeof(request));
+				memset(request.ranges, 0, sizeof(request.ranges));
+				request.count = 0;
+				request.flags = 0;
+			}
+		}
+	}
+
+	bool IsMissing(size_t id, int owner) const
+	{
+		return m_owner[id] == owner && m_wanted[id] && !m_file.HasSlice(id);
+	}
+
+	DownloadConfig m_config;
+	net::ImpairmentConfig m_egress;
+	net::ImpairmentConfig m_ingress;
+	std::vector<net::Address> m_servers;
+	std::vector<unsigned int> m_locals;                         // local address of each path
+	std::vector<std::pair<uint64_t, uint64_t>> m_byteRanges;   // offset, size
+
+	std::vector<Source> m_sources;
+	FileSlices m_file;
+	bool m_haveMeta = false;
+	size_t m_remaining = 0;                 // wanted slices not yet arrived
+	std::vector<bool> m_wanted;
+	std::vector<int> m_owner;               // source each slice is asked from
+	size_t m_unassigned = 0;                // wanted slices not yet handed to a source
+};
@@ -0,0 +1,867 @@
+/*
+* FILE : IoUring.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides an optional io_uring I/O engine for Linux. `IoRing`
+*   is one submission/completion ring shared by the sockets and the file
+*   I/O of the process; in SQPOLL mode a kernel thread picks submissions up
+*   so the hot path makes almost no system calls. `UringSocket` stands in
+*   for `net::Socket` underneath a `Connection`: datagrams arrive through
+*   one multishot receive into a group of provided buffers and sends
+*   are queued and submitted in batches. Files are read and written through
+*   registered buffers with several blocks in flight. Where io_uring is
+*   missing (other platforms, kernels before 6.0, or disabled by policy)
+*   the ring does not start and everything uses plain system calls.
+*/
+
+#ifndef NET_IO_URING_H
+#define NET_IO_URING_H
+
+#include <vector>
+#include <algorithm>
+
+#include "Net.h"
+
+#if defined( __linux__ ) && defined( __has_include )
+#if __has_include( <linux/io_uring.h> )
+#define NET_IO_URING 1
+#endif
+#endif
+
+#ifdef NET_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+namespace net
+{
+	// one io_uring instance, shared by everything doing I/O on the thread that runs it
+	//  + completions are handed to the Operation whose address was the submission's user data
+
+	class IoRing
+	{
+	public:
+
+		struct Operation
+		{
+			virtual void Complete( int result, unsigned int flags ) = 0;
+		protected:
+			~Operation() {}
+		};
+
+		// the ring of the process, started on request from main
+
+		static IoRing & Get()
+		{
+			static IoRing ring;
+			return ring;
+		}
+
+		IoRing()
+		{
+			fd = -1;
+			polling = false;
+			timed = false;
+			fixed = false;
+		}
+
+		~IoRing()
+		{
+			Stop();
+		}
+
+		// returns false, leaving callers on plain system calls, when the kernel cannot provide the ring
+
+		bool Start( unsigned int entries, bool sqpoll )
+		{
+			assert( !IsActive() );
+			#ifdef NET_IO_URING
+			io_uring_params params;
+			memset( &params, 0, sizeof( params ) );
+			if ( sqpoll )
+			{
+				params.flags |= IORING_SETUP_SQPOLL;
+				params.sq_thread_idle = SqThreadIdle;
+			}
+			fd = (int) syscall( __NR_io_uring_setup, entries, &params );
+			if ( fd < 0 )
+			{
+				NET_INFO( "io_uring unavailable (%s), using plain system calls", strerror( errno ) );
+				fd = -1;
+				return false;
+			}
+			if ( !( params.features & IORING_FEAT_SINGLE_MMAP ) || !( params.features & IORING_FEAT_NODROP ) || !Map( params ) )
+			{
+				NET_INFO( "io_uring too old, using plain system calls" );
+				Stop();
+				return false;
+			}
+			polling = sqpoll;
+			timed = ( params.features & IORING_FEAT_EXT_ARG ) != 0;
+
+			// file blocks: registered once so reads and writes skip the per-call page pinning
+			fileBuffers.assign( (size_t) FileDepth * FileBlock, 0 );
+			iovec vectors[FileDepth];
+			for ( int i = 0; i < FileDepth; ++i )
+			{
+				vectors[i].iov_base = &fileBuffers[(size_t) i * FileBlock];
+				vectors[i].iov_len = FileBlock;
+			}
+			fixed = syscall( __NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, vectors, FileDepth ) == 0;
+			NET_INFO( "io_uring started with %u entries%s%s", params.sq_entries, sqpoll ? ", sqpoll" : "",
+				fixed ? ", registered file buffers" : "" );
+			return true;
+			#else
+			(void) entries;
+			(void) sqpoll;
+			NET_INFO( "io_uring unavailable on this platform, using plain system calls" );
+			return false;
+			#endif
+		}
+
+		void Stop()
+		{
+			#ifdef NET_IO_URING
+			if ( fd < 0 )
+				return;
+			if ( sqMemory != MAP_FAILED )
+				munmap( sqMemory, sqSize );
+			if ( sqeMemory != MAP_FAILED )
+				munmap( sqeMemory, sqeSize );
+			close( fd );
+			fd = -1;
+			polling = false;
+			timed = false;
+			fixed = false;
+			#endif
+		}
+
+		bool IsActive() const
+		{
+			return fd >= 0;
+		}
+
+		bool IsPolling() const
+		{
+			return polling;
+		}
+
+		int GetHandle() const
+		{
+			return fd;
+		}
+
+		#ifdef NET_IO_URING
+
+		// a cleared submission entry for "operation", or null if the queue stays full
+
+		io_uring_sqe * Prepare( Operation * operation )
+		{
+			assert( IsActive() );
+			if ( sqLocal - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= sqEntries )
+			{
+				Submit();
+				if ( polling )
+					syscall( __NR_io_uring_enter, fd, 0, 0, IORING_ENTER_SQ_WAIT, NULL, 0 );
+				if ( sqLocal - __atomic_load_n( sqHead, __ATOMIC_ACQUIRE ) >= sqEntries )
+					return NULL;
+			}
+			const unsigned int index = sqLocal & sqMask;
+			io_uring_sqe * sqe = &sqes[index];
+			memset( sqe, 0, sizeof( *sqe ) );
+			sqe->user_data = (unsigned long long) (uintptr_t) operation;
+			sqArray[index] = index;
+			sqLocal++;
+			return sqe;
+		}
+
+		#endif
+
+		// hand the prepared entries to the kernel. with sqpoll this only wakes the kernel thread if it went idle
+
+		void Submit()
+		{
+			#ifdef NET_IO_URING
+			if ( fd < 0 )
+				return;
+			const unsigned int pending = sqLocal - *sqTail;
+			__atomic_store_n( sqTail, sqLocal, __ATOMIC_RELEASE );
+			if ( polling )
+			{
+				__atomic_thread_fence( __ATOMIC_SEQ_CST );
+				if ( __atomic_load_n( sqFlags, __ATOMIC_RELAXED ) & IORING_SQ_NEED_WAKEUP )
+					syscall( __NR_io_uring_enter, fd, 0, 0, IORING_ENTER_SQ_WAKEUP, NULL, 0 );
+			}
+			else if ( pending > 0 )
+				syscall( __NR_io_uring_enter, fd, pending, 0, 0, NULL, 0 );
+			#endif
+		}
+
+		// dispatch every completion that is ready, returns how many there were
+
+		int Poll()
+		{
+			int count = 0;
+			#ifdef NET_IO_URING
+			if ( fd < 0 )
+				return 0;
+			unsigned int head = *cqHead;
+			const unsigned int tail = __atomic_load_n( cqTail, __ATOMIC_ACQUIRE );
+			while ( head != tail )
+			{
+				const io_uring_cqe cqe = cqes[head & cqMask];
+				__atomic_store_n( cqHead, ++head, __ATOMIC_RELEASE );
+				Operation * operation = (Operation*) (uintptr_t) cqe.user_data;
+				if ( operation != NULL )
+					operation->Complete( cqe.res, cqe.flags );
+				count++;
+			}
+			#endif
+			return count;
+		}
+
+		// submit, then block until at least one completion has been dispatched
+
+		void Wait()
+		{
+			#ifdef NET_IO_URING
+			if ( fd < 0 )
+				return;
+			Submit();
+			while ( Poll() == 0 )
+			{
+				const unsigned int pending = polling ? 0 : sqLocal - *sqTail;
+				if ( syscall( __NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0 && errno != EINTR )
+					return;
+			}
+			#endif
+		}
+
+		// as Wait, but gives up at the deadline (time_now_ns). returns false if nothing completed by then
+
+		bool WaitUntil( unsigned long long deadline )
+		{
+			#ifdef NET_IO_URING
+			if ( fd < 0 )
+				return false;
+			Submit();
+			while ( Poll() == 0 )
+			{
+				const unsigned long long now = time_now_ns();
+				if ( now >= deadline )
+					return false;
+				if ( !timed )
+				{
+					// before 5.11 the wait cannot time out, nap instead
+					sleep_until_ns( deadline - now < NapTime ? deadline : now + NapTime );
+					continue;
+				}
+				__kernel_timespec ts;
+				ts.tv_sec = (long long) ( ( deadline - now ) / 1000000000ULL );
+				ts.tv_nsec = (long long) ( ( deadline - now ) % 1000000000ULL );
+				io_uring_getevents_arg arg;
+				memset( &arg, 0, sizeof( arg ) );
+				arg.ts = (unsigned long long) (uintptr_t) &ts;
+				const unsigned int pending = polling ? 0 : sqLocal - *sqTail;
+				if ( syscall( __NR_io_uring_enter, fd, pending, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof( arg ) ) < 0 &&
+					 errno != EINTR && errno != ETIME )
+					return false;
+			}
+			return true;
+			#else
+			(void) deadline;
+			return false;
+			#endif
+		}
+
+		// whole files through the ring: FileDepth blocks in flight, each read or written from a registered buffer
+
+		bool ReadFile( const char * path, std::vector<unsigned char> & content )
+		{
+			#ifdef NET_IO_URING
+			const int file = open( path, O_RDONLY );
+			if ( file < 0 )
+				return false;
+			struct stat status;
+			bool ok = fstat( file, &status ) == 0;
+			if ( ok )
+			{
+				content.resize( (size_t) status.st_size );
+				ok = Transfer( file, content.data(), content.size(), 0, false );
+			}
+			close( file );
+			return ok;
+			#else
+			(void) path;
+			(void) content;
+			return false;
+			#endif
+		}
+
+		bool WriteFile( const char * path, const void * data, size_t size, unsigned long long offset, bool truncate )
+		{
+			#ifdef NET_IO_URING
+			const int file = open( path, O_WRONLY | O_CREAT | ( truncate ? O_TRUNC : 0 ), 0644 );
+			if ( file < 0 )
+				return false;
+			const bool ok = Transfer( file, (unsigned char*) data, size, offset, true );
+			return close( file ) == 0 && ok;
+			#else
+			(void) path;
+			(void) data;
+			(void) size;
+			(void) offset;
+			(void) truncate;
+			return false;
+			#endif
+		}
+
+	private:
+
+		enum
+		{
+			FileDepth = 4,						// file blocks in flight
+			FileBlock = 256 * 1024,
+			SqThreadIdle = 100,					// ms the sqpoll thread spins before it sleeps
+			NapTime = 50000						// ns between completion checks when waits cannot time out
+		};
+
+		#ifdef NET_IO_URING
+
+		bool Map( const io_uring_params & params )
+		{
+			// one mapping holds both rings (IORING_FEAT_SINGLE_MMAP), the entries are a second one
+			const size_t sqRing = params.sq_off.array + params.sq_entries * sizeof( unsigned int );
+			const size_t cqRing = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+			sqSize = sqRing > cqRing ? sqRing : cqRing;
+			sqMemory = mmap( NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+			sqeSize = params.sq_entries * sizeof( io_uring_sqe );
+			sqeMemory = mmap( NULL, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+			if ( sqMemory == MAP_FAILED || sqeMemory == MAP_FAILED )
+				return false;
+
+			unsigned char * ring = (unsigned char*) sqMemory;
+			sqHead = (unsigned int*) ( ring + params.sq_off.head );
+			sqTail = (unsigned int*) ( ring + params.sq_off.tail );
+			sqFlags = (unsigned int*) ( ring + params.sq_off.flags );
+			sqArray = (unsigned int*) ( ring + params.sq_off.array );
+			sqMask = *(unsigned int*) ( ring + params.sq_off.ring_mask );
+			sqEntries = params.sq_entries;
+			sqLocal = *sqTail;
+			sqes = (io_uring_sqe*) sqeMemory;
+			cqHead = (unsigned int*) ( ring + params.cq_off.head );
+			cqTail = (unsigned int*) ( ring + params.cq_off.tail );
+			cqMask = *(unsigned int*) ( ring + params.cq_off.ring_mask );
+			cqes = (io_uring_cqe*) ( ring + params.cq_off.cqes );
+			return true;
+		}
+
+		struct Block : Operation
+		{
+			bool busy = false;
+			int result = 0;
+			size_t position = 0;				// where in the caller's data this block starts
+			size_t size = 0;					// bytes asked for, 0 when the block is free
+
+			void Complete( int result, unsigned int flags )
+			{
+				this->result = result;
+				busy = false;
+			}
+		};
+
+		bool Issue( int file, Block & block, int index, unsigned long long offset, bool write )
+		{
+			io_uring_sqe * sqe = Prepare( &block );
+			if ( sqe == NULL )
+				return false;
+			if ( fixed )
+			{
+				sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+				sqe->buf_index = (unsigned short) index;
+			}
+			else
+				sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+			sqe->fd = file;
+			sqe->off = offset + block.position;
+			sqe->addr = (unsigned long long) (uintptr_t) &fileBuffers[(size_t) index * FileBlock];
+			sqe->len = (unsigned int) block.size;
+			block.busy = true;
+			return true;
+		}
+
+		bool Transfer( int file, unsigned char * data, size_t size, unsigned long long offset, bool write )
+		{
+			Block blocks[FileDepth];
+			size_t submitted = 0;
+			size_t completed = 0;
+			bool failed = false;
+			while ( true )
+			{
+				bool busy = false;
+				for ( int i = 0; i < FileDepth; ++i )
+				{
+					Block & block = blocks[i];
+					unsigned char * buffer = &fileBuffers[(size_t) i * FileBlock];
+					if ( block.busy )
+					{
+						busy = true;
+						continue;
+					}
+					if ( block.size > 0 )
+					{
+						if ( block.result <= 0 )
+						{
+							failed = true;
+							block.size = 0;
+							continue;
+						}
+						const size_t done = (size_t) block.result;
+						if ( !write )
+							memcpy( data + block.position, buffer, done );
+						completed += done;
+						block.position += done;
+						block.size -= done;
+						// a short transfer continues where it stopped
+						if ( block.size > 0 && !failed )
+						{
+							if ( write )
+								memmove( buffer, buffer + done, block.size );
+							failed = !Issue( file, block, i, offset, write );
+							busy |= !failed;
+							continue;
+						}
+						block.size = 0;
+					}
+					if ( !failed && submitted < size )
+					{
+						block.position = submitted;
+						block.size = size - submitted < (size_t) FileBlock ? size - submitted : (size_t) FileBlock;
+						if ( write )
+							memcpy( buffer, data + submitted, block.size );
+						submitted += block.size;
+						failed = !Issue( file, block, i, offset, write );
+						busy |= !failed;
+					}
+				}
+				// a failed transfer still waits for its blocks, the kernel writes into them
+				if ( !busy )
+					break;
+				Wait();
+			}
+			return !failed && completed == size;
+		}
+
+		unsigned int * sqHead;
+		unsigned int * sqTail;
+		unsigned int * sqFlags;
+		unsigned int * sqArray;
+		unsigned int sqMask;
+		unsigned int sqEntries;
+		unsigned int sqLocal;					// entries prepared, published to sqTail by Submit
+		io_uring_sqe * sqes;
+		unsigned int * cqHead;
+		unsigned int * cqTail;
+		unsigned int cqMask;
+		io_uring_cqe * cqes;
+		void * sqMemory = MAP_FAILED;
+		size_t sqSize = 0;
+		void * sqeMemory = MAP_FAILED;
+		size_t sqeSize = 0;
+
+		#endif
+
+		int fd;
+		bool polling;							// sqpoll: a kernel thread consumes the submission queue
+		bool timed;								// waits take a timeout (IORING_FEAT_EXT_ARG)
+		bool fixed;								// file buffers are registered
+		std::vector<unsigned char> fileBuffers;
+	};
+
+	// udp socket doing its i/o through an IoRing
+	//  + one multishot receive fills buffers the kernel takes from a provided buffer group, each handed
+	//    back once its datagram is read. sends are copied into slots and submitted in batches, at the
+	//    latest by the next Receive, which the connection loops call after sending
+	//  + without an active ring it is a plain Socket
+
+	class UringSocket : public Socket
+	{
+	public:
+
+		UringSocket( IoRing & ring = IoRing::Get() ) : ring( ring )
+		{
+			active = false;
+			#ifdef NET_IO_URING
+			receiving = false;
+			group = NextGroup();
+			receiver.owner = this;
+			#endif
+		}
+
+		~UringSocket()
+		{
+			Close();
+		}
+
+		bool Open( unsigned short port )
+		{
+			// trains are handed out datagram by datagram through Send and Receive
+			SetOffload( false );
+			if ( !Socket::Open( port ) )
+				return false;
+			#ifdef NET_IO_URING
+			active = ring.IsActive() && Setup();
+			#endif
+			return true;
+		}
+
+		void Close()
+		{
+			#ifdef NET_IO_URING
+			if ( active )
+			{
+				// the kernel owns the buffers until the receive and every send have completed
+				if ( receiving )
+				{
+					io_uring_sqe * sqe = ring.Prepare( &ignore );
+					if ( sqe != NULL )
+					{
+						sqe->opcode = IORING_OP_ASYNC_CANCEL;
+						sqe->addr = (unsigned long long) (uintptr_t) &receiver;
+					}
+				}
+				while ( receiving || InFlight() > 0 )
+					ring.Wait();
+				// take back the buffers the kernel still holds
+				io_uring_sqe * sqe = ring.Prepare( &removal );
+				if ( sqe != NULL )
+				{
+					sqe->opcode = IORING_OP_REMOVE_BUFFERS;
+					sqe->fd = BufferCount;
+					sqe->buf_group = group;
+					removal.done = false;
+					while ( !removal.done )
+						ring.Wait();
+				}
+				recycled.clear();
+				active = false;
+			}
+			#endif
+			Socket::Close();
+		}
+
+		bool IsActive() const
+		{
+			return active;
+		}
+
+		bool Send( const Address & destination, const void * data, int size )
+		{
+			if ( !active )
+				return Socket::Send( destination, data, size );
+			#ifdef NET_IO_URING
+			assert( size <= SlotSize );
+			SendSlot * slot = FreeSlot();
+			if ( slot == NULL )
+				return false;
+			io_uring_sqe * sqe = ring.Prepare( slot );
+			if ( sqe == NULL )
+				return false;
+			memcpy( slot->data, data, size );
+			slot->address.sin_family = AF_INET;
+			slot->address.sin_addr.s_addr = htonl( destination.GetAddress() );
+			slot->address.sin_port = htons( (unsigned short) destination.GetPort() );
+			slot->vector.iov_base = slot->data;
+			slot->vector.iov_len = size;
+			memset( &slot->message, 0, sizeof( slot->message ) );
+			slot->message.msg_name = &slot->address;
+			slot->message.msg_namelen = sizeof( slot->address );
+			slot->message.msg_iov = &slot->vector;
+			slot->message.msg_iovlen = 1;
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = GetHandle();
+			sqe->addr = (unsigned long long) (uintptr_t) &slot->message;
+			sqe->len = 1;
+			slot->busy = true;
+			if ( ++queued >= SubmitBatch )
+				Flush();
+			return true;
+			#else
+			return false;
+			#endif
+		}
+
+		int Receive( Address & sender, void * data, int size )
+		{
+			if ( !active )
+				return Socket::Receive( sender, data, size );
+			#ifdef NET_IO_URING
+			Flush();
+			if ( readyCount == 0 )
+				ring.Poll();
+			// the multishot receive ends when it runs out of buffers, rearm it once some are back
+			if ( !receiving && Arm() )
+				ring.Submit();
+			while ( readyCount > 0 )
+			{
+				const Ready ready = readyQueue[readyHead];
+				readyHead = ( readyHead + 1 ) % BufferCount;
+				readyCount--;
+
+				unsigned char * buffer = &buffers[(size_t) ready.id * BufferSize];
+				const io_uring_recvmsg_out * out = (const io_uring_recvmsg_out*) buffer;
+				const sockaddr_in * from = (const sockaddr_in*) ( buffer + sizeof( *out ) );
+				const unsigned char * payload = buffer + sizeof( *out ) + sizeof( sockaddr_in ) + out->controllen;
+				int bytes = 0;
+				if ( ready.length > 0 && !( out->flags & MSG_TRUNC ) && out->namelen >= sizeof( sockaddr_in ) )
+				{
+					bytes = (int) out->payloadlen < size ? (int) out->payloadlen : size;
+					memcpy( data, payload, bytes );
+					sender = Address( ntohl( from->sin_addr.s_addr ), ntohs( from->sin_port ) );
+				}
+				Recycle( ready.id );
+				if ( bytes > 0 )
+					return bytes;
+			}
+			#endif
+			return 0;
+		}
+
+		// the multishot receive has already taken waiting datagrams off the socket, so wait on the ring
+
+		bool Wait( unsigned long long deadline )
+		{
+			if ( !active )
+				return Socket::Wait( deadline );
+			#ifdef NET_IO_URING
+			Flush();
+			if ( readyCount == 0 )
+				ring.Poll();
+			if ( !receiving && Arm() )
+				ring.Submit();
+			if ( readyCount == 0 )
+				ring.WaitUntil( deadline );
+			return readyCount > 0;
+			#else
+			return false;
+			#endif
+		}
+
+		// submit the queued sends now
+
+		void Flush()
+		{
+			if ( !active )
+				return;
+			#ifdef NET_IO_URING
+			Provide();
+			#endif
+			queued = 0;
+			ring.Submit();
+		}
+
+	private:
+
+		enum
+		{
+			BufferCount = 256,					// provided receive buffers, a power of two
+			BufferSize = 512,					// recvmsg header, sender address and one datagram
+			SlotCount = 128,					// sends in flight
+			SlotSize = PacketSizeHack + 64,
+			SubmitBatch = 16					// queued sends that trigger a submit on their own
+		};
+
+		IoRing & ring;
+		bool active;
+		int queued = 0;
+
+		#ifdef NET_IO_URING
+
+		struct Receiver : IoRing::Operation
+		{
+			UringSocket * owner = NULL;
+
+			void Complete( int result, unsigned int flags )
+			{
+				owner->Received( result, flags );
+			}
+		};
+
+		struct SendSlot : IoRing::Operation
+		{
+			bool busy = false;
+			msghdr message;
+			iovec vector;
+			sockaddr_in address;
+			unsigned char data[SlotSize];
+
+			void Complete( int result, unsigned int flags )
+			{
+				busy = false;
+			}
+		};
+
+		struct Ignore : IoRing::Operation
+		{
+			void Complete( int result, unsigned int flags ) {}
+		};
+
+		struct Removal : IoRing::Operation
+		{
+			bool done = true;
+
+			void Complete( int result, unsigned int flags )
+			{
+				done = true;
+			}
+		};
+
+		struct Ready
+		{
+			unsigned short id;
+			int length;
+		};
+
+		static unsigned short NextGroup()
+		{
+			static unsigned short next = 0;
+			return next++;
+		}
+
+		bool Setup()
+		{
+			buffers.assign( (size_t) BufferCount * BufferSize, 0 );
+			slots.assign( SlotCount, SendSlot() );
+			readyQueue.assign( BufferCount, Ready() );
+			readyHead = 0;
+			readyCount = 0;
+
+			// legacy provided buffers (5.7+) rather than a registered buffer ring, which not every kernel honours
+			recycled.clear();
+			for ( unsigned short id = 0; id < BufferCount; ++id )
+				Recycle( id );
+			if ( !Provide() )
+			{
+				NET_INFO( "io_uring provided buffers unavailable, socket uses plain system calls" );
+				return false;
+			}
+
+			memset( &receiveHeader, 0, sizeof( receiveHeader ) );
+			receiveHeader.msg_namelen = sizeof( sockaddr_in );
+			receiving = false;
+			Arm();
+			ring.Submit();
+			return true;
+		}
+
+		bool Arm()
+		{
+			io_uring_sqe * sqe = ring.Prepare( &receiver );
+			if ( sqe == NULL )
+				return false;
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->fd = GetHandle();
+			sqe->addr = (unsigned long long) (uintptr_t) &receiveHeader;
+			sqe->len = 1;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = group;
+			receiving = true;
+			return true;
+		}
+
+		void Received( int result, unsigned int flags )
+		{
+			if ( !( flags & IORING_CQE_F_MORE ) )
+				receiving = false;
+			if ( result < 0 || !( flags & IORING_CQE_F_BUFFER ) )
+				return;
+			Ready & ready = readyQueue[( readyHead + readyCount ) % BufferCount];
+			ready.id = (unsigned short) ( flags >> IORING_CQE_BUFFER_SHIFT );
+			ready.length = result;
+			readyCount++;
+		}
+
+		// a read buffer goes back to the kernel with the next Provide, runs of adjacent ids in one entry
+
+		void Recycle( unsigned short id )
+		{
+			recycled.push_back( id );
+		}
+
+		bool Provide()
+		{
+			std::sort( recycled.begin(), recycled.end() );
+			size_t first = 0;
+			while ( first < recycled.size() )
+			{
+				size_t last = first + 1;
+				while ( last < recycled.size() && recycled[last] == recycled[last - 1] + 1 )
+					last++;
+				io_uring_sqe * sqe = ring.Prepare( &ignore );
+				if ( sqe == NULL )
+					break;
+				sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+				sqe->fd = (int) ( last - first );
+				sqe->addr = (unsigned long long) (uintptr_t) &buffers[(size_t) recycled[first] * BufferSize];
+				sqe->len = BufferSize;
+				sqe->off = recycled[first];
+				sqe->buf_group = group;
+				first = last;
+			}
+			recycled.erase( recycled.begin(), recycled.begin() + first );
+			return recycled.empty();
+		}
+
+		SendSlot * FreeSlot()
+		{
+			for ( int attempt = 0; attempt < 2; ++attempt )
+			{
+				for ( int i = 0; i < SlotCount; ++i )
+				{
+					const int index = ( nextSlot + i ) % SlotCount;
+					if ( !slots[index].busy )
+					{
+						nextSlot = ( index + 1 ) % SlotCount;
+						return &slots[index];
+					}
+				}
+				// every slot is in flight: wait for the kernel to finish one
+				Flush();
+				ring.Wait();
+			}
+			return NULL;
+		}
+
+		int InFlight() const
+		{
+			int count = 0;
+			for ( const SendSlot & slot : slots )
+				count += slot.busy ? 1 : 0;
+			return count;
+		}
+
+		unsigned short group;					// provided buffer group of this socket
+		Receiver receiver;
+		Ignore ignore;
+		Removal removal;
+		bool receiving;							// the multishot receive is armed
+		msghdr receiveHeader;
+		std::vector<unsigned char> buffers;
+		std::vector<unsigned short> recycled;	// read buffers not yet handed back
+		std::vector<Ready> readyQueue;			// received buffers in arrival order
+		int readyHead = 0;
+		int readyCount = 0;
+		std::vector<SendSlot> slots;
+		int nextSlot = 0;
+
+		#endif
+	};
+}
+
+#endif
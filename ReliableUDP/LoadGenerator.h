@@ -0,0 +1,328 @@
+/*
+* FILE : LoadGenerator.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides an end-to-end load generator in the style of iperf.
+*   It runs a number of concurrent client/server sessions over loopback,
+*   optionally through the network impairment emulator, for a fixed time
+*   and reports goodput, packet rate, CPU cost per gigabyte, loss and
+*   one-way and round trip latency percentiles.
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "Net.h"
+#include "NetEmulator.h"
+
+#if PLATFORM == PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+/*
+ * Struct : LoadConfig
+ * Description :
+ *   Parameters of a load generator run.
+ */
+struct LoadConfig
+{
+	int sessions = 1;                   // concurrent client/server pairs
+	float seconds = 10.0f;              // how long the clients send
+	float targetMbps = 10.0f;           // paced payload rate per session
+	int packetSize = 256;               // payload bytes per packet
+	unsigned int protocolId = 0;
+	int basePort = 40000;               // session i uses basePort + 2i (server) and basePort + 2i + 1 (client)
+	net::ImpairmentConfig impairment;   // applied to every client socket
+	bool impairIngress = false;
+	bool compactHeader = false;         // short connection id and compact reliable header
+};
+
+/*
+ * Struct : LoadSession
+ * Description :
+ *   Measurements gathered by one session. Each session's client and server
+ *   threads only touch their own fields, so no locking is needed.
+ */
+struct LoadSession
+{
+	// client side
+	unsigned long long packetsSent = 0;
+	unsigned long long packetsLost = 0;
+	std::vector<float> rtt;             // seconds, from send to ack
+	// server side
+	unsigned long long packetsReceived = 0;
+	unsigned long long bytesReceived = 0;
+	std::vector<float> oneWay;          // seconds, from send to delivery
+};
+
+/*
+ * Class : LoadGenerator
+ * Description :
+ *   Runs the sessions of a LoadConfig and prints the aggregated report.
+ */
+class LoadGenerator
+{
+public:
+	LoadGenerator(const LoadConfig& config) : m_config(config)
+	{
+	}
+
+	/*
+	 * Function : Run
+	 * Description :
+	 *   Starts every session, waits for them to finish and prints the report.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - Returns true if every session connected.
+	 */
+	bool Run()
+	{
+		m_sessions.assign(m_config.sessions, LoadSession());
+		std::vector<std::thread> threads;
+
+		printf("bench: %d sessions, %.1f s, %.1f Mbps per session, %d byte packets%s\n",
+			m_config.sessions, m_config.seconds, m_config.targetMbps, m_config.packetSize,
+			m_config.impairment.IsActive() ? ", impaired" : "");
+
+		const double cpuStart = GetCpuSeconds();
+		const unsigned long long start = net::time_now_ns();
+		const unsigned long long end = start + (unsigned long long)(m_config.seconds * 1e9);
+		std::atomic<bool> ok(true);
+
+		for (int i = 0; i < m_config.sessions; i++)
+		{
+			threads.emplace_back(&LoadGenerator::ServerThread, this, i, end);
+			threads.emplace_back(&LoadGenerator::ClientThread, this, i, end, &ok);
+		}
+		for (std::thread& thread : threads)
+		{
+			thread.join();
+		}
+
+		const double cpuSeconds = GetCpuSeconds() - cpuStart;
+		net::Logger::Get().Flush();
+		Report(cpuSeconds);
+		return ok.load();
+	}
+
+	/*
+	 * Function : GetCpuSeconds
+	 * Description :
+	 *   Returns the user plus system CPU time consumed by the process so far.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   double - CPU seconds.
+	 */
+	static double GetCpuSeconds()
+	{
+#if PLATFORM == PLATFORM_WINDOWS
+		FILETIME creation, exit, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		{
+			return 0.0;
+		}
+		auto toSeconds = [](const FILETIME& time)
+		{
+			return ((unsigned long long)time.dwHighDateTime << 32 | time.dwLowDateTime) / 1e7;
+		};
+		return toSeconds(kernel) + toSeconds(user);
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+	}
+
+private:
+	// payload layout: send time (8 bytes) then the client's packet counter (8 bytes), rest zero
+	struct Stamp
+	{
+		unsigned long long sent;
+		unsigned long long counter;
+	};
+
+	void ClientThread(int index, unsigned long long end, std::atomic<bool>* ok)
+	{
+		LoadSession& session = m_sessions[index];
+		const unsigned short serverPort = (unsigned short)(m_config.basePort + index * 2);
+
+		net::ImpairedSocket impaired(m_config.impairment,
+			m_config.impairIngress ? m_config.impairment : net::ImpairmentConfig(), index + 1);
+		net::ReliableConnection connection(m_config.protocolId, 10.0f);
+		connection.SetCompactHeader(m_config.compactHeader);
+		if (m_config.impairment.IsActive())
+		{
+			connection.SetTransport(&impaired);
+		}
+		if (!connection.Start(serverPort + 1))
+		{
+			*ok = false;
+			return;
+		}
+		connection.Connect(net::Address(127, 0, 0, 1, serverPort));
+
+		// remember when each reliability sequence left, to turn acks into rtt samples
+		const size_t ringSize = 1 << 16;
+		std::vector<unsigned long long> sentAt(ringSize, 0);
+
+		net::Pacer pacer(m_config.targetMbps * 1e6f / 8.0f, m_config.packetSize * 4);
+		std::vector<unsigned char> packet(m_config.packetSize, 0);
+		unsigned long long last = net::time_now_ns();
+
+		while (true)
+		{
+			unsigned long long now = net::time_now_ns();
+			if (now >= end)
+			{
+				break;
+			}
+
+			while (pacer.TryConsume(m_config.packetSize))
+			{
+				Stamp stamp = { net::time_now_ns(), session.packetsSent };
+				memcpy(packet.data(), &stamp, sizeof(stamp));
+				unsigned int sequence = connection.GetReliabilitySystem().GetLocalSequence();
+				if (connection.SendPacket(packet.data(), (int)packet.size()))
+				{
+					sentAt[sequence % ringSize] = stamp.sent;
+					session.packetsSent++;
+				}
+			}
+
+			unsigned char incoming[net::PacketSizeHack - 12];    // room left by the reliable header
+			while (connection.ReceivePacket(incoming, sizeof(incoming)) > 0)
+			{
+			}
+
+			// acks gathered while receiving are cleared by the next update, so sample them first
+			now = net::time_now_ns();
+			unsigned int* acks = nullptr;
+			int ackCount = 0;
+			connection.GetReliabilitySystem().GetAcks(&acks, ackCount);
+			for (int i = 0; i < ackCount; i++)
+			{
+				unsigned long long sent = sentAt[acks[i] % ringSize];
+				if (sent != 0 && now > sent)
+				{
+					session.rtt.push_back((now - sent) / 1e9f);
+				}
+			}
+
+			connection.Update((now - last) / 1e9f);
+			last = now;
+
+			// wake for the next departure, but at least every 200us to service acks
+			pacer.WaitUntil(m_config.packetSize, now + 200000);
+		}
+
+		if (!connection.IsConnected())
+		{
+			*ok = false;
+		}
+		session.packetsLost = connection.GetReliabilitySystem().GetLostPackets();
+	}
+
+	void ServerThread(int index, unsigned long long end)
+	{
+		LoadSession& session = m_sessions[index];
+		net::ReliableConnection connection(m_config.protocolId, 10.0f);
+		connection.SetCompactHeader(m_config.compactHeader);
+		if (!connection.Start((unsigned short)(m_config.basePort + index * 2)))
+		{
+			return;
+		}
+		connection.Listen();
+
+		// keep draining for a moment after the clients stop so packets in flight are counted
+		const unsigned long long drainUntil = end + 500000000ULL;
+		std::vector<unsigned char> packet(net::PacketSizeHack - 12);    // room left by the reliable header
+		unsigned long long last = net::time_now_ns();
+
+		while (true)
+		{
+			unsigned long long now = net::time_now_ns();
+			if (now >= drainUntil)
+			{
+				break;
+			}
+
+			int bytes;
+			while ((bytes = connection.ReceivePacket(packet.data(), (int)packet.size())) > 0)
+			{
+				session.packetsReceived++;
+				session.bytesReceived += bytes;
+				if (bytes >= (int)sizeof(Stamp))
+				{
+					Stamp stamp;
+					memcpy(&stamp, packet.data(), sizeof(stamp));
+					unsigned long long arrived = net::time_now_ns();
+					if (arrived > stamp.sent)
+					{
+						session.oneWay.push_back((arrived - stamp.sent) / 1e9f);
+					}
+				}
+			}
+
+			now = net::time_now_ns();
+			connection.Update((now - last) / 1e9f);
+			last = now;
+			net::sleep_until_ns(now + 100000);
+		}
+	}
+
+	static float Percentile(std::vector<float>& samples, double fraction)
+	{
+		if (samples.empty())
+		{
+			return 0.0f;
+		}
+		size_t index = (size_t)(fraction * (samples.size() - 1) + 0.5);
+		std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+		return samples[index];
+	}
+
+	void Report(double cpuSeconds)
+	{
+		unsigned long long sent = 0, lost = 0, received = 0, bytes = 0;
+		std::vector<float> rtt;
+		std::vector<float> oneWay;
+		for (LoadSession& session : m_sessions)
+		{
+			sent += session.packetsSent;
+			lost += session.packetsLost;
+			received += session.packetsReceived;
+			bytes += session.bytesReceived;
+			rtt.insert(rtt.end(), session.rtt.begin(), session.rtt.end());
+			oneWay.insert(oneWay.end(), session.oneWay.begin(), session.oneWay.end());
+		}
+
+		const double seconds = m_config.seconds;
+		const double gigabytes = bytes / 1e9;
+		printf("goodput      %.2f Mbps (%.2f Mbps per session)\n", bytes * 8.0 / seconds / 1e6,
+			bytes * 8.0 / seconds / 1e6 / m_config.sessions);
+		printf("packets      %llu sent, %llu delivered, %.0f pps delivered\n", sent, received, received / seconds);
+		printf("loss         %llu reported lost by the sender (%.3f%% would need retransmitting)\n",
+			lost, sent > 0 ? lost * 100.0 / sent : 0.0);
+		printf("cpu          %.2f s, %.2f cpu-seconds per GB delivered\n", cpuSeconds, gigabytes > 0.0 ? cpuSeconds / gigabytes : 0.0);
+		printf("one-way ms   p50 %.3f  p99 %.3f  p999 %.3f  (%zu samples)\n", Percentile(oneWay, 0.5) * 1000.0f,
+			Percentile(oneWay, 0.99) * 1000.0f, Percentile(oneWay, 0.999) * 1000.0f, oneWay.size());
+		printf("rtt ms       p50 %.3f  p99 %.3f  p999 %.3f  (%zu samples)\n", Percentile(rtt, 0.5) * 1000.0f,
+			Percentile(rtt, 0.99) * 1000.0f, Percentile(rtt, 0.999) * 1000.0f, rtt.size());
+	}
+
+	LoadConfig m_config;
+	std::vector<LoadSession> m_sessions;
+};
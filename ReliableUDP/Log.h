@@ -0,0 +1,434 @@
+/*
+* FILE : Log.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides asynchronous leveled logging. A log call copies its
+*   format string pointer and arguments as a binary record into a ring
+*   buffer owned by the calling thread; a background thread formats the
+*   records and writes them out, so the transfer loop never waits on the
+*   terminal. Levels below NET_LOG_LEVEL compile out entirely, and
+*   NET_LOG_EVERY rate-limits a call site.
+*/
+
+#ifndef NET_LOG_H
+#define NET_LOG_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+// lowest level compiled in; 0 keeps per-packet traces, the default drops them
+
+#ifndef NET_LOG_LEVEL
+#define NET_LOG_LEVEL 1
+#endif
+
+namespace net
+{
+	enum LogLevel
+	{
+		LogTrace = 0,
+		LogDebug = 1,
+		LogInfo = 2,
+		LogWarning = 3,
+		LogError = 4
+	};
+
+	// one log call: the format is a string literal, kept by pointer; string arguments are copied into text
+
+	struct LogRecord
+	{
+		static const int MaxArgs = 8;
+		static const int TextSize = 80;
+
+		unsigned long long time;
+		const char * format;
+		unsigned char level;
+		unsigned char count;
+		char types[MaxArgs];			// 'i' signed, 'u' unsigned, 'f' floating, 's' offset into text
+		union
+		{
+			long long i;
+			unsigned long long u;
+			double f;
+		} args[MaxArgs];
+		unsigned short used;
+		char text[TextSize];
+	};
+
+	// single producer, single consumer ring of records, one per logging thread
+
+	class LogRing
+	{
+	public:
+
+		static const unsigned int Size = 1024;
+
+		LogRing()
+		{
+			head = 0;
+			tail = 0;
+			retired = false;
+		}
+
+		LogRecord * Claim()
+		{
+			const unsigned int h = head.load( std::memory_order_relaxed );
+			if ( h - tail.load( std::memory_order_acquire ) >= Size )
+				return 0;
+			return &records[h % Size];
+		}
+
+		void Publish()
+		{
+			head.store( head.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+		}
+
+		bool Pop( LogRecord & record )
+		{
+			const unsigned int t = tail.load( std::memory_order_relaxed );
+			if ( t == head.load( std::memory_order_acquire ) )
+				return false;
+			record = records[t % Size];
+			tail.store( t + 1, std::memory_order_release );
+			return true;
+		}
+
+		bool Empty() const
+		{
+			return tail.load( std::memory_order_acquire ) == head.load( std::memory_order_acquire );
+		}
+
+		std::atomic<bool> retired;			// the owning thread has exited
+
+	private:
+
+		std::atomic<unsigned int> head;
+		std::atomic<unsigned int> tail;
+		LogRecord records[Size];
+	};
+
+	class Logger
+	{
+	public:
+
+		static Logger & Get()
+		{
+			static Logger logger;
+			return logger;
+		}
+
+		void SetLevel( LogLevel level )
+		{
+			this->level.store( level, std::memory_order_relaxed );
+		}
+
+		bool Enabled( LogLevel level ) const
+		{
+			return level >= this->level.load( std::memory_order_relaxed );
+		}
+
+		// records lost because a ring was full; the hot path never blocks
+
+		unsigned long long GetDropped() const
+		{
+			return dropped.load( std::memory_order_relaxed );
+		}
+
+		template <typename... Args> void Write( LogLevel level, const char * format, Args... args )
+		{
+			static_assert( sizeof...( Args ) <= LogRecord::MaxArgs, "too many log arguments" );
+			LogRing & ring = ThreadRing();
+			LogRecord * record = ring.Claim();
+			if ( !record )
+			{
+				dropped.fetch_add( 1, std::memory_order_relaxed );
+				return;
+			}
+			record->time = Now();
+			record->format = format;
+			record->level = (unsigned char) level;
+			record->count = 0;
+			record->used = 0;
+			( Encode( *record, args ), ... );
+			ring.Publish();
+			if ( level >= LogWarning )
+				wake.notify_one();
+		}
+
+		// write out everything logged so far
+
+		void Flush()
+		{
+			Drain();
+		}
+
+	private:
+
+		Logger()
+		{
+			level = LogDebug;
+			dropped = 0;
+			running = true;
+			thread = std::thread( &Logger::Run, this );
+		}
+
+		~Logger()
+		{
+			{
+				std::lock_guard<std::mutex> lock( mutex );
+				running = false;
+			}
+			wake.notify_one();
+			thread.join();
+			Drain();
+			if ( dropped )
+				fprintf( stderr, "log dropped %llu records\n", (unsigned long long) dropped );
+		}
+
+		static unsigned long long Now()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		}
+
+		// each thread registers its ring on first use and retires it on exit; the logger drains what is left
+
+		struct RingOwner
+		{
+			std::shared_ptr<LogRing> ring;
+
+			~RingOwner()
+			{
+				if ( ring )
+					ring->retired = true;
+			}
+		};
+
+		LogRing & ThreadRing()
+		{
+			thread_local RingOwner owner;
+			if ( !owner.ring )
+			{
+				owner.ring = std::make_shared<LogRing>();
+				std::lock_guard<std::mutex> lock( mutex );
+				rings.push_back( owner.ring );
+			}
+			return *owner.ring;
+		}
+
+		template <typename T> static void Encode( LogRecord & record, T value )
+		{
+			const int k = record.count++;
+			if constexpr ( std::is_same<T, const char*>::value || std::is_same<T, char*>::value )
+			{
+				record.types[k] = 's';
+				const size_t room = LogRecord::TextSize - record.used;
+				if ( room == 0 )
+				{
+					// the text is full, point at the terminator of the last string written
+					record.args[k].u = LogRecord::TextSize - 1;
+					return;
+				}
+				record.args[k].u = record.used;
+				const char * text = value ? value : "(null)";
+				const size_t length = std::min( strlen( text ), room - 1 );
+				memcpy( record.text + record.used, text, length );
+				record.text[record.used + length] = '\0';
+				record.used = (unsigned short) ( record.used + ( room > 1 ? length + 1 : 0 ) );
+			}
+			else if constexpr ( std::is_floating_point<T>::value )
+			{
+				record.types[k] = 'f';
+				record.args[k].f = value;
+			}
+			else if constexpr ( std::is_pointer<T>::value )
+			{
+				record.types[k] = 'u';
+				record.args[k].u = (unsigned long long) (uintptr_t) value;
+			}
+			else if constexpr ( std::is_signed<T>::value )
+			{
+				record.types[k] = 'i';
+				record.args[k].i = value;
+			}
+			else
+			{
+				record.types[k] = 'u';
+				record.args[k].u = value;
+			}
+		}
+
+		// printf formatting, one conversion at a time, from the stored arguments
+
+		static void Format( const LogRecord & record, std::string & out )
+		{
+			char piece[128];
+			int next = 0;
+			for ( const char * p = record.format; *p; ++p )
+			{
+				if ( *p != '%' )
+				{
+					out += *p;
+					continue;
+				}
+				if ( p[1] == '%' )
+				{
+					out += '%';
+					++p;
+					continue;
+				}
+
+				// copy flags, width and precision, drop length modifiers, keep the conversion
+				std::string spec = "%";
+				const char * q = p + 1;
+				while ( *q && strchr( "-+ #0123456789.", *q ) )
+					spec += *q++;
+				while ( *q && strchr( "hlLqjzt", *q ) )
+					q++;
+				const char conversion = *q;
+				if ( !conversion )
+					break;
+				p = q;
+
+				if ( next >= record.count )
+				{
+					out += spec + conversion;
+					continue;
+				}
+				const int k = next++;
+				const char type = record.types[k];
+				const long long i = type == 'i' ? record.args[k].i : type == 'u' ? (long long) record.args[k].u : (long long) record.args[k].f;
+				const unsigned long long u = type == 'i' ? (unsigned long long) record.args[k].i : type == 'u' ? record.args[k].u : (unsigned long long) record.args[k].f;
+				const double f = type == 'f' ? record.args[k].f : type == 'i' ? (double) record.args[k].i : (double) record.args[k].u;
+
+				switch ( conversion )
+				{
+					case 'd': case 'i':
+						snprintf( piece, sizeof( piece ), ( spec + "lld" ).c_str(), i );
+						break;
+					case 'u': case 'x': case 'X': case 'o':
+						snprintf( piece, sizeof( piece ), ( spec + "ll" + conversion ).c_str(), u );
+						break;
+					case 'c':
+						snprintf( piece, sizeof( piece ), ( spec + "c" ).c_str(), (int) i );
+						break;
+					case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+						snprintf( piece, sizeof( piece ), ( spec + conversion ).c_str(), f );
+						break;
+					case 'p':
+						snprintf( piece, sizeof( piece ), "%p", (void*) (uintptr_t) u );
+						break;
+					case 's':
+						snprintf( piece, sizeof( piece ), ( spec + "s" ).c_str(), type == 's' ? record.text + record.args[k].u : "?" );
+						break;
+					default:
+						piece[0] = '\0';
+						break;
+				}
+				out += piece;
+			}
+		}
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> lock( mutex );
+			while ( running )
+			{
+				wake.wait_for( lock, std::chrono::milliseconds( 5 ) );
+				lock.unlock();
+				Drain();
+				lock.lock();
+			}
+		}
+
+		// collect what every ring holds, write it in time order; informational output goes to stdout, warnings and errors to stderr
+
+		void Drain()
+		{
+			std::lock_guard<std::mutex> drainLock( draining );
+
+			// the snapshot and batch keep their capacity, so an idle drain allocates nothing
+			{
+				std::lock_guard<std::mutex> lock( mutex );
+				current.assign( rings.begin(), rings.end() );
+			}
+
+			batch.clear();
+			LogRecord record;
+			for ( const std::shared_ptr<LogRing> & ring : current )
+				while ( ring->Pop( record ) )
+					batch.push_back( record );
+			current.clear();
+			if ( batch.empty() )
+				return;
+			std::stable_sort( batch.begin(), batch.end(), []( const LogRecord & a, const LogRecord & b ) { return a.time < b.time; } );
+
+			std::string line;
+			for ( const LogRecord & r : batch )
+			{
+				line.clear();
+				Format( r, line );
+				if ( line.empty() || line.back() != '\n' )
+					line += '\n';
+				fwrite( line.data(), 1, line.size(), r.level >= LogWarning ? stderr : stdout );
+			}
+			fflush( stdout );
+
+			// forget rings whose threads are gone once they are empty
+			std::lock_guard<std::mutex> lock( mutex );
+			rings.erase( std::remove_if( rings.begin(), rings.end(), []( const std::shared_ptr<LogRing> & ring )
+				{ return ring->retired && ring->Empty(); } ), rings.end() );
+		}
+
+		std::atomic<int> level;
+		std::atomic<unsigned long long> dropped;
+		bool running;
+		std::mutex mutex;									// guards rings and running
+		std::mutex draining;								// one consumer at a time
+		std::condition_variable wake;
+		std::vector< std::shared_ptr<LogRing> > rings;
+		std::vector< std::shared_ptr<LogRing> > current;	// rings being drained, copied out of the lock
+		std::vector<LogRecord> batch;
+		std::thread thread;
+	};
+
+	// true at most once per interval for the call site owning "next"
+
+	inline bool LogRateAllow( std::atomic<unsigned long long> & next, float seconds )
+	{
+		const unsigned long long now = std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+		unsigned long long due = next.load( std::memory_order_relaxed );
+		if ( now < due )
+			return false;
+		return next.compare_exchange_strong( due, now + (unsigned long long) ( seconds * 1e9f ), std::memory_order_relaxed );
+	}
+}
+
+// logging macros; the level test against NET_LOG_LEVEL is a constant, so disabled levels generate no code
+
+#define NET_LOG( level, ... ) \
+	do { if ( (level) >= NET_LOG_LEVEL && net::Logger::Get().Enabled( level ) ) net::Logger::Get().Write( level, __VA_ARGS__ ); } while ( 0 )
+
+#define NET_LOG_EVERY( seconds, level, ... ) \
+	do { if ( (level) >= NET_LOG_LEVEL ) { static std::atomic<unsigned long long> net_log_next( 0 ); \
+		if ( net::LogRateAllow( net_log_next, seconds ) ) NET_LOG( level, __VA_ARGS__ ); } } while ( 0 )
+
+#define NET_TRACE( ... )	NET_LOG( net::LogTrace, __VA_ARGS__ )
+#define NET_DEBUG( ... )	NET_LOG( net::LogDebug, __VA_ARGS__ )
+#define NET_INFO( ... )		NET_LOG( net::LogInfo, __VA_ARGS__ )
+#define NET_WARN( ... )		NET_LOG( net::LogWarning, __VA_ARGS__ )
+#define NET_ERROR( ... )	NET_LOG( net::LogError, __VA_ARGS__ )
+
+#endif
@@ -0,0 +1,338 @@
+/*
+* FILE : Metrics.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides the live transport statistics of a connection. The
+*   I/O thread updates `ConnectionMetrics` with relaxed atomics, so any
+*   other thread can take a `MetricsSnapshot` at any time without stopping
+*   it, and the snapshot can be rendered in the Prometheus text format.
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdio>
+
+namespace net
+{
+	// log-linear histogram of durations in microseconds
+	//  + values below 16us get a bucket each, above that every power of two is split into 8 buckets,
+	//    so any recorded value is known to within 12.5%
+
+	class Histogram
+	{
+	public:
+
+		static const int LinearBuckets = 16;
+		static const int SubBits = 3;
+		static const int Buckets = LinearBuckets + ( 32 - 4 ) * ( 1 << SubBits );
+
+		struct Snapshot
+		{
+			unsigned long long counts[Buckets];
+			unsigned long long count;
+			unsigned long long sum;				// microseconds
+
+			// value in seconds below which this fraction of the samples fall (bucket upper bound)
+
+			float Percentile( double fraction ) const
+			{
+				if ( count == 0 )
+					return 0.0f;
+				unsigned long long rank = (unsigned long long) ( fraction * count );
+				if ( rank >= count )
+					rank = count - 1;
+				unsigned long long seen = 0;
+				for ( int i = 0; i < Buckets; ++i )
+				{
+					seen += counts[i];
+					if ( seen > rank )
+						return UpperBound( i ) / 1000000.0f;
+				}
+				return UpperBound( Buckets - 1 ) / 1000000.0f;
+			}
+
+			float Mean() const
+			{
+				return count ? sum / (float) count / 1000000.0f : 0.0f;
+			}
+		};
+
+		Histogram()
+		{
+			Reset();
+		}
+
+		void Reset()
+		{
+			for ( int i = 0; i < Buckets; ++i )
+				counts[i].store( 0, std::memory_order_relaxed );
+			count.store( 0, std::memory_order_relaxed );
+			sum.store( 0, std::memory_order_relaxed );
+		}
+
+		void Record( float seconds )
+		{
+			const unsigned int micros = seconds <= 0.0f ? 0 : seconds >= 4000.0f ? 0xFFFFFFFFu : (unsigned int) ( seconds * 1000000.0f );
+			counts[BucketFor( micros )].fetch_add( 1, std::memory_order_relaxed );
+			count.fetch_add( 1, std::memory_order_relaxed );
+			sum.fetch_add( micros, std::memory_order_relaxed );
+		}
+
+		void Read( Snapshot & snapshot ) const
+		{
+			for ( int i = 0; i < Buckets; ++i )
+				snapshot.counts[i] = counts[i].load( std::memory_order_relaxed );
+			snapshot.count = count.load( std::memory_order_relaxed );
+			snapshot.sum = sum.load( std::memory_order_relaxed );
+		}
+
+		static int BucketFor( unsigned int micros )
+		{
+			if ( micros < LinearBuckets )
+				return (int) micros;
+			int exponent = 31;
+			while ( !( micros >> exponent ) )
+				exponent--;
+			const int sub = ( micros >> ( exponent - SubBits ) ) & ( ( 1 << SubBits ) - 1 );
+			return LinearBuckets + ( exponent - 4 ) * ( 1 << SubBits ) + sub;
+		}
+
+		// largest value in microseconds that falls into a bucket
+
+		static unsigned long long UpperBound( int bucket )
+		{
+			if ( bucket < LinearBuckets )
+				return bucket;
+			const int exponent = 4 + ( bucket - LinearBuckets ) / ( 1 << SubBits );
+			const int sub = ( bucket - LinearBuckets ) % ( 1 << SubBits );
+			const unsigned long long width = 1ULL << ( exponent - SubBits );
+			return ( 1ULL << exponent ) + ( sub + 1 ) * width - 1;
+		}
+
+	private:
+
+		std::atomic<unsigned long long> counts[Buckets];
+		std::atomic<unsigned long long> count;
+		std::atomic<unsigned long long> sum;
+	};
+
+	// plain copy of a connection's metrics at one moment
+
+	struct MetricsSnapshot
+	{
+		unsigned long long packets_sent;
+		unsigned long long packets_received;
+		unsigned long long packets_acked;
+		unsigned long long packets_lost;
+		unsigned long long retransmits;
+		unsigned long long duplicates;
+		unsigned long long ack_frames;
+		unsigned long long bytes_sent;
+		unsigned long long bytes_delivered;
+
+		unsigned long long sent_queue;
+		unsigned long long pending_ack_queue;
+		unsigned long long received_queue;
+		unsigned long long acked_queue;
+		unsigned long long pacing_rate;			// bytes per second
+		unsigned long long pacing_window;		// bytes, pacing rate times the round trip
+		float srtt;								// seconds
+		float rto;								// seconds
+
+		Histogram::Snapshot rtt;
+		Histogram::Snapshot jitter;
+	};
+
+	// metrics of one connection
+	//  + written only by the thread driving the connection; every access is a relaxed atomic so other
+	//    threads may read at any time. counters never reset, gauges hold the latest value
+
+	class ConnectionMetrics
+	{
+	public:
+
+		ConnectionMetrics()
+		{
+			Reset();
+		}
+
+		void Reset()
+		{
+			std::atomic<unsigned long long> * all[] = { &packets_sent, &packets_received, &packets_acked, &packets_lost, &retransmits,
+				&duplicates, &ack_frames, &bytes_sent, &bytes_delivered, &sent_queue, &pending_ack_queue, &received_queue,
+				&acked_queue, &pacing_rate, &pacing_window, &srtt_us, &rto_us, &last_rtt_us };
+			for ( std::atomic<unsigned long long> * value : all )
+				value->store( 0, std::memory_order_relaxed );
+			rtt.Reset();
+			jitter.Reset();
+		}
+
+		static void Add( std::atomic<unsigned long long> & counter, unsigned long long amount = 1 )
+		{
+			counter.fetch_add( amount, std::memory_order_relaxed );
+		}
+
+		static void Set( std::atomic<unsigned long long> & gauge, unsigned long long value )
+		{
+			gauge.store( value, std::memory_order_relaxed );
+		}
+
+		// one rtt sample; jitter is the change from the previous sample (as in rfc 3550)
+
+		void RecordRtt( float seconds )
+		{
+			const unsigned long long micros = seconds > 0.0f ? (unsigned long long) ( seconds * 1000000.0f ) : 0;
+			const unsigned long long previous = last_rtt_us.exchange( micros + 1, std::memory_order_relaxed );
+			rtt.Record( seconds );
+			if ( previous != 0 )
+			{
+				const unsigned long long last = previous - 1;
+				jitter.Record( ( micros > last ? micros - last : last - micros ) / 1000000.0f );
+			}
+		}
+
+		void Read( MetricsSnapshot & snapshot ) const
+		{
+			snapshot.packets_sent = packets_sent.load( std::memory_order_relaxed );
+			snapshot.packets_received = packets_received.load( std::memory_order_relaxed );
+			snapshot.packets_acked = packets_acked.load( std::memory_order_relaxed );
+			snapshot.packets_lost = packets_lost.load( std::memory_order_relaxed );
+			snapshot.retransmits = retransmits.load( std::memory_order_relaxed );
+			snapshot.duplicates = duplicates.load( std::memory_order_relaxed );
+			snapshot.ack_frames = ack_frames.load( std::memory_order_relaxed );
+			snapshot.bytes_sent = bytes_sent.load( std::memory_order_relaxed );
+			snapshot.bytes_delivered = bytes_delivered.load( std::memory_order_relaxed );
+			snapshot.sent_queue = sent_queue.load( std::memory_order_relaxed );
+			snapshot.pending_ack_queue = pending_ack_queue.load( std::memory_order_relaxed );
+			snapshot.received_queue = received_queue.load( std::memory_order_relaxed );
+			snapshot.acked_queue = acked_queue.load( std::memory_order_relaxed );
+			snapshot.pacing_rate = pacing_rate.load( std::memory_order_relaxed );
+			snapshot.pacing_window = pacing_window.load( std::memory_order_relaxed );
+			snapshot.srtt = srtt_us.load( std::memory_order_relaxed ) / 1000000.0f;
+			snapshot.rto = rto_us.load( std::memory_order_relaxed ) / 1000000.0f;
+			rtt.Read( snapshot.rtt );
+			jitter.Read( snapshot.jitter );
+		}
+
+		// counters
+		std::atomic<unsigned long long> packets_sent;
+		std::atomic<unsigned long long> packets_received;		// including duplicates
+		std::atomic<unsigned long long> packets_acked;
+		std::atomic<unsigned long long> packets_lost;			// not acked within the rto
+		std::atomic<unsigned long long> retransmits;			// counted by whoever resends the data
+		std::atomic<unsigned long long> duplicates;
+		std::atomic<unsigned long long> ack_frames;
+		std::atomic<unsigned long long> bytes_sent;				// payload bytes
+		std::atomic<unsigned long long> bytes_delivered;		// payload bytes of new packets handed to the application
+
+		// gauges
+		std::atomic<unsigned long long> sent_queue;
+		std::atomic<unsigned long long> pending_ack_queue;
+		std::atomic<unsigned long long> received_queue;
+		std::atomic<unsigned long long> acked_queue;
+		std::atomic<unsigned long long> pacing_rate;
+		std::atomic<unsigned long long> pacing_window;
+		std::atomic<unsigned long long> srtt_us;
+		std::atomic<unsigned long long> rto_us;
+
+		Histogram rtt;
+		Histogram jitter;
+
+	private:
+
+		std::atomic<unsigned long long> last_rtt_us;			// previous sample + 1, zero before the first
+	};
+
+	// append snapshots in the prometheus text exposition format, every series labelled with its connection name
+
+	inline void WritePrometheus( std::string & out, const std::vector< std::pair<std::string, MetricsSnapshot> > & connections )
+	{
+		char line[256];
+
+		struct Series
+		{
+			const char * name;
+			const char * type;
+			const char * help;
+		};
+
+		static const Series series[] =
+		{
+			{ "rudp_packets_sent_total", "counter", "Packets sent." },
+			{ "rudp_packets_received_total", "counter", "Packets received, including duplicates." },
+			{ "rudp_packets_acked_total", "counter", "Sent packets acknowledged by the peer." },
+			{ "rudp_packets_lost_total", "counter", "Sent packets not acknowledged within the retransmission timeout." },
+			{ "rudp_retransmits_total", "counter", "Packets of data or control the application sent again." },
+			{ "rudp_duplicates_total", "counter", "Duplicate packets received." },
+			{ "rudp_ack_frames_total", "counter", "Header-only ack frames sent." },
+			{ "rudp_sent_bytes_total", "counter", "Payload bytes sent." },
+			{ "rudp_delivered_bytes_total", "counter", "Payload bytes delivered to the application." },
+			{ "rudp_sent_queue_packets", "gauge", "Packets in the sent bandwidth window." },
+			{ "rudp_pending_ack_queue_packets", "gauge", "Sent packets awaiting an ack." },
+			{ "rudp_received_queue_packets", "gauge", "Received packets kept for ack generation." },
+			{ "rudp_acked_queue_packets", "gauge", "Acked packets in the acked bandwidth window." },
+			{ "rudp_pacing_rate_bytes", "gauge", "Pacing rate in bytes per second." },
+			{ "rudp_pacing_window_bytes", "gauge", "Bytes the pacer sends in one round trip, the pacing rate times the smoothed round trip time." },
+			{ "rudp_srtt_seconds", "gauge", "Smoothed round trip time." },
+			{ "rudp_rto_seconds", "gauge", "Retransmission timeout." },
+		};
+		const int count = sizeof( series ) / sizeof( series[0] );
+
+		for ( int i = 0; i < count; ++i )
+		{
+			snprintf( line, sizeof( line ), "# HELP %s %s\n# TYPE %s %s\n", series[i].name, series[i].help, series[i].name, series[i].type );
+			out += line;
+			for ( const auto & connection : connections )
+			{
+				const MetricsSnapshot & m = connection.second;
+				const double values[count] = { (double) m.packets_sent, (double) m.packets_received, (double) m.packets_acked,
+					(double) m.packets_lost, (double) m.retransmits, (double) m.duplicates, (double) m.ack_frames, (double) m.bytes_sent,
+					(double) m.bytes_delivered, (double) m.sent_queue, (double) m.pending_ack_queue, (double) m.received_queue,
+					(double) m.acked_queue, (double) m.pacing_rate, (double) m.pacing_window, m.srtt, m.rto };
+				snprintf( line, sizeof( line ), "%s{connection=\"%s\"} %.17g\n", series[i].name, connection.first.c_str(), values[i] );
+				out += line;
+			}
+		}
+
+		static const Series histograms[] =
+		{
+			{ "rudp_rtt_seconds", "histogram", "Round trip time samples." },
+			{ "rudp_jitter_seconds", "histogram", "Change between consecutive round trip time samples." },
+		};
+
+		// export at power of two boundaries from 16us to ~67s, the fine buckets stay internal
+		for ( int i = 0; i < 2; ++i )
+		{
+			snprintf( line, sizeof( line ), "# HELP %s %s\n# TYPE %s histogram\n", histograms[i].name, histograms[i].help, histograms[i].name );
+			out += line;
+			for ( const auto & connection : connections )
+			{
+				const char * name = histograms[i].name;
+				const char * label = connection.first.c_str();
+				const Histogram::Snapshot & h = i == 0 ? connection.second.rtt : connection.second.jitter;
+				unsigned long long cumulative = 0;
+				int bucket = 0;
+				for ( int exponent = 4; exponent <= 26; ++exponent )
+				{
+					const unsigned long long bound = ( 1ULL << exponent ) - 1;
+					while ( bucket < Histogram::Buckets && Histogram::UpperBound( bucket ) <= bound )
+						cumulative += h.counts[bucket++];
+					snprintf( line, sizeof( line ), "%s_bucket{connection=\"%s\",le=\"%g\"} %llu\n", name, label, ( bound + 1 ) / 1000000.0, cumulative );
+					out += line;
+				}
+				snprintf( line, sizeof( line ), "%s_bucket{connection=\"%s\",le=\"+Inf\"} %llu\n%s_sum{connection=\"%s\"} %.6f\n%s_count{connection=\"%s\"} %llu\n",
+					name, label, h.count, name, label, h.sum / 1000000.0, name, label, h.count );
+				out += line;
+			}
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,244 @@
+/*
+* FILE : MetricsExporter.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides a small local exporter that serves the metrics of
+*   registered connections in the Prometheus text format. It listens on a
+*   loopback TCP port or, outside Windows, on a Unix domain socket, and
+*   answers every request from its own thread with a fresh snapshot, so
+*   the I/O thread is never stopped or locked while it is scraped.
+*/
+
+#ifndef METRICS_EXPORTER_H
+#define METRICS_EXPORTER_H
+
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+
+#include "Net.h"
+#include "Metrics.h"
+
+#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+	#include <sys/un.h>
+	#include <sys/select.h>
+	#include <arpa/inet.h>
+#endif
+
+namespace net
+{
+	class MetricsExporter
+	{
+	public:
+
+		MetricsExporter()
+		{
+			listener = -1;
+			running = false;
+		}
+
+		~MetricsExporter()
+		{
+			Stop();
+		}
+
+		// serve on 127.0.0.1:port, e.g. scrape with "curl http://127.0.0.1:9464/metrics"
+
+		bool Start( unsigned short port )
+		{
+			assert( !running );
+			listener = (int) ::socket( AF_INET, SOCK_STREAM, IPPROTO_TCP );
+			if ( listener < 0 )
+				return false;
+			int reuse = 1;
+			setsockopt( listener, SOL_SOCKET, SO_REUSEADDR, (const char*) &reuse, sizeof( reuse ) );
+			sockaddr_in address;
+			memset( &address, 0, sizeof( address ) );
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl( 0x7F000001 );
+			address.sin_port = htons( port );
+			return Listen( (const sockaddr*) &address, sizeof( address ) );
+		}
+
+		#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+
+		// serve on a unix domain socket, e.g. "curl --unix-socket /tmp/rudp.sock http://localhost/metrics"
+
+		bool Start( const char * path )
+		{
+			assert( !running );
+			sockaddr_un address;
+			memset( &address, 0, sizeof( address ) );
+			address.sun_family = AF_UNIX;
+			if ( strlen( path ) >= sizeof( address.sun_path ) )
+				return false;
+			strcpy( address.sun_path, path );
+			unlink( path );
+			listener = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+			if ( listener < 0 )
+				return false;
+			unix_path = path;
+			return Listen( (const sockaddr*) &address, sizeof( address ) );
+		}
+
+		#endif
+
+		void Stop()
+		{
+			if ( running )
+			{
+				running = false;
+				thread.join();
+			}
+			if ( listener >= 0 )
+			{
+				CloseSocket( listener );
+				listener = -1;
+			}
+			#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+			if ( !unix_path.empty() )
+			{
+				unlink( unix_path.c_str() );
+				unix_path.clear();
+			}
+			#endif
+		}
+
+		// registered metrics must outlive their registration
+
+		void Add( const std::string & name, const ConnectionMetrics * metrics )
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			sources.push_back( std::make_pair( name, metrics ) );
+		}
+
+		void Remove( const ConnectionMetrics * metrics )
+		{
+			std::lock_guard<std::mutex> lock( mutex );
+			for ( size_t i = 0; i < sources.size(); ++i )
+			{
+				if ( sources[i].second == metrics )
+				{
+					sources.erase( sources.begin() + i );
+					return;
+				}
+			}
+		}
+
+		// the text a scrape returns
+
+		std::string Render()
+		{
+			std::vector< std::pair<std::string, MetricsSnapshot> > snapshots;
+			{
+				std::lock_guard<std::mutex> lock( mutex );
+				snapshots.resize( sources.size() );
+				for ( size_t i = 0; i < sources.size(); ++i )
+				{
+					snapshots[i].first = sources[i].first;
+					sources[i].second->Read( snapshots[i].second );
+				}
+			}
+			std::string body;
+			WritePrometheus( body, snapshots );
+			return body;
+		}
+
+	private:
+
+		bool Listen( const sockaddr * address, int size )
+		{
+			if ( ::bind( listener, address, size ) < 0 || ::listen( listener, 4 ) < 0 )
+			{
+				NET_ERROR( "failed to start metrics exporter" );
+				CloseSocket( listener );
+				listener = -1;
+				return false;
+			}
+			running = true;
+			thread = std::thread( &MetricsExporter::Serve, this );
+			return true;
+		}
+
+		void Serve()
+		{
+			while ( running )
+			{
+				// wake regularly to notice Stop
+				fd_set readable;
+				FD_ZERO( &readable );
+				FD_SET( listener, &readable );
+				timeval timeout = { 0, 100000 };
+				if ( select( listener + 1, &readable, 0, 0, &timeout ) <= 0 )
+					continue;
+				int client = (int) accept( listener, 0, 0 );
+				if ( client < 0 )
+					continue;
+				#if defined( SO_NOSIGPIPE )
+				int one = 1;
+				setsockopt( client, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof( one ) );
+				#endif
+
+				// read the request head, whatever the path every request gets the metrics
+				char request[1024];
+				int received = 0;
+				while ( received < (int) sizeof( request ) - 1 )
+				{
+					FD_ZERO( &readable );
+					FD_SET( client, &readable );
+					timeval wait = { 1, 0 };
+					if ( select( client + 1, &readable, 0, 0, &wait ) <= 0 )
+						break;
+					const int bytes = (int) recv( client, request + received, sizeof( request ) - 1 - received, 0 );
+					if ( bytes <= 0 )
+						break;
+					received += bytes;
+					request[received] = '\0';
+					if ( strstr( request, "\r\n\r\n" ) || strstr( request, "\n\n" ) )
+						break;
+				}
+
+				const std::string body = Render();
+				char head[160];
+				snprintf( head, sizeof( head ), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.size() );
+				const std::string response = head + body;
+				// a scraper hanging up mid-response must not raise SIGPIPE, EPIPE just ends the response
+				#if defined( MSG_NOSIGNAL )
+				const int flags = MSG_NOSIGNAL;
+				#else
+				const int flags = 0;
+				#endif
+				size_t sent = 0;
+				while ( sent < response.size() )
+				{
+					const int bytes = (int) send( client, response.data() + sent, (int) ( response.size() - sent ), flags );
+					if ( bytes <= 0 )
+						break;
+					sent += bytes;
+				}
+				CloseSocket( client );
+			}
+		}
+
+		static void CloseSocket( int socket )
+		{
+			#if PLATFORM == PLATFORM_MAC || PLATFORM == PLATFORM_UNIX
+			close( socket );
+			#elif PLATFORM == PLATFORM_WINDOWS
+			closesocket( socket );
+			#endif
+		}
+
+		int listener;
+		std::atomic<bool> running;
+		std::thread thread;
+		std::mutex mutex;						// guards sources; never taken by the i/o thread
+		std::vector< std::pair<std::string, const ConnectionMetrics*> > sources;
+		std::string unix_path;
+	};
+}
+
+#endif
@@ -0,0 +1,208 @@
+/*
+* FILE : Multipath.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides the scheduler that stripes one transfer across
+*   several paths. A path is a `ReliableConnection` with its own socket or
+*   source port and its own pacer, so each path keeps its own round trip
+*   time and loss in its `ReliabilitySystem`. Each packet goes out on the
+*   path, among those whose pacer allows a packet now, where it is expected
+*   to arrive first. A slower path is held back while a faster one would
+*   still deliver the packet and the data queued behind it before the
+*   slower path could, so a slow path only carries the backlog the faster
+*   ones cannot drain in time. A path losing many packets is rested until
+*   its loss estimate decays.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "Net.h"
+
+/*
+ * Class : PathScheduler
+ * Description :
+ *   Picks the path for each packet of a striped transfer.
+ */
+class PathScheduler
+{
+public:
+	/*
+	 * Function : Add
+	 * Description :
+	 *   Adds a path. The connection and pacer must outlive their registration.
+	 * Parameters :
+	 *   net::ReliableConnection* connection - The path's connection.
+	 *   net::Pacer* pacer - The pacer limiting the path's send rate.
+	 * Return :
+	 *   void
+	 */
+	void Add(net::ReliableConnection* connection, net::Pacer* pacer)
+	{
+		Path path = { connection, pacer };
+		m_paths.push_back(path);
+	}
+
+	/*
+	 * Function : Remove
+	 * Description :
+	 *   Removes a path.
+	 * Parameters :
+	 *   const net::ReliableConnection* connection - The path's connection.
+	 * Return :
+	 *   void
+	 */
+	void Remove(const net::ReliableConnection* connection)
+	{
+		m_paths.erase(std::remove_if(m_paths.begin(), m_paths.end(),
+			[connection](const Path& path) { return path.connection == connection; }), m_paths.end());
+	}
+
+	/*
+	 * Function : GetPathCount
+	 * Description :
+	 *   Returns the number of paths.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of paths.
+	 */
+	size_t GetPathCount() const
+	{
+		return m_paths.size();
+	}
+
+	/*
+	 * Function : Update
+	 * Description :
+	 *   Refreshes the recent loss rate of every path from its reliability system.
+	 *   Call it once per tick, after the connections are updated.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Update()
+	{
+		for (Path& path : m_paths)
+		{
+			const net::ReliabilitySystem& reliability = path.connection->GetReliabilitySystem();
+			const unsigned int sent = reliability.GetSentPackets() - path.sent;
+			const unsigned int lost = reliability.GetLostPackets() - path.lost;
+			path.sent = reliability.GetSentPackets();
+			path.lost = reliability.GetLostPackets();
+			// an idle path is forgiven slowly so a rested path is tried again
+			const float sample = sent > 0 ? std::min(1.0f, (float)lost / sent) : 0.0f;
+			path.loss += (sample - path.loss) * LossGain;
+		}
+	}
+
+	/*
+	 * Function : Pick
+	 * Description :
+	 *   Chooses, among the paths whose pacer allows the packet now, the one on
+	 *   which it would arrive first: half the round trip plus the expected cost
+	 *   of losing it there. No path is chosen while a path that is not ready yet
+	 *   would deliver the packet and everything queued behind it sooner than the
+	 *   ready one delivers this packet alone, so the sender waits for the faster
+	 *   path instead. Paths above LossLimit are passed over while another path
+	 *   is usable. The chosen path's pacer tokens are taken.
+	 * Parameters :
+	 *   int bytes - The size of the packet.
+	 *   long long queued - The bytes waiting to be sent, this packet included.
+	 * Return :
+	 *   net::ReliableConnection* - The path to send on, or NULL to wait.
+	 */
+	net::ReliableConnection* Pick(int bytes, long long queued)
+	{
+		bool healthy = false;
+		for (const Path& path : m_paths)
+		{
+			healthy |= path.connection->IsConnected() && path.loss <= LossLimit;
+		}
+
+		const unsigned long long now = net::time_now_ns();
+		Path* best = nullptr;
+		double bestArrival = 0.0;
+		double soonest = -1.0;
+		for (Path& path : m_paths)
+		{
+			if (!path.connection->IsConnected() || (healthy && path.loss > LossLimit))
+			{
+				continue;
+			}
+			// a lost packet is asked for again about a round trip later
+			const double rtt = path.connection->GetReliabilitySystem().GetRoundTripTime();
+			const double loss = std::min((double)path.loss, MaxLoss);
+			const double arrival = rtt * (0.5 + loss / (1.0 - loss));
+			if (path.pacer->IsReady(bytes))
+			{
+				if (best == nullptr || arrival < bestArrival)
+				{
+					best = &path;
+					bestArrival = arrival;
+				}
+				continue;
+			}
+			// a path that is not ready drains the backlog at its pacing rate once it is
+			const double rate = path.pacer->GetRate();
+			if (rate > 0.0)
+			{
+				const double wait = (path.pacer->NextDeparture(bytes) - now) / 1000000000.0;
+				const double done = wait + std::max(queued - bytes, 0LL) / rate + arrival;
+				if (soonest < 0.0 || done < soonest)
+				{
+					soonest = done;
+				}
+			}
+		}
+		if (best == nullptr || (soonest >= 0.0 && soonest < bestArrival) || !best->pacer->TryConsume(bytes))
+		{
+			return nullptr;
+		}
+		best->packets++;
+		return best->connection;
+	}
+
+	/*
+	 * Function : GetPackets
+	 * Description :
+	 *   Returns how many packets were sent on a path.
+	 * Parameters :
+	 *   const net::ReliableConnection* connection - The path's connection.
+	 * Return :
+	 *   unsigned long long - The number of packets picked for the path.
+	 */
+	unsigned long long GetPackets(const net::ReliableConnection* connection) const
+	{
+		for (const Path& path : m_paths)
+		{
+			if (path.connection == connection)
+			{
+				return path.packets;
+			}
+		}
+		return 0;
+	}
+
+private:
+	static constexpr float LossGain = 0.125f;   // weight of each tick's loss sample
+	static constexpr float LossLimit = 0.25f;   // loss above which a path is rested
+	static constexpr double MaxLoss = 0.9;
+
+	struct Path
+	{
+		net::ReliableConnection* connection;
+		net::Pacer* pacer;
+		unsigned int sent = 0;                  // reliability counters at the last update
+		unsigned int lost = 0;
+		float loss = 0.0f;                      // smoothed fraction of packets lost
+		unsigned long long packets = 0;
+	};
+
+	std::vector<Path> m_paths;
+};
@@ -32,7 +32,13 @@
 
 	#include <sys/socket.h>
 	#include <netinet/in.h>
+	#include <netinet/udp.h>
 	#include <fcntl.h>
+	#include <time.h>
+	#include <errno.h>
+	#include <poll.h>
+	#include <pthread.h>
+	#include <sched.h>
 
 #else
 
@@ -47,6 +53,11 @@
 #include <list>
 #include <algorithm>
 #include <functional>
+#include <memory>
+#include <cstddef>
+
+#include "Metrics.h"
+#include "Log.h"
 
 namespace net
 {
@@ -68,6 +79,282 @@ namespace net
 
 #endif
 
+	// high resolution monotonic clock and absolute sleep, in nanoseconds
+	//  + usleep/Sleep round up to the scheduler tick, which is far too coarse to pace individual packets
+
+#if PLATFORM == PLATFORM_WINDOWS
+
+	inline unsigned long long time_now_ns()
+	{
+		static LARGE_INTEGER frequency = { 0 };
+		if ( frequency.QuadPart == 0 )
+			QueryPerformanceFrequency( &frequency );
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter( &counter );
+		return (unsigned long long) ( counter.QuadPart / frequency.QuadPart ) * 1000000000ULL +
+			   (unsigned long long) ( counter.QuadPart % frequency.QuadPart ) * 1000000000ULL / frequency.QuadPart;
+	}
+
+	inline void sleep_until_ns( unsigned long long deadline )
+	{
+		#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+		#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+		#endif
+		static HANDLE timer = CreateWaitableTimerExW( NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS );
+		unsigned long long now = time_now_ns();
+		if ( deadline <= now )
+			return;
+		if ( timer != NULL )
+		{
+			LARGE_INTEGER due;
+			due.QuadPart = -(LONGLONG) ( ( deadline - now ) / 100 );		// relative, in 100ns units
+			if ( SetWaitableTimer( timer, &due, 0, NULL, NULL, FALSE ) )
+			{
+				WaitForSingleObject( timer, INFINITE );
+				return;
+			}
+		}
+		Sleep( (DWORD) ( ( deadline - now ) / 1000000 ) );
+	}
+
+#else
+
+	inline unsigned long long time_now_ns()
+	{
+		timespec ts;
+		clock_gettime( CLOCK_MONOTONIC, &ts );
+		return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+	}
+
+	inline void sleep_until_ns( unsigned long long deadline )
+	{
+		#if PLATFORM == PLATFORM_MAC
+		unsigned long long now = time_now_ns();
+		if ( deadline > now )
+			usleep( (useconds_t) ( ( deadline - now ) / 1000 ) );
+		#else
+		timespec ts;
+		ts.tv_sec = (time_t) ( deadline / 1000000000ULL );
+		ts.tv_nsec = (long) ( deadline % 1000000000ULL );
+		while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL ) == EINTR ) {}
+		#endif
+	}
+
+#endif
+
+	// latency mode helpers
+	//  + pin_thread keeps the calling i/o thread on one cpu, so it is not migrated away from its warm caches
+	//  + cpu_relax is the pause inside a spin loop, it hands the core to a sibling hyperthread
+
+#if PLATFORM == PLATFORM_WINDOWS
+
+	inline bool pin_thread( int cpu )
+	{
+		if ( cpu < 0 || cpu >= (int) ( sizeof( DWORD_PTR ) * 8 ) )
+			return false;
+		return SetThreadAffinityMask( GetCurrentThread(), (DWORD_PTR) 1 << cpu ) != 0;
+	}
+
+#elif PLATFORM == PLATFORM_UNIX
+
+	inline bool pin_thread( int cpu )
+	{
+		if ( cpu < 0 || cpu >= CPU_SETSIZE )
+			return false;
+		cpu_set_t set;
+		CPU_ZERO( &set );
+		CPU_SET( cpu, &set );
+		return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+	}
+
+#else
+
+	inline bool pin_thread( int cpu )
+	{
+		// macos only takes affinity hints
+		(void) cpu;
+		return false;
+	}
+
+#endif
+
+	inline void cpu_relax()
+	{
+		#if defined( _MSC_VER )
+		YieldProcessor();
+		#elif defined( __i386__ ) || defined( __x86_64__ )
+		__builtin_ia32_pause();
+		#elif defined( __aarch64__ ) || defined( __arm__ )
+		__asm__ __volatile__( "yield" );
+		#endif
+	}
+
+	// adaptive spin-then-block wait for loops that care more about latency than cpu
+	//  + once a receive comes up empty the loop keeps polling the socket for a spin budget, then blocks
+	//    in the kernel until a datagram arrives or the deadline passes
+	//  + a spin that catches a datagram doubles the budget and one that runs dry halves it, so a busy
+	//    peer is met spinning while a quiet one, or a peer sharing our only cpu, costs almost nothing
+
+	class BusyPoller
+	{
+	public:
+
+		BusyPoller( unsigned int maxSpinNs = DefaultSpin )
+		{
+			maxSpin = maxSpinNs;
+			spin = maxSpinNs;
+			spinStart = 0;
+		}
+
+		// the receive returned data
+
+		void Ready()
+		{
+			if ( spinStart != 0 )
+				spin = std::min( std::max( spin * 2, (unsigned int) MinSpin ), maxSpin );
+			spinStart = 0;
+		}
+
+		// the receive came up empty: returns at once while the budget lasts (the caller polls again),
+		// then blocks "waitable" (a Socket or Connection) until a datagram is waiting or the deadline passes
+
+		template <typename Waitable> void Idle( Waitable & waitable, unsigned long long deadline )
+		{
+			const unsigned long long now = time_now_ns();
+			if ( now >= deadline )
+				return;
+			if ( spinStart == 0 )
+				spinStart = now;
+			if ( now - spinStart < spin )
+			{
+				cpu_relax();
+				return;
+			}
+			// never below MinSpin, a budget of zero would block at once and Ready could not grow it again
+			spin = std::min( std::max( spin / 2, (unsigned int) MinSpin ), maxSpin );
+			waitable.Wait( deadline );
+			spinStart = 0;
+		}
+
+		unsigned int GetSpin() const
+		{
+			return spin;
+		}
+
+	private:
+
+		enum
+		{
+			DefaultSpin = 50000,			// ns, about ten loopback round trips
+			MinSpin = 1000
+		};
+
+		unsigned int maxSpin;
+		unsigned int spin;					// current budget in ns
+		unsigned long long spinStart;		// start of the current spin, 0 when not spinning
+	};
+
+	// token bucket pacer
+	//  + tokens are bytes, refilled continuously at the rate set by flow/congestion control
+	//  + the bucket depth bounds the largest burst, so departures are spread evenly instead of
+	//    leaving in one clump at the start of every frame
+
+	class Pacer
+	{
+	public:
+
+		Pacer( float bytesPerSecond = 0.0f, int burstBytes = 0 )
+		{
+			rate = 0.0;
+			burst = 0.0;
+			Reset( bytesPerSecond, burstBytes );
+		}
+
+		void Reset( float bytesPerSecond, int burstBytes )
+		{
+			rate = bytesPerSecond;
+			burst = burstBytes;
+			tokens = burstBytes;
+			last = time_now_ns();
+		}
+
+		void SetRate( float bytesPerSecond )
+		{
+			Refill( time_now_ns() );
+			rate = bytesPerSecond;
+		}
+
+		void SetBurst( int burstBytes )
+		{
+			burst = burstBytes;
+			if ( tokens > burst )
+				tokens = burst;
+		}
+
+		// consume tokens for a packet if they are available right now
+
+		bool TryConsume( int bytes )
+		{
+			Refill( time_now_ns() );
+			if ( tokens < bytes )
+				return false;
+			tokens -= bytes;
+			return true;
+		}
+
+		// whether a packet of this size may depart right now, without taking the tokens
+
+		bool IsReady( int bytes )
+		{
+			Refill( time_now_ns() );
+			return tokens >= bytes;
+		}
+
+		// absolute time at which a packet of this size may depart
+
+		unsigned long long NextDeparture( int bytes )
+		{
+			unsigned long long now = time_now_ns();
+			Refill( now );
+			if ( tokens >= bytes )
+				return now;
+			if ( rate <= 0.0 )
+				return ~0ULL;
+			return now + (unsigned long long) ( ( bytes - tokens ) / rate * 1000000000.0 );
+		}
+
+		// sleep until the next departure or the deadline, whichever is first
+
+		void WaitUntil( int bytes, unsigned long long deadline )
+		{
+			unsigned long long departure = NextDeparture( bytes );
+			sleep_until_ns( departure < deadline ? departure : deadline );
+		}
+
+		float GetRate() const
+		{
+			return (float) rate;
+		}
+
+	private:
+
+		void Refill( unsigned long long now )
+		{
+			if ( now > last )
+			{
+				tokens += rate * ( now - last ) / 1000000000.0;
+				if ( tokens > burst )
+					tokens = burst;
+			}
+			last = now;
+		}
+
+		double rate;					// bytes per second
+		double burst;					// bucket depth in bytes
+		double tokens;					// bytes that may be sent right now
+		unsigned long long last;		// time of the last refill
+	};
+
 	// internet address
 
 	class Address
@@ -168,21 +455,36 @@ namespace net
 		#endif
 	}
 
+	// udp socket
+	//  + Open/Close/Send/Receive are virtual so test transports (impairment, simulation) can stand in for it
+
 	class Socket
 	{
 	public:
 	
+		// limits of one segment train: the kernel takes at most 64 segments in a 64k datagram
+
+		enum
+		{
+			MaxTrainSegments = 64,
+			MaxTrainBytes = 65535 - 8 - 20
+		};
+
 		Socket()
 		{
 			socket = 0;
+			local = 0;
+			offload = true;
+			gso = false;
+			gro = false;
 		}
 	
-		~Socket()
+		virtual ~Socket()
 		{
 			Close();
 		}
 	
-		bool Open( unsigned short port )
+		virtual bool Open( unsigned short port )
 		{
 			assert( !IsOpen() );
 		
@@ -192,7 +494,7 @@ namespace net
 
 			if ( socket <= 0 )
 			{
-				printf( "failed to create socket\n" );
+				NET_ERROR( "failed to create socket" );
 				socket = 0;
 				return false;
 			}
@@ -201,12 +503,12 @@ namespace net
 
 			sockaddr_in address;
 			address.sin_family = AF_INET;
-			address.sin_addr.s_addr = INADDR_ANY;
+			address.sin_addr.s_addr = local != 0 ? htonl( local ) : INADDR_ANY;
 			address.sin_port = htons( (unsigned short) port );
 		
 			if (::bind(socket, (const sockaddr*)&address, sizeof(sockaddr_in)) < 0)
 			{
-				printf( "failed to bind socket\n" );
+				NET_ERROR( "failed to bind socket" );
 				Close();
 				return false;
 			}
@@ -218,7 +520,7 @@ namespace net
 				int nonBlocking = 1;
 				if ( fcntl( socket, F_SETFL, O_NONBLOCK, nonBlocking ) == -1 )
 				{
-					printf( "failed to set non-blocking socket\n" );
+					NET_ERROR( "failed to set non-blocking socket" );
 					Close();
 					return false;
 				}
@@ -228,17 +530,27 @@ namespace net
 				DWORD nonBlocking = 1;
 				if ( ioctlsocket( socket, FIONBIO, &nonBlocking ) != 0 )
 				{
-					printf( "failed to set non-blocking socket\n" );
+					NET_ERROR( "failed to set non-blocking socket" );
 					Close();
 					return false;
 				}
 
 			#endif
+
+			// udp segmentation and receive offload, where the kernel has them (linux 4.18 / 5.0)
+
+			#if defined( UDP_SEGMENT ) && defined( UDP_GRO )
+
+				int zero = 0, one = 1;
+				gso = offload && setsockopt( socket, IPPROTO_UDP, UDP_SEGMENT, &zero, sizeof( zero ) ) == 0;
+				gro = offload && setsockopt( socket, IPPROTO_UDP, UDP_GRO, &one, sizeof( one ) ) == 0;
+
+			#endif
 		
 			return true;
 		}
 	
-		void Close()
+		virtual void Close()
 		{
 			if ( socket != 0 )
 			{
@@ -249,14 +561,40 @@ namespace net
 				#endif
 				socket = 0;
 			}
+			gso = false;
+			gro = false;
 		}
 	
-		bool IsOpen() const
+		virtual bool IsOpen() const
 		{
 			return socket != 0;
 		}
+
+		// bind to one local interface instead of all of them (set before Open)
+
+		void SetLocalAddress( unsigned int address )
+		{
+			local = address;
+		}
+
+		// allow segmentation/receive offload (set before Open, on by default)
+
+		void SetOffload( bool enable )
+		{
+			offload = enable;
+		}
+
+		bool IsSendOffload() const
+		{
+			return gso;
+		}
+
+		virtual bool IsReceiveOffload() const
+		{
+			return gro;
+		}
 	
-		bool Send( const Address & destination, const void * data, int size )
+		virtual bool Send( const Address & destination, const void * data, int size )
 		{
 			assert( data );
 			assert( size > 0 );
@@ -277,7 +615,7 @@ namespace net
 			return sent_bytes == size;
 		}
 	
-		int Receive( Address & sender, void * data, int size )
+		virtual int Receive( Address & sender, void * data, int size )
 		{
 			assert( data );
 			assert( size > 0 );
@@ -304,10 +642,222 @@ namespace net
 
 			return received_bytes;
 		}
+
+		// send "size" bytes as a train of datagrams of "segment" bytes each (the last one may be shorter)
+		//  + with udp gso the train takes one syscall and the kernel or nic splits it. without it, or once
+		//    the kernel refuses, every datagram goes through Send so wrapping transports still see each one
+
+		virtual bool SendSegments( const Address & destination, const void * data, int size, int segment )
+		{
+			assert( data );
+			assert( segment > 0 );
+
+			const char * bytes = (const char*) data;
+			int offset = 0;
+			bool ok = true;
+
+			#if defined( UDP_SEGMENT )
+
+			while ( gso && socket != 0 && size - offset > segment )
+			{
+				int count = ( size - offset + segment - 1 ) / segment;
+				if ( count > MaxTrainSegments )
+					count = MaxTrainSegments;
+				if ( count * segment > MaxTrainBytes )
+					count = MaxTrainBytes / segment;
+				const int length = size - offset < count * segment ? size - offset : count * segment;
+
+				sockaddr_in address;
+				address.sin_family = AF_INET;
+				address.sin_addr.s_addr = htonl( destination.GetAddress() );
+				address.sin_port = htons( (unsigned short) destination.GetPort() );
+
+				iovec vector;
+				vector.iov_base = (void*) ( bytes + offset );
+				vector.iov_len = length;
+
+				char control[CMSG_SPACE( sizeof( uint16_t ) )] = { 0 };
+				msghdr message = {};
+				message.msg_name = &address;
+				message.msg_namelen = sizeof( address );
+				message.msg_iov = &vector;
+				message.msg_iovlen = 1;
+				message.msg_control = control;
+				message.msg_controllen = sizeof( control );
+				cmsghdr * header = CMSG_FIRSTHDR( &message );
+				header->cmsg_level = IPPROTO_UDP;
+				header->cmsg_type = UDP_SEGMENT;
+				header->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+				const uint16_t segmentSize = (uint16_t) segment;
+				memcpy( CMSG_DATA( header ), &segmentSize, sizeof( segmentSize ) );
+
+				if ( sendmsg( socket, &message, 0 ) == length )
+				{
+					offset += length;
+					continue;
+				}
+				if ( errno != EIO && errno != EINVAL && errno != EOPNOTSUPP )
+				{
+					ok = false;
+					offset += length;
+					continue;
+				}
+				// no segmentation on this route (e.g. checksum offload off): send them one by one from now on
+				NET_INFO( "udp segmentation offload unavailable, sending datagrams one at a time" );
+				gso = false;
+			}
+
+			#endif
+
+			return SendEach( destination, bytes + offset, size - offset, segment ) && ok;
+		}
+
+		// receive a datagram, or with udp gro a train of datagrams from one sender coalesced into "data",
+		// which then needs MaxTrainBytes of room. "segment" is set to the size of each datagram in it
+
+		virtual int ReceiveSegments( Address & sender, void * data, int size, int & segment )
+		{
+			assert( data );
+			assert( size > 0 );
+
+			#if defined( UDP_GRO )
+
+			if ( gro && socket != 0 )
+			{
+				sockaddr_in from;
+				iovec vector;
+				vector.iov_base = data;
+				vector.iov_len = size;
+
+				char control[CMSG_SPACE( sizeof( int ) )];
+				msghdr message = {};
+				message.msg_name = &from;
+				message.msg_namelen = sizeof( from );
+				message.msg_iov = &vector;
+				message.msg_iovlen = 1;
+				message.msg_control = control;
+				message.msg_controllen = sizeof( control );
+
+				int received_bytes = (int) recvmsg( socket, &message, 0 );
+				if ( received_bytes <= 0 )
+					return 0;
+
+				segment = received_bytes;
+				for ( cmsghdr * header = CMSG_FIRSTHDR( &message ); header != NULL; header = CMSG_NXTHDR( &message, header ) )
+				{
+					if ( header->cmsg_level == IPPROTO_UDP && header->cmsg_type == UDP_GRO )
+					{
+						int coalesced;
+						memcpy( &coalesced, CMSG_DATA( header ), sizeof( coalesced ) );
+						if ( coalesced > 0 )
+							segment = coalesced;
+					}
+				}
+
+				sender = Address( ntohl( from.sin_addr.s_addr ), ntohs( from.sin_port ) );
+				return received_bytes;
+			}
+
+			#endif
+
+			const int received_bytes = Receive( sender, data, size );
+			segment = received_bytes;
+			return received_bytes;
+		}
+
+		// block until a datagram is waiting or the deadline (time_now_ns) passes, true if one is waiting
+
+		virtual bool Wait( unsigned long long deadline )
+		{
+			if ( socket == 0 )
+				return false;
+			const unsigned long long now = time_now_ns();
+			const unsigned long long remaining = deadline > now ? deadline - now : 0;
+			#if PLATFORM == PLATFORM_WINDOWS
+			WSAPOLLFD descriptor = { socket, POLLRDNORM, 0 };
+			const int timeout = deadline == ~0ULL ? -1 : (int) ( ( remaining + 999999 ) / 1000000 );
+			return WSAPoll( &descriptor, 1, timeout ) > 0;
+			#elif PLATFORM == PLATFORM_UNIX
+			// ppoll takes nanoseconds, poll would round a short wait up to a whole millisecond
+			pollfd descriptor = { socket, POLLIN, 0 };
+			timespec ts;
+			ts.tv_sec = (time_t) ( remaining / 1000000000ULL );
+			ts.tv_nsec = (long) ( remaining % 1000000000ULL );
+			return ppoll( &descriptor, 1, deadline == ~0ULL ? NULL : &ts, NULL ) > 0;
+			#else
+			pollfd descriptor = { socket, POLLIN, 0 };
+			const int timeout = deadline == ~0ULL ? -1 : (int) ( ( remaining + 999999 ) / 1000000 );
+			return poll( &descriptor, 1, timeout ) > 0;
+			#endif
+		}
+
+		// hand datagrams a transport has queued or delayed to the network now (the udp socket holds none)
+
+		virtual void Flush()
+		{
+		}
+
+		// kernel busy polling (linux): a blocking receive on this socket polls the device queue for up to
+		// "microseconds" before it sleeps, and "prefer" keeps the queue busy polled rather than interrupt
+		// driven under load (5.11). raising the time needs CAP_NET_ADMIN. set it after Open
+
+		bool SetBusyPoll( int microseconds, bool prefer )
+		{
+			if ( socket == 0 )
+				return false;
+			#if defined( SO_BUSY_POLL )
+			bool ok = setsockopt( socket, SOL_SOCKET, SO_BUSY_POLL, (const char*) &microseconds, sizeof( microseconds ) ) == 0;
+			#if defined( SO_PREFER_BUSY_POLL )
+			const int enable = prefer ? 1 : 0;
+			ok = setsockopt( socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, (const char*) &enable, sizeof( enable ) ) == 0 && ok;
+			#else
+			ok = ok && !prefer;
+			#endif
+			return ok;
+			#else
+			(void) microseconds;
+			(void) prefer;
+			return false;
+			#endif
+		}
+
+		// ask the kernel to pace this socket's departures (needs the fq qdisc on the egress interface)
+
+		virtual bool SetPacingRate( unsigned int bytesPerSecond )
+		{
+			if ( socket == 0 )
+				return false;
+			#if defined( SO_MAX_PACING_RATE )
+			return setsockopt( socket, SOL_SOCKET, SO_MAX_PACING_RATE, (const char*) &bytesPerSecond, sizeof( bytesPerSecond ) ) == 0;
+			#else
+			return false;
+			#endif
+		}
 		
+	protected:
+
+		int GetHandle() const
+		{
+			return socket;
+		}
+
+		// the portable path for a segment train: one Send per datagram
+
+		bool SendEach( const Address & destination, const char * bytes, int size, int segment )
+		{
+			bool ok = true;
+			for ( int offset = 0; offset < size; offset += segment )
+				ok &= Send( destination, bytes + offset, size - offset < segment ? size - offset : segment );
+			return ok;
+		}
+
 	private:
 	
 		int socket;
+		unsigned int local;
+		bool offload;						// try segmentation/receive offload on open
+		bool gso;							// udp segmentation offload in use
+		bool gro;							// udp receive offload in use
 	};
 	
 	// connection
@@ -327,8 +877,11 @@ namespace net
 		{
 			this->protocolId = protocolId;
 			this->timeout = timeout;
+			transport = &socket;
 			mode = None;
 			running = false;
+			immediate = false;
+			SetShortId( false );
 			ClearData();
 		}
 		
@@ -341,9 +894,13 @@ namespace net
 		bool Start( int port )
 		{
 			assert( !running );
-			printf( "start connection on port %d\n", port );
-			if ( !socket.Open( port ) )
+			NET_INFO( "start connection on port %d", port );
+			if ( !transport->Open( port ) )
 				return false;
+			// coalesced trains need room for a whole one, single datagrams are read straight into the caller's buffer
+			receiveTrain.assign( transport->IsReceiveOffload() ? Socket::MaxTrainBytes : 0, 0 );
+			trainOffset = 0;
+			trainSize = 0;
 			running = true;
 			OnStart();
 			return true;
@@ -352,10 +909,10 @@ namespace net
 		void Stop()
 		{
 			assert( running );
-			printf( "stop connection\n" );
+			NET_INFO( "stop connection" );
 			bool connected = IsConnected();
 			ClearData();
-			socket.Close();
+			transport->Close();
 			running = false;
 			if ( connected )
 				OnDisconnect();
@@ -369,7 +926,7 @@ namespace net
 		
 		void Listen()
 		{
-			printf( "server listening for connection\n" );
+			NET_INFO( "server listening for connection" );
 			bool connected = IsConnected();
 			ClearData();
 			if ( connected )
@@ -380,7 +937,7 @@ namespace net
 		
 		void Connect( const Address & address )
 		{
-			printf( "client connecting to %d.%d.%d.%d:%d\n", 
+			NET_INFO( "client connecting to %d.%d.%d.%d:%d", 
 				address.GetA(), address.GetB(), address.GetC(), address.GetD(), address.GetPort() );
 			bool connected = IsConnected();
 			ClearData();
@@ -391,6 +948,17 @@ namespace net
 			this->address = address;
 		}
 		
+		// drop the connection as a timeout would, for errors the layers above cannot recover from
+		void Disconnect()
+		{
+			assert( running );
+			if ( !IsConnected() )
+				return;
+			NET_INFO( "connection dropped" );
+			ClearData();
+			OnDisconnect();
+		}
+		
 		bool IsConnecting() const
 		{
 			return state == Connecting;
@@ -424,14 +992,14 @@ namespace net
 			{
 				if ( state == Connecting )
 				{
-					printf( "connect timed out\n" );
+					NET_INFO( "connect timed out" );
 					ClearData();
 					state = ConnectFail;
 					OnDisconnect();
 				}
 				else if ( state == Connected )
 				{
-					printf( "connection timed out\n" );
+					NET_INFO( "connection timed out" );
 					ClearData();
 					if ( state == Connecting )
 						state = ConnectFail;
@@ -446,12 +1014,34 @@ namespace net
 			if ( address.GetAddress() == 0 )
 				return false;
 			unsigned char packet[PacketSizeHack+4];
-			packet[0] = (unsigned char) ( protocolId >> 24 );
-			packet[1] = (unsigned char) ( ( protocolId >> 16 ) & 0xFF );
-			packet[2] = (unsigned char) ( ( protocolId >> 8 ) & 0xFF );
-			packet[3] = (unsigned char) ( ( protocolId ) & 0xFF );
-      std::memcpy( &packet[4], data, size );
-			return socket.Send( address, packet, size + 4 );
+			std::memcpy( packet, id, 4 );
+      std::memcpy( &packet[id_bytes], data, size );
+			const bool sent = transport->Send( address, packet, size + id_bytes );
+			if ( immediate )
+				transport->Flush();
+			return sent;
+		}
+
+		// send "count" payloads of "size" bytes each, stored back to back, as one segment train
+
+		virtual bool SendPackets( const unsigned char data[], int size, int count )
+		{
+			assert( running );
+			assert( size <= PacketSizeHack );
+			if ( address.GetAddress() == 0 )
+				return false;
+			const int stride = size + id_bytes;
+			if ( (int) sendTrain.size() < stride * count )
+				sendTrain.resize( stride * count );
+			for ( int i = 0; i < count; ++i )
+			{
+				std::memcpy( &sendTrain[i * stride], id, id_bytes );
+				std::memcpy( &sendTrain[i * stride + id_bytes], data + i * size, size );
+			}
+			const bool sent = transport->SendSegments( address, sendTrain.data(), stride * count, stride );
+			if ( immediate )
+				transport->Flush();
+			return sent;
 		}
 		
 		virtual int ReceivePacket( unsigned char data[], int size )
@@ -459,19 +1049,16 @@ namespace net
 			assert( running );
 			unsigned char packet[PacketSizeHack +4];
 			Address sender;
-			int bytes_read = socket.Receive( sender, packet, size + 4 );
+			int bytes_read = NextDatagram( sender, packet, std::min( size + id_bytes, (int) sizeof( packet ) ) );
 			if ( bytes_read == 0 )
 				return 0;
-			if ( bytes_read <= 4 )
+			if ( bytes_read <= id_bytes )
 				return 0;
-			if ( packet[0] != (unsigned char) ( protocolId >> 24 ) || 
-				 packet[1] != (unsigned char) ( ( protocolId >> 16 ) & 0xFF ) ||
-				 packet[2] != (unsigned char) ( ( protocolId >> 8 ) & 0xFF ) ||
-				 packet[3] != (unsigned char) ( protocolId & 0xFF ) )
+			if ( std::memcmp( packet, id, id_bytes ) != 0 )
 				return 0;
 			if ( mode == Server && !IsConnected() )
 			{
-				printf( "server accepts connection from client %d.%d.%d.%d:%d\n", 
+				NET_INFO( "server accepts connection from client %d.%d.%d.%d:%d", 
 					sender.GetA(), sender.GetB(), sender.GetC(), sender.GetD(), sender.GetPort() );
 				state = Connected;
 				address = sender;
@@ -481,20 +1068,70 @@ namespace net
 			{
 				if ( mode == Client && state == Connecting )
 				{
-					printf( "client completes connection with server\n" );
+					NET_INFO( "client completes connection with server" );
 					state = Connected;
 					OnConnect();
 				}
 				timeoutAccumulator = 0.0f;
-				memcpy( data, &packet[4], bytes_read - 4 );
-				return bytes_read - 4;
+				memcpy( data, &packet[id_bytes], bytes_read - id_bytes );
+				return bytes_read - id_bytes;
 			}
 			return 0;
 		}
 		
 		int GetHeaderSize() const
 		{
-			return 4;
+			return id_bytes;
+		}
+
+		// identify packets by a 2 byte connection id folded from the protocol id instead of the full 4 bytes
+		//  + both ends must agree, so set it before the connection starts
+
+		void SetShortId( bool enable )
+		{
+			assert( !running || id_bytes == ( enable ? 2 : 4 ) );
+			const unsigned int value = enable ? ( ( protocolId >> 16 ) ^ ( protocolId & 0xFFFF ) ) << 16 : protocolId;
+			id[0] = (unsigned char) ( value >> 24 );
+			id[1] = (unsigned char) ( ( value >> 16 ) & 0xFF );
+			id[2] = (unsigned char) ( ( value >> 8 ) & 0xFF );
+			id[3] = (unsigned char) ( value & 0xFF );
+			id_bytes = enable ? 2 : 4;
+		}
+
+		bool SetPacingRate( unsigned int bytesPerSecond )
+		{
+			return transport->SetPacingRate( bytesPerSecond );
+		}
+
+		// latency mode: every datagram reaches the network as it is sent, instead of when a batching
+		// transport next flushes (on the following receive)
+
+		void SetImmediate( bool enable )
+		{
+			immediate = enable;
+		}
+
+		bool SetBusyPoll( int microseconds, bool prefer )
+		{
+			return transport->SetBusyPoll( microseconds, prefer );
+		}
+
+		// block until a datagram is waiting or the deadline passes, see BusyPoller
+
+		bool Wait( unsigned long long deadline )
+		{
+			assert( running );
+			if ( !receiveTrain.empty() && trainOffset < trainSize )
+				return true;
+			return transport->Wait( deadline );
+		}
+
+		// replace the udp socket with another transport (must outlive the connection, null restores the socket)
+
+		void SetTransport( Socket * transport )
+		{
+			assert( !running );
+			this->transport = transport ? transport : &socket;
 		}
 		
 	protected:
@@ -512,6 +1149,30 @@ namespace net
 			timeoutAccumulator = 0.0f;
 			address = Address();
 		}
+
+		// next datagram, taken from the current coalesced train until it is used up
+
+		int NextDatagram( Address & sender, unsigned char * packet, int size )
+		{
+			if ( receiveTrain.empty() )
+				return transport->Receive( sender, packet, size );
+			if ( trainOffset >= trainSize )
+			{
+				trainOffset = 0;
+				trainSize = transport->ReceiveSegments( trainSender, receiveTrain.data(), (int) receiveTrain.size(), trainSegment );
+				if ( trainSize <= 0 || trainSegment <= 0 )
+				{
+					trainSize = 0;
+					return 0;
+				}
+			}
+			const int segment = trainSize - trainOffset < trainSegment ? trainSize - trainOffset : trainSegment;
+			const int length = segment < size ? segment : size;
+			std::memcpy( packet, &receiveTrain[trainOffset], length );
+			trainOffset += segment;
+			sender = trainSender;
+			return length;
+		}
 	
 		enum State
 		{
@@ -523,18 +1184,151 @@ namespace net
 		};
 
 		unsigned int protocolId;
+		unsigned char id[4];				// protocol or short connection id as sent on the wire
+		int id_bytes;
 		float timeout;
 		
 		bool running;
+		bool immediate;						// flush the transport after every send
 		Mode mode;
 		State state;
 		Socket socket;
+		Socket * transport;
 		float timeoutAccumulator;
 		Address address;
+
+		std::vector<unsigned char> sendTrain;		// outgoing train with the connection id in front of every packet
+		std::vector<unsigned char> receiveTrain;	// last coalesced train received, empty without receive offload
+		int trainOffset;							// next datagram in it
+		int trainSize;
+		int trainSegment;
+		Address trainSender;
 	};
 	
+	// fixed size node pool behind the packet queues
+	//  + nodes are carved from chunks and never handed back to the heap, a freed node goes on a free list for the next one
+	//  + once the queues have grown to their working size, sending and receiving packets allocates nothing
+
+	class NodePool
+	{
+	public:
+
+		NodePool( size_t size )
+		{
+			const size_t align = alignof( std::max_align_t );
+			node_size = ( std::max( size, sizeof( Node ) ) + align - 1 ) & ~( align - 1 );
+			free_list = nullptr;
+			capacity = 0;
+		}
+
+		void * Allocate()
+		{
+			if ( free_list == nullptr )
+				Grow( std::max( capacity, (size_t) ChunkNodes ) );
+			Node * node = free_list;
+			free_list = node->next;
+			return node;
+		}
+
+		void Free( void * pointer )
+		{
+			Node * node = (Node*) pointer;
+			node->next = free_list;
+			free_list = node;
+		}
+
+		// make room for at least this many nodes in all
+		void Reserve( size_t nodes )
+		{
+			if ( nodes > capacity )
+				Grow( nodes - capacity );
+		}
+
+		size_t GetNodeSize() const
+		{
+			return node_size;
+		}
+
+		size_t GetCapacity() const
+		{
+			return capacity;
+		}
+
+	private:
+
+		struct Node
+		{
+			Node * next;
+		};
+
+		static const size_t ChunkNodes = 64;
+
+		void Grow( size_t nodes )
+		{
+			chunks.emplace_back( new unsigned char[node_size * nodes] );
+			unsigned char * chunk = chunks.back().get();
+			for ( size_t i = 0; i < nodes; ++i )
+				Free( chunk + i * node_size );
+			capacity += nodes;
+		}
+
+		size_t node_size;
+		Node * free_list;
+		size_t capacity;
+		std::vector< std::unique_ptr<unsigned char[]> > chunks;
+	};
+
+	// allocator handing out single list nodes from a NodePool, copies and rebinds share the pool
+	//  + the pool's nodes hold two links and a T, anything else the container asks for comes from the heap
+
+	template <typename T> class PoolAllocator
+	{
+	public:
+
+		typedef T value_type;
+
+		PoolAllocator() : pool( std::make_shared<NodePool>( sizeof( T ) + 2 * sizeof( void* ) ) ) {}
+
+		template <typename U> PoolAllocator( const PoolAllocator<U> & other ) : pool( other.GetPool() ) {}
+
+		T * allocate( size_t count )
+		{
+			if ( count != 1 || sizeof( T ) > pool->GetNodeSize() )
+				return (T*) ::operator new( count * sizeof( T ) );
+			return (T*) pool->Allocate();
+		}
+
+		void deallocate( T * pointer, size_t count )
+		{
+			if ( count != 1 || sizeof( T ) > pool->GetNodeSize() )
+				::operator delete( pointer );
+			else
+				pool->Free( pointer );
+		}
+
+		const std::shared_ptr<NodePool> & GetPool() const
+		{
+			return pool;
+		}
+
+		template <typename U> bool operator == ( const PoolAllocator<U> & other ) const
+		{
+			return pool == other.GetPool();
+		}
+
+		template <typename U> bool operator != ( const PoolAllocator<U> & other ) const
+		{
+			return pool != other.GetPool();
+		}
+
+	private:
+
+		std::shared_ptr<NodePool> pool;
+	};
+
 	// packet queue to store information about sent and received packets sorted in sequence order
 	//  + we define ordering using the "sequence_more_recent" function, this works provided there is a large gap when sequence wrap occurs
+	//  + its nodes come from the queue's own pool, see reserve
 	
 	struct PacketData
 	{
@@ -553,9 +1347,19 @@ namespace net
     );
 	}		
 	
-	class PacketQueue : public std::list<PacketData>
+	class PacketQueue : public std::list< PacketData, PoolAllocator<PacketData> >
 	{
 	public:
+
+		void reserve( size_t count )
+		{
+			get_allocator().GetPool()->Reserve( count );
+		}
+
+		size_t capacity() const
+		{
+			return get_allocator().GetPool()->GetCapacity();
+		}
 		
 		bool exists( unsigned int sequence )
 		{
@@ -611,6 +1415,119 @@ namespace net
 		}
 	};
 
+	// round trip time estimator following RFC 6298
+	//  + srtt/rttvar are smoothed with alpha = 1/8 and beta = 1/4
+	//  + rto = srtt + max( G, 4 * rttvar ), clamped, starting at one second until the first sample
+	//  + also tracks the minimum rtt over a sliding window as the propagation delay estimate
+
+	class RttEstimator
+	{
+	public:
+
+		RttEstimator()
+		{
+			Reset();
+		}
+
+		void Reset()
+		{
+			srtt = 0.0f;
+			rttvar = 0.0f;
+			rto = InitialTimeout;
+			granularity = 0.0f;
+			backoff = 1.0f;
+			min_rtt = 0.0f;
+			min_rtt_age = 0.0f;
+			has_sample = false;
+		}
+
+		void AddSample( float sample )
+		{
+			if ( sample < 0.0f )
+				return;
+
+			const bool first = !has_sample;
+			if ( first )
+			{
+				srtt = sample;
+				rttvar = sample / 2.0f;
+				has_sample = true;
+			}
+			else
+			{
+				const float error = srtt - sample;
+				rttvar += ( ( error < 0.0f ? -error : error ) - rttvar ) * 0.25f;
+				srtt += ( sample - srtt ) * 0.125f;
+			}
+
+			if ( first || sample <= min_rtt || min_rtt_age > MinRttWindow )
+			{
+				min_rtt = sample;
+				min_rtt_age = 0.0f;
+			}
+
+			backoff = 1.0f;
+			UpdateTimeout();
+		}
+
+		// the clock granularity is the update step, since queue times only advance in Update
+
+		void Advance( float deltaTime )
+		{
+			granularity = deltaTime;
+			if ( has_sample )
+				min_rtt_age += deltaTime;
+			UpdateTimeout();
+		}
+
+		// exponential backoff after a retransmission timeout, cleared by the next sample
+
+		void Backoff()
+		{
+			if ( rto * 2.0f <= MaximumTimeout )
+				backoff *= 2.0f;
+			UpdateTimeout();
+		}
+
+		bool HasSample() const		{ return has_sample; }
+		float GetSmoothed() const	{ return srtt; }
+		float GetVariance() const	{ return rttvar; }
+		float GetTimeout() const	{ return rto; }
+		float GetMinimum() const	{ return min_rtt; }
+
+		static constexpr float InitialTimeout = 1.0f;
+		static constexpr float MinimumTimeout = 0.005f;
+		static constexpr float MaximumTimeout = 60.0f;
+		static constexpr float MinRttWindow = 10.0f;
+
+	private:
+
+		void UpdateTimeout()
+		{
+			float timeout = InitialTimeout;
+			if ( has_sample )
+			{
+				const float variance = 4.0f * rttvar;
+				timeout = srtt + ( variance > granularity ? variance : granularity );
+			}
+			timeout *= backoff;
+			if ( timeout < MinimumTimeout )
+				timeout = MinimumTimeout;
+			if ( timeout > MaximumTimeout )
+				timeout = MaximumTimeout;
+			rto = timeout;
+		}
+
+		float srtt;						// smoothed round trip time
+		float rttvar;					// round trip time variation
+		float rto;						// retransmission timeout
+		float granularity;				// clock granularity (G in RFC 6298)
+		float backoff;					// timeout multiplier after consecutive timeouts
+		float min_rtt;					// minimum rtt seen in the current window
+		float min_rtt_age;				// time since min_rtt was sampled
+		bool has_sample;
+	};
+
 	// reliability system to support reliable connection
 	//  + manages sent, received, pending ack and acked packet queues
 	//  + separated out from reliable connection because it is quite complex and i want to unit test it!
@@ -621,7 +1538,6 @@ namespace net
 		
 		ReliabilitySystem( unsigned int max_sequence = 0xFFFFFFFF )
 		{
-			this->rtt_maximum = rtt_maximum;
 			this->max_sequence = max_sequence;
 			Reset();
 		}
@@ -640,18 +1556,35 @@ namespace net
 			acked_packets = 0;
 			sent_bandwidth = 0.0f;
 			acked_bandwidth = 0.0f;
-			rtt = 0.0f;
-			rtt_maximum = 1.0f;
+			rtt.Reset();
+			acked_since_loss = true;
+			largest_acked = 0;
+			has_acked = false;
 		}
 		
+		// size the queues for this many packets sent or received per second, so steady traffic allocates nothing
+		//  + the acked queue holds its packets for an rto beyond the stats window, so it gets twice the room
+
+		void Reserve( int packets )
+		{
+			sentQueue.reserve( packets );
+			pendingAckQueue.reserve( packets );
+			receivedQueue.reserve( packets );
+			ackedQueue.reserve( packets * 2 );
+			acks.reserve( packets );
+		}
+
 		void PacketSent( int size )
 		{
+			// the check walks the whole sent queue, a second's worth of packets, so release builds skip it
+			#ifndef NDEBUG
 			if ( sentQueue.exists( local_sequence ) )
 			{
-				printf( "local sequence %d exists\n", local_sequence );				
+				NET_ERROR( "local sequence %d exists", local_sequence );				
 				for ( PacketQueue::iterator itor = sentQueue.begin(); itor != sentQueue.end(); ++itor )
-					printf( " + %d\n", itor->sequence );
+					NET_ERROR( " + %d", itor->sequence );
 			}
+			#endif
 			assert( !sentQueue.exists( local_sequence ) );
 			assert( !pendingAckQueue.exists( local_sequence ) );
 			PacketData data;
@@ -661,16 +1594,22 @@ namespace net
 			sentQueue.push_back( data );
 			pendingAckQueue.push_back( data );
 			sent_packets++;
+			ConnectionMetrics::Add( metrics.packets_sent );
+			ConnectionMetrics::Add( metrics.bytes_sent, size );
 			local_sequence++;
 			if ( local_sequence > max_sequence )
 				local_sequence = 0;
 		}
 		
-		void PacketReceived( unsigned int sequence, int size )
+		bool PacketReceived( unsigned int sequence, int size )
 		{
 			recv_packets++;
+			ConnectionMetrics::Add( metrics.packets_received );
 			if ( receivedQueue.exists( sequence ) )
-				return;
+			{
+				ConnectionMetrics::Add( metrics.duplicates );
+				return false;
+			}
 			PacketData data;
 			data.sequence = sequence;
 			data.time = 0.0f;
@@ -678,6 +1617,7 @@ namespace net
 			receivedQueue.push_back( data );
 			if ( sequence_more_recent( sequence, remote_sequence, max_sequence ) )
 				remote_sequence = sequence;
+			return true;
 		}
 
 		unsigned int GenerateAckBits()
@@ -687,15 +1627,30 @@ namespace net
 		
 		void ProcessAck( unsigned int ack, unsigned int ack_bits )
 		{
-			process_ack( ack, ack_bits, pendingAckQueue, ackedQueue, acks, acked_packets, rtt, max_sequence );
+			unsigned int acked_before = acked_packets;
+			const size_t first = acks.size();
+			process_ack( ack, ack_bits, pendingAckQueue, ackedQueue, acks, acked_packets, rtt, max_sequence, &metrics );
+			if ( acked_packets != acked_before )
+			{
+				acked_since_loss = true;
+				ConnectionMetrics::Add( metrics.packets_acked, acked_packets - acked_before );
+				for ( size_t i = first; i < acks.size(); ++i )
+				{
+					if ( !has_acked || sequence_more_recent( acks[i], largest_acked, max_sequence ) )
+						largest_acked = acks[i];
+					has_acked = true;
+				}
+			}
 		}
 				
 		void Update( float deltaTime )
 		{
 			acks.clear();
+			rtt.Advance( deltaTime );
 			AdvanceQueueTime( deltaTime );
 			UpdateQueues();
 			UpdateStats();
+			UpdateMetrics();
 			#ifdef NET_UNIT_TEST
 			Validate();
 			#endif
@@ -753,7 +1708,7 @@ namespace net
 		static void process_ack( unsigned int ack, unsigned int ack_bits, 
 								 PacketQueue & pending_ack_queue, PacketQueue & acked_queue, 
 								 std::vector<unsigned int> & acks, unsigned int & acked_packets, 
-								 float & rtt, unsigned int max_sequence )
+								 RttEstimator & rtt, unsigned int max_sequence, ConnectionMetrics * metrics = 0 )
 		{
 			if ( pending_ack_queue.empty() )
 				return;
@@ -776,7 +1731,9 @@ namespace net
 				
 				if ( acked )
 				{
-					rtt += ( itor->time - rtt ) * 0.1f;
+					rtt.AddSample( itor->time );
+					if ( metrics )
+						metrics->RecordRtt( itor->time );
 
 					acked_queue.insert_sorted( *itor, max_sequence );
 					acks.push_back( itor->sequence );
@@ -804,6 +1761,14 @@ namespace net
 		{
 			return max_sequence;
 		}
+
+		// most recent of our packets the peer has acknowledged, false until one has been
+
+		bool GetLargestAcked( unsigned int & sequence ) const
+		{
+			sequence = largest_acked;
+			return has_acked;
+		}
 				
  		void GetAcks( unsigned int ** acks, int & count )
 		{
@@ -843,7 +1808,22 @@ namespace net
 
 		float GetRoundTripTime() const
 		{
-			return rtt;
+			return rtt.GetSmoothed();
+		}
+
+		float GetRoundTripTimeVariance() const
+		{
+			return rtt.GetVariance();
+		}
+
+		float GetMinimumRoundTripTime() const
+		{
+			return rtt.GetMinimum();
+		}
+
+		float GetRetransmissionTimeout() const
+		{
+			return rtt.GetTimeout();
 		}
 		
 		int GetHeaderSize() const
@@ -851,6 +1831,18 @@ namespace net
 			return 12;
 		}
 
+		// live statistics, safe to read from any thread
+
+		ConnectionMetrics & GetMetrics()
+		{
+			return metrics;
+		}
+
+		const ConnectionMetrics & GetMetrics() const
+		{
+			return metrics;
+		}
+
 	protected:
 		
 		void AdvanceQueueTime( float deltaTime )
@@ -871,8 +1863,9 @@ namespace net
 		void UpdateQueues()
 		{
 			const float epsilon = 0.001f;
+			const float rto = rtt.GetTimeout();
 
-			while ( sentQueue.size() && sentQueue.front().time > rtt_maximum + epsilon )
+			while ( sentQueue.size() && sentQueue.front().time > StatsWindow + epsilon )
 				sentQueue.pop_front();
 
 			if ( receivedQueue.size() )
@@ -883,13 +1876,24 @@ namespace net
 					receivedQueue.pop_front();
 			}
 
-			while ( ackedQueue.size() && ackedQueue.front().time > rtt_maximum * 2 - epsilon )
+			while ( ackedQueue.size() && ackedQueue.front().time > rto + StatsWindow - epsilon )
 				ackedQueue.pop_front();
 
-			while ( pendingAckQueue.size() && pendingAckQueue.front().time > rtt_maximum + epsilon )
+			bool timed_out = false;
+			while ( pendingAckQueue.size() && pendingAckQueue.front().time > rto + epsilon )
 			{
 				pendingAckQueue.pop_front();
 				lost_packets++;
+				ConnectionMetrics::Add( metrics.packets_lost );
+				timed_out = true;
+			}
+
+			// back off only when nothing was acked since the previous timeout, as a lone loss says little about the path
+			if ( timed_out )
+			{
+				if ( !acked_since_loss )
+					rtt.Backoff();
+				acked_since_loss = false;
 			}
 		}
 		
@@ -900,20 +1904,32 @@ namespace net
 				sent_bytes_per_second += itor->size;
 			int acked_packets_per_second = 0;
 			int acked_bytes_per_second = 0;
+			// only count packets old enough that their ack had a full rto to arrive
+			const float rto = rtt.GetTimeout();
 			for ( PacketQueue::iterator itor = ackedQueue.begin(); itor != ackedQueue.end(); ++itor )
 			{
-				if ( itor->time >= rtt_maximum )
+				if ( itor->time >= rto )
 				{
 					acked_packets_per_second++;
 					acked_bytes_per_second += itor->size;
 				}
 			}
-			sent_bytes_per_second /= rtt_maximum;
-			acked_bytes_per_second /= rtt_maximum;
+			sent_bytes_per_second /= StatsWindow;
+			acked_bytes_per_second /= StatsWindow;
 			sent_bandwidth = sent_bytes_per_second * ( 8 / 1000.0f );
 			acked_bandwidth = acked_bytes_per_second * ( 8 / 1000.0f );
 		}
 		
+		void UpdateMetrics()
+		{
+			ConnectionMetrics::Set( metrics.sent_queue, sentQueue.size() );
+			ConnectionMetrics::Set( metrics.pending_ack_queue, pendingAckQueue.size() );
+			ConnectionMetrics::Set( metrics.received_queue, receivedQueue.size() );
+			ConnectionMetrics::Set( metrics.acked_queue, ackedQueue.size() );
+			ConnectionMetrics::Set( metrics.srtt_us, (unsigned long long) ( rtt.GetSmoothed() * 1000000.0f ) );
+			ConnectionMetrics::Set( metrics.rto_us, (unsigned long long) ( rtt.GetTimeout() * 1000000.0f ) );
+		}
+		
 	private:
 		
 		unsigned int max_sequence;			// maximum sequence value before wrap around (used to test sequence wrap at low # values)
@@ -927,18 +1943,139 @@ namespace net
 
 		float sent_bandwidth;				// approximate sent bandwidth over the last second
 		float acked_bandwidth;				// approximate acked bandwidth over the last second
-		float rtt;							// estimated round trip time
-		float rtt_maximum;					// maximum expected round trip time (hard coded to one second for the moment)
+		RttEstimator rtt;					// smoothed rtt, variance, retransmission timeout and minimum rtt
+		bool acked_since_loss;				// an ack arrived since packets were last declared lost
+		unsigned int largest_acked;			// most recent sequence acked by the peer (valid once has_acked)
+		bool has_acked;
+
+		static constexpr float StatsWindow = 1.0f;	// bandwidth statistics are measured over the last second
 
 		std::vector<unsigned int> acks;		// acked packets from last set of packet receives. cleared each update!
 
-		PacketQueue sentQueue;				// sent packets used to calculate sent bandwidth (kept until rtt_maximum)
-		PacketQueue pendingAckQueue;		// sent packets which have not been acked yet (kept until rtt_maximum * 2 )
+		PacketQueue sentQueue;				// sent packets used to calculate sent bandwidth (kept for StatsWindow)
+		PacketQueue pendingAckQueue;		// sent packets which have not been acked yet (kept until rto, then counted lost)
 		PacketQueue receivedQueue;			// received packets for determining acks to send (kept up to most recent recv sequence - 32)
-		PacketQueue ackedQueue;				// acked packets (kept until rtt_maximum * 2)
+		PacketQueue ackedQueue;				// acked packets (kept until rto + StatsWindow)
+
+		ConnectionMetrics metrics;			// counters survive Reset, so they cover every connection made through this object
+	};
+
+	// compact reliable header, sent instead of the 12 byte sequence/ack/ack_bits header when enabled
+	//  + flags (1 byte): bits 0-1 packet number length - 1, bit 2 ack present, bit 3 ack_bits present
+	//    (absent means all 32 earlier packets arrived), bit 4 ack-only frame (carries no packet number)
+	//  + packet number truncated to 1-4 bytes, long enough to stay unambiguous given what the peer has acked,
+	//    and expanded against the largest sequence received (as quic does, rfc 9000 appendix a)
+	//  + ack truncated to 2 bytes and expanded against the receiver's own latest sent sequence, so it must be
+	//    within 65535 packets of it
+	//  + encode always stores whole fields and only advances past the present ones, keeping it branch-light
+
+	struct CompactHeader
+	{
+		enum
+		{
+			LengthMask = 0x03,
+			AckFlag = 0x04,
+			AckBitsFlag = 0x08,
+			AckOnlyFlag = 0x10,
+			MaxSize = 1 + 4 + 2 + 4
+		};
+
+		// bytes of packet number needed so that twice the unacked range fits
+		
+		static int PacketNumberLength( unsigned int sequence, unsigned int largest_acked, bool acked )
+		{
+			const unsigned int unacked = acked ? sequence - largest_acked : sequence + 1;
+			return 1 + ( unacked >= 0x80 ) + ( unacked >= 0x8000 ) + ( unacked >= 0x800000 );
+		}
+
+		// write a header into "out", which needs MaxSize bytes of room; returns the header size
+
+		static int Write( unsigned char * out, unsigned int sequence, int length, bool ack_only, bool with_ack, unsigned int ack, unsigned int ack_bits )
+		{
+			assert( length >= 1 && length <= 4 );
+			const bool with_bits = with_ack && ack_bits != 0xFFFFFFFF;
+			out[0] = (unsigned char) ( ( length - 1 ) | ( with_ack ? AckFlag : 0 ) | ( with_bits ? AckBitsFlag : 0 ) | ( ack_only ? AckOnlyFlag : 0 ) );
+			unsigned char * p = out + 1;
+			Store32( p, sequence << ( 32 - 8 * length ) );
+			p += ack_only ? 0 : length;
+			p[0] = (unsigned char) ( ack >> 8 );
+			p[1] = (unsigned char) ack;
+			p += with_ack ? 2 : 0;
+			Store32( p, ack_bits );
+			p += with_bits ? 4 : 0;
+			return (int) ( p - out );
+		}
+
+		// parse a header; "expected" is one past the largest sequence received, "latest_sent" our own most recent
+		// sequence. returns the header size, or zero if the packet is too short
+
+		static int Read( const unsigned char * in, int size, unsigned int expected, unsigned int latest_sent,
+						 unsigned int & sequence, bool & ack_only, bool & with_ack, unsigned int & ack, unsigned int & ack_bits )
+		{
+			if ( size < 1 )
+				return 0;
+			const unsigned char flags = in[0];
+			const int length = ( flags & LengthMask ) + 1;
+			ack_only = ( flags & AckOnlyFlag ) != 0;
+			with_ack = ( flags & AckFlag ) != 0;
+			const bool with_bits = ( flags & AckBitsFlag ) != 0;
+			const int number_bytes = ack_only ? 0 : length;
+			const int total = 1 + number_bytes + ( with_ack ? 2 : 0 ) + ( with_bits ? 4 : 0 );
+			if ( size < total )
+				return 0;
+
+			const unsigned char * p = in + 1;
+			unsigned int truncated = 0;
+			for ( int i = 0; i < number_bytes; ++i )
+				truncated = ( truncated << 8 ) | p[i];
+			sequence = ack_only ? 0 : Expand( truncated, length * 8, expected );
+			p += number_bytes;
+
+			ack = 0;
+			if ( with_ack )
+			{
+				// the ack can only be at or before our latest sent packet
+				ack = ( latest_sent & 0xFFFF0000u ) | ( (unsigned int) p[0] << 8 ) | p[1];
+				if ( (int) ( ack - latest_sent ) > 0 )
+					ack -= 0x10000;
+				p += 2;
+			}
+			ack_bits = with_bits ? ( (unsigned int) p[0] << 24 ) | ( (unsigned int) p[1] << 16 ) | ( (unsigned int) p[2] << 8 ) | p[3] : 0xFFFFFFFF;
+			return total;
+		}
+
+		// closest sequence to "expected" whose low bits match
+		
+		static unsigned int Expand( unsigned int truncated, int bits, unsigned int expected )
+		{
+			if ( bits >= 32 )
+				return truncated;
+			const unsigned int window = 1u << bits;
+			const unsigned int half = window / 2;
+			unsigned int candidate = ( expected & ~( window - 1 ) ) | truncated;
+			const int delta = (int) ( candidate - expected );
+			if ( delta <= -(int) half )
+				candidate += window;
+			else if ( delta > (int) half )
+				candidate -= window;
+			return candidate;
+		}
+
+	private:
+
+		static void Store32( unsigned char * p, unsigned int value )
+		{
+			p[0] = (unsigned char) ( value >> 24 );
+			p[1] = (unsigned char) ( value >> 16 );
+			p[2] = (unsigned char) ( value >> 8 );
+			p[3] = (unsigned char) value;
+		}
 	};
 
 	// connection with reliability (seq/ack)
+	//  + acks piggyback on outgoing packets; when there is nothing to send a header-only ack frame
+	//    is sent after every "ack_every" new packets, after "ack_max_delay" seconds, or at once when
+	//    a packet arrives out of order. nothing is sent when nothing new has arrived
 
 	class ReliableConnection : public Connection
 	{
@@ -947,6 +2084,10 @@ namespace net
 		ReliableConnection( unsigned int protocolId, float timeout, unsigned int max_sequence = 0xFFFFFFFF )
 			: Connection( protocolId, timeout ), reliabilitySystem( max_sequence )
 		{
+			ack_every = 2;
+			ack_max_delay = 0.025f;
+			ack_frames_sent = 0;
+			compact = false;
 			ClearData();
 			#ifdef NET_UNIT_TEST
 			packet_loss_mask = 0;
@@ -970,49 +2111,195 @@ namespace net
 				return true;
 			}
 			#endif
-			const int header = 12;
-			unsigned char packet[header+PacketSizeHack];
+			unsigned char packet[12+PacketSizeHack];
 			unsigned int seq = reliabilitySystem.GetLocalSequence();
 			unsigned int ack = reliabilitySystem.GetRemoteSequence();
 			unsigned int ack_bits = reliabilitySystem.GenerateAckBits();
-			WriteHeader( packet, seq, ack, ack_bits );
+			bool with_ack = true;
+			int header = 12;
+			if ( compact )
+			{
+				// repeat an unchanged ack now and then in case the packet that carried it was lost
+				unsigned int largest_acked;
+				const bool acked = reliabilitySystem.GetLargestAcked( largest_acked );
+				with_ack = ack != sent_ack || ack_bits != sent_ack_bits || packets_since_ack + 1 >= AckRepeat;
+				header = CompactHeader::Write( packet, seq, CompactHeader::PacketNumberLength( seq, largest_acked, acked ), false, with_ack, ack, ack_bits );
+			}
+			else
+				WriteHeader( packet, seq, ack, ack_bits );
       std::memcpy( packet + header, data, size );
  			if ( !Connection::SendPacket( packet, size + header ) )
 				return false;
 			reliabilitySystem.PacketSent( size );
+			ack_pending = 0;
+			ack_timer = 0.0f;
+			AckSent( with_ack, ack, ack_bits );
 			return true;
-		}	
+		}
+
+		// send "count" payloads of "size" bytes each, stored back to back, as one segment train
+		//  + segments must be the same size, so the compact header of every packet uses the packet number
+		//    length of the last one and carries the ack. a train that fails part way still counts as sent,
+		//    the packets that did not leave are then found lost like any other
+
+		bool SendPackets( const unsigned char data[], int size, int count )
+		{
+			if ( count <= 0 )
+				return true;
+			const unsigned int first = reliabilitySystem.GetLocalSequence();
+			const unsigned int max_sequence = reliabilitySystem.GetMaxSequence();
+			const unsigned int ack = reliabilitySystem.GetRemoteSequence();
+			const unsigned int ack_bits = reliabilitySystem.GenerateAckBits();
+			int length = 4;
+			int header = 12;
+			if ( compact )
+			{
+				unsigned int largest_acked;
+				const bool acked = reliabilitySystem.GetLargestAcked( largest_acked );
+				length = CompactHeader::PacketNumberLength( first + count - 1, largest_acked, acked );
+				unsigned char probe[CompactHeader::MaxSize];
+				header = CompactHeader::Write( probe, first, length, false, true, ack, ack_bits );
+			}
+			const int stride = header + size;
+			// the compact header writer needs MaxSize bytes of room, the payload then overwrites the excess
+			if ( (int) train.size() < stride * count + CompactHeader::MaxSize )
+				train.resize( stride * count + CompactHeader::MaxSize );
+			for ( int i = 0; i < count; ++i )
+			{
+				unsigned int seq = first + i;
+				if ( max_sequence != 0xFFFFFFFF && seq > max_sequence )
+					seq -= max_sequence + 1;
+				unsigned char * packet = &train[i * stride];
+				if ( compact )
+					CompactHeader::Write( packet, seq, length, false, true, ack, ack_bits );
+				else
+					WriteHeader( packet, seq, ack, ack_bits );
+				std::memcpy( packet + header, data + i * size, size );
+			}
+			const bool sent = Connection::SendPackets( train.data(), stride, count );
+			for ( int i = 0; i < count; ++i )
+				reliabilitySystem.PacketSent( size );
+			ack_pending = 0;
+			ack_timer = 0.0f;
+			AckSent( true, ack, ack_bits );
+			return sent;
+		}
+
+		// header-only frame carrying the current ack state. it takes no sequence number and is never acked
+
+		bool SendAck()
+		{
+			unsigned char packet[CompactHeader::MaxSize > 12 ? CompactHeader::MaxSize : 12];
+			const unsigned int ack = reliabilitySystem.GetRemoteSequence();
+			const unsigned int ack_bits = reliabilitySystem.GenerateAckBits();
+			int header = 12;
+			if ( compact )
+				header = CompactHeader::Write( packet, 0, 1, true, true, ack, ack_bits );
+			else
+				WriteHeader( packet, reliabilitySystem.GetLocalSequence(), ack, ack_bits );
+			if ( !Connection::SendPacket( packet, header ) )
+				return false;
+			AckSent( true, ack, ack_bits );
+			ack_pending = 0;
+			ack_timer = 0.0f;
+			ack_frames_sent++;
+			ConnectionMetrics::Add( reliabilitySystem.GetMetrics().ack_frames );
+			return true;
+		}
 		
 		int ReceivePacket( unsigned char data[], int size )
 		{
-			const int header = 12;
-			if ( size <= header )
-				return false;
-			unsigned char packet[header+PacketSizeHack];
-			int received_bytes = Connection::ReceivePacket( packet, size + header );
-			if ( received_bytes == 0 )
+			const int max_header = 12;
+			if ( size <= max_header )
 				return false;
-			if ( received_bytes <= header )
-				return false;
-			unsigned int packet_sequence = 0;
-			unsigned int packet_ack = 0;
-			unsigned int packet_ack_bits = 0;
-			ReadHeader( packet, packet_sequence, packet_ack, packet_ack_bits );
-			reliabilitySystem.PacketReceived( packet_sequence, received_bytes - header );
-			reliabilitySystem.ProcessAck( packet_ack, packet_ack_bits );
-      std::memcpy( data, packet + header, received_bytes - header );
-			return received_bytes - header;
+			unsigned char packet[max_header+PacketSizeHack];
+			while ( true )
+			{
+				int received_bytes = Connection::ReceivePacket( packet, std::min( size + max_header, (int) sizeof( packet ) ) );
+				if ( received_bytes == 0 )
+					return false;
+				const unsigned int expected = reliabilitySystem.GetRemoteSequence() == reliabilitySystem.GetMaxSequence() ? 0 : reliabilitySystem.GetRemoteSequence() + 1;
+				unsigned int packet_sequence = 0;
+				unsigned int packet_ack = 0;
+				unsigned int packet_ack_bits = 0;
+				bool ack_only = false;
+				bool with_ack = true;
+				const int header = ReadPacketHeader( packet, received_bytes, expected, packet_sequence, ack_only, with_ack, packet_ack, packet_ack_bits );
+				if ( header == 0 )
+					continue;
+				if ( ack_only || received_bytes == header )
+				{
+					// ack-only frame: nothing to deliver, keep draining the socket
+					if ( with_ack )
+						reliabilitySystem.ProcessAck( packet_ack, packet_ack_bits );
+					continue;
+				}
+				// a compact header is shorter than max_header, so the payload may not fit the caller's buffer
+				if ( received_bytes - header > size )
+					continue;
+				const bool fresh = reliabilitySystem.PacketReceived( packet_sequence, received_bytes - header );
+				if ( with_ack )
+					reliabilitySystem.ProcessAck( packet_ack, packet_ack_bits );
+				if ( fresh )
+				{
+					ack_pending++;
+					if ( ack_pending >= ack_every || packet_sequence != expected )
+						SendAck();
+					ConnectionMetrics::Add( reliabilitySystem.GetMetrics().bytes_delivered, received_bytes - header );
+				}
+				std::memcpy( data, packet + header, received_bytes - header );
+				return received_bytes - header;
+			}
 		}
 		
 		void Update( float deltaTime )
 		{
 			Connection::Update( deltaTime );
 			reliabilitySystem.Update( deltaTime );
+			if ( ack_pending > 0 && IsConnected() )
+			{
+				ack_timer += deltaTime;
+				if ( ack_timer >= ack_max_delay )
+					SendAck();
+			}
+		}
+
+		// ack frequency: ack after this many new packets, or this long after the first unacked one
+
+		void SetAckFrequency( int packets, float maxDelay )
+		{
+			assert( packets >= 1 );
+			// acks for packets beyond the 32 bit ack_bits window would be lost
+			ack_every = packets < 32 ? packets : 32;
+			ack_max_delay = maxDelay;
+		}
+
+		unsigned int GetAckFramesSent() const
+		{
+			return ack_frames_sent;
+		}
+
+		// switch to the short connection id and the compact header (both ends must agree, set before starting)
+		//  + truncated sequence numbers assume the full 32 bit sequence space
+
+		void SetCompactHeader( bool enable )
+		{
+			assert( !IsRunning() );
+			assert( !enable || reliabilitySystem.GetMaxSequence() == 0xFFFFFFFF );
+			compact = enable;
+			SetShortId( enable );
+		}
+
+		bool IsCompactHeader() const
+		{
+			return compact;
 		}
 		
+		// largest header a packet may carry
+
 		int GetHeaderSize() const
 		{
-			return Connection::GetHeaderSize() + reliabilitySystem.GetHeaderSize();
+			return Connection::GetHeaderSize() + ( compact ? (int) CompactHeader::MaxSize : reliabilitySystem.GetHeaderSize() );
 		}
 		
 		ReliabilitySystem & GetReliabilitySystem()
@@ -1059,6 +2346,29 @@ namespace net
 			ReadInteger( header + 8, ack_bits );
 		}
 
+		// read either header format, returns the header size or zero if the packet is malformed
+
+		int ReadPacketHeader( const unsigned char * packet, int size, unsigned int expected, unsigned int & sequence,
+							  bool & ack_only, bool & with_ack, unsigned int & ack, unsigned int & ack_bits )
+		{
+			if ( compact )
+			{
+				const unsigned int latest_sent = reliabilitySystem.GetLocalSequence() - 1;
+				return CompactHeader::Read( packet, size, expected, latest_sent, sequence, ack_only, with_ack, ack, ack_bits );
+			}
+			if ( size < 12 )
+				return 0;
+			ReadHeader( packet, sequence, ack, ack_bits );
+			ack_only = size == 12;
+			with_ack = true;
+			return 12;
+		}
+
+		virtual void OnStart()
+		{
+			reliabilitySystem.Reserve( QueueReserve );
+		}
+
 		virtual void OnStop()
 		{
 			ClearData();
@@ -1074,11 +2384,43 @@ namespace net
 		void ClearData()
 		{
 			reliabilitySystem.Reset();
+			ack_pending = 0;
+			ack_timer = 0.0f;
+			sent_ack = 0;
+			sent_ack_bits = 0;
+			packets_since_ack = 0;
 		}
 
+		void AckSent( bool with_ack, unsigned int ack, unsigned int ack_bits )
+		{
+			if ( with_ack )
+			{
+				sent_ack = ack;
+				sent_ack_bits = ack_bits;
+				packets_since_ack = 0;
+			}
+			else
+				packets_since_ack++;
+		}
+
+		static const int AckRepeat = 4;			// compact header: an unchanged ack still rides along on every 4th packet
+		static const int QueueReserve = 1024;	// packets per second the reliability queues hold without allocating
+
 		#ifdef NET_UNIT_TEST
 		unsigned int packet_loss_mask;			// mask sequence number, if non-zero, drop packet - for unit test only
 		#endif
+
+		int ack_every;							// send an ack frame after this many unacked packets
+		float ack_max_delay;					// ... or once the oldest unacked packet has waited this long
+		int ack_pending;						// new packets received since our last ack went out
+		float ack_timer;						// time since the first of those packets
+		unsigned int ack_frames_sent;			// total number of ack-only frames sent
+
+		bool compact;							// compact header and short connection id
+		unsigned int sent_ack;					// ack state last sent, the compact header omits it while unchanged
+		unsigned int sent_ack_bits;
+		int packets_since_ack;					// packets sent without the ack since then
+		std::vector<unsigned char> train;		// outgoing segment train, headers included
 		
 		ReliabilitySystem reliabilitySystem;	// reliability system: manages sequence numbers and acks, tracks network stats etc.
 	};
@@ -0,0 +1,356 @@
+/*
+* FILE : NetEmulator.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides an in-process network impairment emulator. The
+*   `ImpairedSocket` decorator stands in for `net::Socket` underneath a
+*   `Connection` and applies delay, jitter, random and bursty
+*   (Gilbert-Elliott) loss, reordering, duplication and a bandwidth limit
+*   to the datagrams passing through it, so WAN conditions can be
+*   reproduced over loopback on a single machine.
+*/
+
+#ifndef NET_EMULATOR_H
+#define NET_EMULATOR_H
+
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "Net.h"
+
+namespace net
+{
+	// impairments applied to one direction of traffic
+	//  + times are in seconds, probabilities in [0,1], bandwidth in bytes per second (0 = unlimited)
+
+	struct ImpairmentConfig
+	{
+		float latency = 0.0f;			// fixed one-way delay
+		float jitter = 0.0f;			// uniform extra delay in [0, jitter]; reorders packets as a side effect
+		float loss = 0.0f;				// independent random loss
+		float burst_enter = 0.0f;		// gilbert-elliott: chance per packet of moving from the good to the bad state
+		float burst_exit = 0.0f;		// gilbert-elliott: chance per packet of moving from the bad back to the good state
+		float burst_loss = 1.0f;		// loss probability while in the bad state
+		float reorder = 0.0f;			// chance a packet is held back by reorder_delay
+		float reorder_delay = 0.01f;
+		float duplicate = 0.0f;			// chance a packet is delivered twice
+		float bandwidth = 0.0f;			// link rate
+		int queue_limit = 64 * 1024;	// bytes queued behind the link before tail drop
+
+		bool IsActive() const
+		{
+			return latency > 0.0f || jitter > 0.0f || loss > 0.0f || burst_enter > 0.0f ||
+				   reorder > 0.0f || duplicate > 0.0f || bandwidth > 0.0f;
+		}
+
+		// parse one "--option value" pair, returns false if the option is not an impairment option
+
+		bool Parse( const char * option, const char * value )
+		{
+			const float v = (float) atof( value );
+			const std::string name = option;
+			if ( name == "--latency" )			latency = v / 1000.0f;
+			else if ( name == "--jitter" )		jitter = v / 1000.0f;
+			else if ( name == "--loss" )		loss = v / 100.0f;
+			else if ( name == "--burst-enter" )	burst_enter = v / 100.0f;
+			else if ( name == "--burst-exit" )	burst_exit = v / 100.0f;
+			else if ( name == "--burst-loss" )	burst_loss = v / 100.0f;
+			else if ( name == "--reorder" )		reorder = v / 100.0f;
+			else if ( name == "--reorder-delay" ) reorder_delay = v / 1000.0f;
+			else if ( name == "--duplicate" )	duplicate = v / 100.0f;
+			else if ( name == "--rate" )		bandwidth = v * 1000.0f / 8.0f;		// kbps
+			else if ( name == "--queue" )		queue_limit = atoi( value );
+			else
+				return false;
+			return true;
+		}
+	};
+
+	// one direction of an emulated link: loss and duplication decisions, bandwidth queue and delay line
+
+	class ImpairedLink
+	{
+	public:
+
+		struct Datagram
+		{
+			unsigned long long release;		// time the datagram leaves the link
+			unsigned long long order;		// tie break so equal release times keep send order
+			Address address;
+			std::vector<unsigned char> data;
+
+			bool operator > ( const Datagram & other ) const
+			{
+				return release > other.release || ( release == other.release && order > other.order );
+			}
+		};
+
+		ImpairedLink()
+		{
+			Reset( ImpairmentConfig(), 0 );
+		}
+
+		void Reset( const ImpairmentConfig & config, unsigned int seed )
+		{
+			this->config = config;
+			random.seed( seed );
+			bad_state = false;
+			link_free = 0;
+			order = 0;
+			while ( !line.empty() )
+				line.pop();
+			submitted = delivered = dropped = duplicated = reordered = 0;
+		}
+
+		void Submit( const Address & address, const void * data, int size, unsigned long long now )
+		{
+			submitted++;
+
+			if ( Lost() )
+			{
+				dropped++;
+				return;
+			}
+
+			// serialize onto the link, tail dropping once the queue behind it is full
+			unsigned long long departure = now;
+			if ( config.bandwidth > 0.0f )
+			{
+				if ( link_free > now && ( link_free - now ) / 1e9 * config.bandwidth > config.queue_limit )
+				{
+					dropped++;
+					return;
+				}
+				departure = ( link_free > now ? link_free : now ) + (unsigned long long) ( size / config.bandwidth * 1e9 );
+				link_free = departure;
+			}
+
+			const int copies = Chance( config.duplicate ) ? 2 : 1;
+			if ( copies == 2 )
+				duplicated++;
+
+			for ( int i = 0; i < copies; ++i )
+			{
+				float delay = config.latency;
+				if ( config.jitter > 0.0f )
+					delay += Uniform() * config.jitter;
+				if ( Chance( config.reorder ) )
+				{
+					delay += config.reorder_delay;
+					reordered++;
+				}
+
+				Datagram datagram;
+				datagram.release = departure + (unsigned long long) ( delay * 1e9f );
+				datagram.order = order++;
+				datagram.address = address;
+				datagram.data.assign( (const unsigned char*) data, (const unsigned char*) data + size );
+				line.push( std::move( datagram ) );
+			}
+		}
+
+		// pop the next datagram whose release time has passed
+
+		bool Pop( unsigned long long now, Datagram & datagram )
+		{
+			if ( line.empty() || line.top().release > now )
+				return false;
+			datagram = line.top();
+			line.pop();
+			delivered++;
+			return true;
+		}
+
+		bool IsActive() const
+		{
+			return config.IsActive();
+		}
+
+		unsigned long long NextRelease() const
+		{
+			return line.empty() ? ~0ULL : line.top().release;
+		}
+
+		unsigned int GetSubmitted() const	{ return submitted; }
+		unsigned int GetDelivered() const	{ return delivered; }
+		unsigned int GetDropped() const		{ return dropped; }
+		unsigned int GetDuplicated() const	{ return duplicated; }
+		unsigned int GetReordered() const	{ return reordered; }
+
+	private:
+
+		float Uniform()
+		{
+			return std::uniform_real_distribution<float>( 0.0f, 1.0f )( random );
+		}
+
+		bool Chance( float probability )
+		{
+			return probability > 0.0f && Uniform() < probability;
+		}
+
+		bool Lost()
+		{
+			// gilbert-elliott two state model: bursts of loss while in the bad state
+			if ( config.burst_enter > 0.0f )
+			{
+				if ( bad_state )
+				{
+					if ( Chance( config.burst_exit ) )
+						bad_state = false;
+				}
+				else if ( Chance( config.burst_enter ) )
+				{
+					bad_state = true;
+				}
+				if ( bad_state && Chance( config.burst_loss ) )
+					return true;
+			}
+			return Chance( config.loss );
+		}
+
+		ImpairmentConfig config;
+		std::mt19937 random;
+		bool bad_state;
+		unsigned long long link_free;		// time the link finishes serializing what is queued
+		unsigned long long order;
+		std::priority_queue<Datagram, std::vector<Datagram>, std::greater<Datagram> > line;
+
+		unsigned int submitted;
+		unsigned int delivered;
+		unsigned int dropped;
+		unsigned int duplicated;
+		unsigned int reordered;
+	};
+
+	// socket decorator applying impairments to outgoing (egress) and incoming (ingress) datagrams
+	//  + delayed datagrams are released whenever the socket is used, so poll it at least as often
+	//    as the delay resolution you need (the main loop does so between every paced departure)
+
+	class ImpairedSocket : public Socket
+	{
+	public:
+
+		ImpairedSocket( const ImpairmentConfig & egress, const ImpairmentConfig & ingress, unsigned int seed = 1 )
+		{
+			this->egress.Reset( egress, seed );
+			this->ingress.Reset( ingress, seed * 2 + 1 );
+		}
+
+		bool Send( const Address & destination, const void * data, int size )
+		{
+			if ( !IsOpen() )
+				return false;
+			if ( !egress.IsActive() )
+				return Socket::Send( destination, data, size );
+			egress.Submit( destination, data, size, time_now_ns() );
+			Flush();
+			return true;
+		}
+
+		int Receive( Address & sender, void * data, int size )
+		{
+			if ( !IsOpen() )
+				return 0;
+			Flush();
+			if ( !ingress.IsActive() )
+				return Socket::Receive( sender, data, size );
+
+			// drain the real socket into the ingress delay line, then hand out whatever is due
+			//  + with udp gro the kernel still coalesces, so each train is split into its datagrams here
+			Address from;
+			int bytes;
+			if ( Socket::IsReceiveOffload() )
+			{
+				train.resize( MaxTrainBytes );
+				int segment;
+				while ( ( bytes = Socket::ReceiveSegments( from, train.data(), (int) train.size(), segment ) ) > 0 )
+				{
+					for ( int offset = 0; offset < bytes; offset += segment )
+						ingress.Submit( from, &train[offset], bytes - offset < segment ? bytes - offset : segment, time_now_ns() );
+				}
+			}
+			else
+			{
+				unsigned char buffer[PacketSizeHack + 64];
+				while ( ( bytes = Socket::Receive( from, buffer, sizeof( buffer ) ) ) > 0 )
+					ingress.Submit( from, buffer, bytes, time_now_ns() );
+			}
+
+			ImpairedLink::Datagram datagram;
+			if ( !ingress.Pop( time_now_ns(), datagram ) )
+				return 0;
+			const int length = (int) datagram.data.size() < size ? (int) datagram.data.size() : size;
+			memcpy( data, datagram.data.data(), length );
+			sender = datagram.address;
+			return length;
+		}
+
+		// trains are only handed to the kernel whole when nothing is impaired in that direction
+
+		bool SendSegments( const Address & destination, const void * data, int size, int segment )
+		{
+			if ( !IsOpen() )
+				return false;
+			if ( egress.IsActive() )
+				return SendEach( destination, (const char*) data, size, segment );
+			Flush();
+			return Socket::SendSegments( destination, data, size, segment );
+		}
+
+		int ReceiveSegments( Address & sender, void * data, int size, int & segment )
+		{
+			if ( !IsOpen() )
+				return 0;
+			if ( !ingress.IsActive() )
+			{
+				Flush();
+				return Socket::ReceiveSegments( sender, data, size, segment );
+			}
+			segment = Receive( sender, data, size );
+			return segment;
+		}
+
+		bool IsReceiveOffload() const
+		{
+			return !ingress.IsActive() && Socket::IsReceiveOffload();
+		}
+
+		// a delayed datagram due before the deadline ends the wait as well
+
+		bool Wait( unsigned long long deadline )
+		{
+			if ( !IsOpen() )
+				return false;
+			unsigned long long release = egress.NextRelease() < ingress.NextRelease() ? egress.NextRelease() : ingress.NextRelease();
+			if ( release <= time_now_ns() )
+				return true;
+			return Socket::Wait( release < deadline ? release : deadline ) || time_now_ns() >= release;
+		}
+
+		// release egress datagrams that are due
+
+		void Flush()
+		{
+			ImpairedLink::Datagram datagram;
+			while ( egress.Pop( time_now_ns(), datagram ) )
+				Socket::Send( datagram.address, datagram.data.data(), (int) datagram.data.size() );
+		}
+
+		const ImpairedLink & GetEgress() const	{ return egress; }
+		const ImpairedLink & GetIngress() const	{ return ingress; }
+
+	private:
+
+		ImpairedLink egress;
+		ImpairedLink ingress;
+		std::vector<unsigned char> train;	// coalesced datagrams read from the real socket
+	};
+}
+
+#endif
@@ -31,6 +31,8 @@
 * +-------------------------+  217
 * |            md5 (16B)    |
 * +-------------------------+  233
+* |    totalChunks (4B)     |
+* +-------------------------+  237
 * |        padding          |
 * +-------------------------+  256
 * 
@@ -46,20 +48,144 @@
 * |        data (247B)      |
 * +-------------------------+  256
 * 
+* 
+*      PacketSlice on the wire (compact):
+* 
+* +-------------------------+    0
+* |   typeFlag (1B): data   |
+* +-------------------------+    1
+* |     id (varint 1-8B)    |
+* +-------------------------+  2-9
+* |        data (247B)      |
+* +-------------------------+ 249-256
+* 
+*   The slice id is sent as a QUIC style variable-length integer: the two
+*   high bits of the first byte give the length (1, 2, 4 or 8 bytes) and
+*   the rest hold the value, so ids below 64 take 1 byte and below 16384
+*   take 2. Slices are kept in memory as PacketSlice.
+* 
+* 
+*      PacketChunkList Segment (sender -> receiver):
+* 
+* +-------------------------+    0
+* |   typeFlag (1B): chunks |
+* +-------------------------+    1
+* |       first (4B)        |
+* +-------------------------+    5
+* |       count (1B)        |
+* +-------------------------+    6
+* | entries (12 x 20B)      |
+* |   size (4B) + md5 (16B) |
+* +-------------------------+  246
+* |        padding          |
+* +-------------------------+  256
+* 
+* 
+*      PacketChunkHave Segment (receiver -> sender):
+* 
+* +-------------------------+    0
+* |    typeFlag (1B): have  |
+* +-------------------------+    1
+* |       first (4B)        |
+* +-------------------------+    5
+* |       count (2B)        |
+* +-------------------------+    7
+* |  bitmap (249B), 1=have  |
+* +-------------------------+  256
+* 
+* 
+*      PacketGet Segment (downloader -> server):
+* 
+* +-------------------------+    0
+* |    typeFlag (1B): get   |
+* +-------------------------+    1
+* |     filename (200B)     |
+* +-------------------------+  201
+* |      session (8B)       |
+* +-------------------------+  209
+* |        padding          |
+* +-------------------------+  256
+* 
+*   The server answers with the file's PacketMeta, or with a PacketMeta
+*   whose filename is empty when it does not hold the file. Connections
+*   sending the same non-zero session are paths of one striped transfer.
+* 
+* 
+*      PacketRanges Segment (downloader -> server, receiver -> sender):
+* 
+* +-------------------------+    0
+* |   typeFlag (1B): ranges |
+* +-------------------------+    1
+* |       count (1B)        |
+* +-------------------------+    2
+* | ranges (15 x 16B)       |
+* |  first (8B) + count (8B)|
+* +-------------------------+  242
+* |       flags (1B)        |
+* +-------------------------+  243
+* |        padding          |
+* +-------------------------+  256
+* 
+*   Each range names slices [first, first + count) of the file last asked
+*   for; the server streams the slices of all its pending ranges in turn.
+*   With RANGES_REPLACE the ranges still pending are dropped first, so a
+*   downloader can take work away from a slow source.
+* 
+*   In a push transfer the receiver sends it as a NACK, listing the gaps in
+*   what it holds with RANGES_REPLACE set, and the sender sends those slices
+*   again before any new ones. A PacketRanges with no ranges and
+*   RANGES_COMPLETE set tells the sender the whole file arrived.
+* 
+* 
+*      Batch on the wire (coalesced messages):
+* 
+* +-------------------------+    0
+* |   typeFlag (1B): batch  |
+* +-------------------------+    1
+* |   size (varint 1-2B)    |
+* +-------------------------+
+* |     message (size B)    |
+* +-------------------------+
+* |  ... size, message ...  |
+* +-------------------------+ <= 256
+* 
+*   Messages too small to fill a datagram of their own are packed into one
+*   and each keeps its own typeFlag. A keep-alive is a message of just its
+*   typeFlag, sent when there is nothing else to say.
+* 
 */
 
 #include <cstdint>
+#include <cstddef>
 
 #define PACKET_SIZE         256
 #define MAX_FILENAME_LENGTH 200
 #define MD5_HASH_LENGTH     16
+#define MAX_FILE_SIZE       (4ULL << 30)    // largest file a transfer takes, the receiver holds all of it in memory
 
-#define PADDING_SIZE        (PACKET_SIZE - 1 - MAX_FILENAME_LENGTH - 8 * 2 - MD5_HASH_LENGTH)
+#define PADDING_SIZE        (PACKET_SIZE - 1 - MAX_FILENAME_LENGTH - 8 * 2 - MD5_HASH_LENGTH - 4)
 #define DATA_SIZE           (PACKET_SIZE - 1 - 8)
 
+#define CHUNKS_PER_PACKET   12
+#define HAVE_BITMAP_SIZE    (PACKET_SIZE - 1 - 4 - 2)
+#define HAVE_PER_PACKET     (HAVE_BITMAP_SIZE * 8)
+
+#define RANGES_PER_PACKET   15
+#define RANGES_REPLACE      0x01
+#define RANGES_COMPLETE     0x02
+
+#define MAX_VARINT_SIZE     8
+#define MAX_VARINT_VALUE    ((1ULL << 62) - 1)
+
 enum PacketType : uint8_t {
-    TYPE_META = 0x01, // 0000 0001
-    TYPE_DATA = 0x02  // 0000 0010
+    TYPE_META   = 0x01, // 0000 0001
+    TYPE_DATA   = 0x02, // 0000 0010
+    TYPE_CHUNKS = 0x04, // 0000 0100
+    TYPE_HAVE   = 0x08, // 0000 1000
+    TYPE_GET    = 0x10, // 0001 0000
+    TYPE_RANGES = 0x20, // 0010 0000
+    TYPE_BATCH  = 0x40, // 0100 0000
+    TYPE_KEEPALIVE = 0x80 // 1000 0000
 };
 
 // Make sure all packets are fixed size(256) and 1 byte aligned.
@@ -71,6 +197,7 @@ struct PacketMeta
     uint64_t    fileSize;
     uint64_t    totalSlices;
     uint8_t     md5[MD5_HASH_LENGTH];
+    uint32_t    totalChunks;
     uint8_t     padding[PADDING_SIZE];
 };
 
@@ -80,6 +207,111 @@ struct PacketSlice
 	uint64_t    id;
 	char        data[DATA_SIZE];
 };
+
+struct ChunkEntry
+{
+    uint32_t    size;
+    uint8_t     md5[MD5_HASH_LENGTH];
+};
+
+struct PacketChunkList
+{
+    uint8_t     typeFlag;
+    uint32_t    first;
+    uint8_t     count;
+    ChunkEntry  entries[CHUNKS_PER_PACKET];
+    uint8_t     padding[PACKET_SIZE - 1 - 4 - 1 - CHUNKS_PER_PACKET * sizeof(ChunkEntry)];
+};
+
+struct PacketChunkHave
+{
+    uint8_t     typeFlag;
+    uint32_t    first;
+    uint16_t    count;
+    uint8_t     bitmap[HAVE_BITMAP_SIZE];
+};
+
+struct PacketGet
+{
+    uint8_t     typeFlag;
+    char        filename[MAX_FILENAME_LENGTH];
+    uint64_t    session;
+    uint8_t     padding[PACKET_SIZE - 1 - MAX_FILENAME_LENGTH - 8];
+};
+
+struct SliceRange
+{
+    uint64_t    first;
+    uint64_t    count;
+};
+
+struct PacketRanges
+{
+    uint8_t     typeFlag;
+    uint8_t     count;
+    SliceRange  ranges[RANGES_PER_PACKET];
+    uint8_t     flags;
+    uint8_t     padding[PACKET_SIZE - 1 - 1 - RANGES_PER_PACKET * sizeof(SliceRange) - 1];
+};
 #pragma pack(pop)
 
+static_assert(sizeof(PacketMeta) == PACKET_SIZE, "PacketMeta must be PACKET_SIZE bytes");
+static_assert(sizeof(PacketSlice) == PACKET_SIZE, "PacketSlice must be PACKET_SIZE bytes");
+static_assert(sizeof(PacketChunkList) == PACKET_SIZE, "PacketChunkList must be PACKET_SIZE bytes");
+static_assert(sizeof(PacketChunkHave) == PACKET_SIZE, "PacketChunkHave must be PACKET_SIZE bytes");
+static_assert(sizeof(PacketGet) == PACKET_SIZE, "PacketGet must be PACKET_SIZE bytes");
+static_assert(sizeof(PacketRanges) == PACKET_SIZE, "PacketRanges must be PACKET_SIZE bytes");
+
+/*
+ * Function : WriteVarint
+ * Description :
+ *   Writes a QUIC style variable-length integer (at most MAX_VARINT_VALUE).
+ * Parameters :
+ *   uint8_t* out - Destination, with room for MAX_VARINT_SIZE bytes.
+ *   uint64_t value - The value to encode.
+ * Return :
+ *   size_t - The number of bytes written.
+ */
+inline size_t WriteVarint(uint8_t* out, uint64_t value)
+{
+    const int code = (value >= (1ULL << 6)) + (value >= (1ULL << 14)) + (value >= (1ULL << 30));
+    const size_t length = size_t(1) << code;
+    for (size_t i = 0; i < length; i++)
+    {
+        out[i] = static_cast<uint8_t>(value >> (8 * (length - 1 - i)));
+    }
+    out[0] |= static_cast<uint8_t>(code << 6);
+    return length;
+}
+
+/*
+ * Function : ReadVarint
+ * Description :
+ *   Reads a QUIC style variable-length integer.
+ * Parameters :
+ *   const uint8_t* in - Source bytes.
+ *   size_t size - Bytes available at in.
+ *   uint64_t& value - Receives the decoded value.
+ * Return :
+ *   size_t - The number of bytes read, or 0 if the input is too short.
+ */
+inline size_t ReadVarint(const uint8_t* in, size_t size, uint64_t& value)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    const size_t length = size_t(1) << (in[0] >> 6);
+    if (size < length)
+    {
+        return 0;
+    }
+    value = in[0] & 0x3F;
+    for (size_t i = 1; i < length; i++)
+    {
+        value = (value << 8) | in[i];
+    }
+    return length;
+}
+
 #endif
\ No newline at end of file
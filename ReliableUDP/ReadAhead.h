@@ -0,0 +1,487 @@
+/*
+* FILE : ReadAhead.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides the read-ahead that keeps disk reads off the send
+*   loop of a streamed file. A reader thread reads the file in order and
+*   encodes its slices into a lock-free single-producer single-consumer
+*   ring, and the send loop takes them from there without a system call or
+*   a lock. How far the reader runs ahead follows the rate slices are taken
+*   at, so a fast sender is never left waiting on storage while a slow one
+*   does not buffer more of the file than it needs.
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include "Net.h"
+#include "Protocol.h"
+#include "Utilities.h"
+
+/*
+ * Class : SpscRing
+ * Description :
+ *   A fixed ring of slots passed from one producer thread to one consumer
+ *   thread. The producer fills the slot Claim returns and Publishes it, the
+ *   consumer reads the slot Front returns and Pops it. Each side only writes
+ *   its own index and keeps a copy of the other's, so the shared cache lines
+ *   are only touched when that copy says the ring looks full or empty.
+ */
+template<typename T>
+class SpscRing
+{
+public:
+	/*
+	 * Function : SpscRing
+	 * Description :
+	 *   Allocates the slots.
+	 * Parameters :
+	 *   size_t capacity - The number of slots, rounded up to a power of two.
+	 * Return :
+	 *   None
+	 */
+	explicit SpscRing(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		m_slots.resize(size);
+		m_mask = size - 1;
+	}
+
+	/*
+	 * Function : Claim
+	 * Description :
+	 *   Producer side: returns the next free slot to fill.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   T* - The slot, or nullptr while the ring is full.
+	 */
+	T* Claim()
+	{
+		const size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_headCache > m_mask)
+		{
+			m_headCache = m_head.load(std::memory_order_acquire);
+			if (tail - m_headCache > m_mask)
+			{
+				return nullptr;
+			}
+		}
+		return &m_slots[tail & m_mask];
+	}
+
+	/*
+	 * Function : Publish
+	 * Description :
+	 *   Producer side: hands the slot last claimed to the consumer.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Publish()
+	{
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/*
+	 * Function : Front
+	 * Description :
+	 *   Consumer side: returns the oldest published slot.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   T* - The slot, or nullptr while the ring is empty.
+	 */
+	T* Front()
+	{
+		const size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tailCache)
+		{
+			m_tailCache = m_tail.load(std::memory_order_acquire);
+			if (head == m_tailCache)
+			{
+				return nullptr;
+			}
+		}
+		return &m_slots[head & m_mask];
+	}
+
+	/*
+	 * Function : Pop
+	 * Description :
+	 *   Consumer side: gives the slot Front returned back to the producer.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Pop()
+	{
+		m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/*
+	 * Function : GetSize
+	 * Description :
+	 *   Returns how many slots are published and not popped. Either side may
+	 *   call it, the answer is only exact on the consumer side.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of slots.
+	 */
+	size_t GetSize() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	/*
+	 * Function : GetCapacity
+	 * Description :
+	 *   Returns how many slots the ring has.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of slots.
+	 */
+	size_t GetCapacity() const
+	{
+		return m_mask + 1;
+	}
+
+private:
+	static const size_t CacheLine = 64;
+
+	std::vector<T> m_slots;
+	size_t m_mask = 0;
+
+	alignas(CacheLine) std::atomic<size_t> m_head{ 0 };   // next slot to read, written by the consumer
+	size_t m_tailCache = 0;                                 // the consumer's copy of m_tail
+	alignas(CacheLine) std::atomic<size_t> m_tail{ 0 };   // next slot to write, written by the producer
+	size_t m_headCache = 0;                                 // the producer's copy of m_head
+};
+
+/*
+ * Class : SliceReadAhead
+ * Description :
+ *   Reads the slices of a streamed file on its own thread, in order and
+ *   ahead of the send loop, which takes them encoded and ready to send.
+ */
+class SliceReadAhead
+{
+public:
+	static constexpr size_t Capacity = 4096;    // slots, bounding the memory to about a megabyte
+	static constexpr size_t MinDepth = 64;      // slices kept ready however slow the sender is
+	static constexpr size_t ReadBatch = 64;     // slices read from the file with one call
+	static constexpr float RateWindow = 0.05f;  // seconds between measurements of the take rate
+	static constexpr float MinLead = 0.02f;     // seconds of sending kept ready
+	static constexpr float MaxLead = 0.5f;
+
+	/*
+	 * Function : SliceReadAhead
+	 * Description :
+	 *   Sets up an idle read-ahead.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   None
+	 */
+	SliceReadAhead() : m_ring(Capacity)
+	{
+	}
+
+	/*
+	 * Function : ~SliceReadAhead
+	 * Description :
+	 *   Stops the reader thread.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   None
+	 */
+	~SliceReadAhead()
+	{
+		Stop();
+	}
+
+	/*
+	 * Function : Start
+	 * Description :
+	 *   Opens the file and starts reading its slices from the first one. The
+	 *   first MinDepth slices are read before it returns, so the first flight
+	 *   of a transfer does not wait for the thread to get going.
+	 * Parameters :
+	 *   const FileSlices& file - The streamed file, which must outlive the read-ahead.
+	 * Return :
+	 *   bool - Returns false if the file could not be opened.
+	 */
+	bool Start(const FileSlices& file)
+	{
+		Stop();
+		m_source.open(file.GetMeta()->filename, std::ios::binary);
+		if (!m_source)
+		{
+			NET_ERROR("Error: Failed opening file to read ahead! %s", file.GetMeta()->filename);
+			return false;
+		}
+		while (m_ring.Front() != nullptr)
+		{
+			m_ring.Pop();
+		}
+		m_file = &file;
+		m_taken = 0;
+		m_stalls = 0;
+		m_depth.store(MinDepth, std::memory_order_relaxed);
+		m_lead = MinLead;
+		m_rate = 0.0f;
+		m_windowStart = net::time_now_ns();
+		m_windowTaken = 0;
+		m_lastStall = 0;
+		m_next = 0;
+		if (!Fill(std::min(MinDepth, file.GetTotal())))
+		{
+			m_source.close();
+			return false;
+		}
+		m_running.store(true, std::memory_order_relaxed);
+		m_finished.store(false, std::memory_order_relaxed);
+		m_thread = std::thread(&SliceReadAhead::Read, this);
+		return true;
+	}
+
+	/*
+	 * Function : Stop
+	 * Description :
+	 *   Stops the reader thread and closes the file.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Stop()
+	{
+		m_running.store(false, std::memory_order_relaxed);
+		if (m_thread.joinable())
+		{
+			m_thread.join();
+		}
+		m_source.close();
+	}
+
+	/*
+	 * Function : Take
+	 * Description :
+	 *   Copies a slice out of the ring in its wire form. Slices before it are
+	 *   dropped, the send loop skipped them. When the reader has not reached
+	 *   the slice yet the loop should send nothing new this time round rather
+	 *   than read it itself, and the read-ahead deepens.
+	 * Parameters :
+	 *   size_t id - The slice wanted, at or after every slice taken before.
+	 *   uint8_t* out - Destination, with room for PACKET_SIZE bytes.
+	 * Return :
+	 *   int - The number of bytes written; 0 if the slice is not read yet;
+	 *   -1 if the read-ahead will not deliver it, for the caller to encode it.
+	 */
+	int Take(size_t id, uint8_t* out)
+	{
+		Slot* slot = m_ring.Front();
+		while (slot != nullptr && slot->id < id)
+		{
+			m_ring.Pop();
+			slot = m_ring.Front();
+		}
+		if (slot == nullptr)
+		{
+			if (m_finished.load(std::memory_order_acquire))
+			{
+				// the reader may have published its last slices just before finishing
+				slot = m_ring.Front();
+				while (slot != nullptr && slot->id < id)
+				{
+					m_ring.Pop();
+					slot = m_ring.Front();
+				}
+			}
+			if (slot == nullptr)
+			{
+				if (m_finished.load(std::memory_order_acquire) || !m_running.load(std::memory_order_relaxed))
+				{
+					return -1;
+				}
+				// the sender caught up with storage, keep more ready from now on
+				m_stalls++;
+				const unsigned long long now = net::time_now_ns();
+				if (now - m_lastStall >= (unsigned long long)(RateWindow * 1000000000.0f))
+				{
+					m_lastStall = now;
+					m_lead = std::min(m_lead * 2.0f, MaxLead);
+					SetDepth();
+				}
+				return 0;
+			}
+		}
+		if (slot->id != id)
+		{
+			return -1;
+		}
+		memcpy(out, slot->packet, slot->bytes);
+		const int bytes = slot->bytes;
+		m_ring.Pop();
+		m_taken++;
+		m_windowTaken++;
+		const unsigned long long now = net::time_now_ns();
+		if (now - m_windowStart >= (unsigned long long)(RateWindow * 1000000000.0f))
+		{
+			// the take rate over the last window, smoothed
+			const float rate = m_windowTaken / ((now - m_windowStart) / 1000000000.0f);
+			m_rate = m_rate == 0.0f ? rate : m_rate + (rate - m_rate) * 0.25f;
+			m_windowStart = now;
+			m_windowTaken = 0;
+			SetDepth();
+		}
+		return bytes;
+	}
+
+	/*
+	 * Function : GetDepth
+	 * Description :
+	 *   Returns how many slices the reader currently keeps ready.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The target depth in slices.
+	 */
+	size_t GetDepth() const
+	{
+		return m_depth.load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * Function : GetStalls
+	 * Description :
+	 *   Returns how often the send loop asked for a slice not read yet.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The number of stalls.
+	 */
+	unsigned long long GetStalls() const
+	{
+		return m_stalls;
+	}
+
+	/*
+	 * Function : GetTaken
+	 * Description :
+	 *   Returns how many slices the send loop took from the ring.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   unsigned long long - The number of slices.
+	 */
+	unsigned long long GetTaken() const
+	{
+		return m_taken;
+	}
+
+private:
+	struct Slot
+	{
+		size_t id = 0;
+		int bytes = 0;
+		uint8_t packet[PACKET_SIZE];
+	};
+
+	// Consumer side: the depth is the slices sent in the lead time at the measured rate
+	void SetDepth()
+	{
+		const size_t depth = (size_t)(m_rate * m_lead);
+		m_depth.store(std::clamp(depth, MinDepth, m_ring.GetCapacity()), std::memory_order_relaxed);
+	}
+
+	// Reader side: reads the next slices of the file into the ring, which has room for them
+	bool Fill(size_t count)
+	{
+		m_block.resize(ReadBatch * DATA_SIZE);
+		while (count > 0)
+		{
+			const size_t batch = std::min(count, ReadBatch);
+			const uint64_t offset = (uint64_t)m_next * DATA_SIZE;
+			const size_t bytes = (size_t)std::min<uint64_t>(batch * DATA_SIZE, m_file->GetMeta()->fileSize - offset);
+			m_source.read(reinterpret_cast<char*>(m_block.data()), bytes);
+			if (!m_source)
+			{
+				NET_ERROR("Error: Failed reading ahead at slice %llu of %s", (unsigned long long)m_next, m_file->GetMeta()->filename);
+				return false;
+			}
+			for (size_t i = 0; i < batch; i++)
+			{
+				Slot* slot = m_ring.Claim();
+				slot->id = m_next + i;
+				slot->bytes = (int)m_file->EncodeSlice(m_next + i, m_block.data() + i * DATA_SIZE, slot->packet);
+				m_ring.Publish();
+			}
+			m_next += batch;
+			count -= batch;
+		}
+		return true;
+	}
+
+	// Reader thread: keeps the ring filled to the depth, a batch of slices at a time
+	void Read()
+	{
+		const size_t total = m_file->GetTotal();
+		while (m_next < total && m_running.load(std::memory_order_relaxed))
+		{
+			const size_t held = m_ring.GetSize();
+			const size_t depth = m_depth.load(std::memory_order_relaxed);
+			if (held >= depth)
+			{
+				// at least MinDepth slices are ready, a short nap cannot starve the sender
+				net::sleep_until_ns(net::time_now_ns() + 200000);
+				continue;
+			}
+
+			if (!Fill(std::min({ depth - held, ReadBatch, total - m_next })))
+			{
+				break;
+			}
+		}
+		m_finished.store(true, std::memory_order_release);
+	}
+
+	SpscRing<Slot> m_ring;
+	std::thread m_thread;
+	std::atomic<bool> m_running{ false };
+	std::atomic<bool> m_finished{ false };      // the reader stopped, at the end of the file or on an error
+	std::atomic<size_t> m_depth{ MinDepth };    // written by the consumer, read by the reader
+
+	// reader thread only, and Start before it runs
+	const FileSlices* m_file = nullptr;
+	std::ifstream m_source;
+	std::vector<uint8_t> m_block;               // one batch of slices as read from the file
+	size_t m_next = 0;                          // the next slice to read
+
+	// consumer only
+	float m_lead = MinLead;
+	float m_rate = 0.0f;                        // slices per second, smoothed
+	unsigned long long m_windowStart = 0;
+	unsigned long long m_windowTaken = 0;
+	unsigned long long m_lastStall = 0;         // when the lead last grew
+	unsigned long long m_taken = 0;
+	unsigned long long m_stalls = 0;
+};
@@ -8,12 +8,23 @@
 #include <fstream>
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
 
 #include "Net.h"
+#include "NetEmulator.h"
+#include "IoUring.h"
+#include "Simulator.h"
+#include "LoadGenerator.h"
+#include "MetricsExporter.h"
+#include "ReadAhead.h"
+#include "Download.h"
+#include "Coalescer.h"
 #include "Utilities.h"
 
 //#define SHOW_ACKS
 //#define MD5_TEST
+//#define KERNEL_PACING
 
 using namespace std;
 using namespace net;
@@ -25,14 +36,29 @@ const float DeltaTime = 1.0f / 30.0f;
 const float SendRate = 1.0f / 30.0f;
 const float TimeOut = 10.0f;
 const int PacketSize = 256;
+const float HaveTimeOut = 1.0f;
+const int InitialWindow = 10;
+const int HaveRounds = 3;
+const int ChunkListRounds = 3;                 // times the chunk list is sent before giving up on the server's report
+const float NackInterval = 0.1f;
+const int CompleteRounds = 3;
+const float LingerTimeOut = 2.0f;
+const uint64_t StreamFileSize = 64ULL << 20;   // files this large are streamed from disk instead of loaded
+const int AckEveryPackets = 4;
+const float AckMaxDelay = 0.02f;
+const bool UseCompactHeader = true;
+const unsigned int IoRingEntries = 256;
+const char* ChunkStoreDir = "chunks";
 
 class FlowControl
 {
 public:
 
-	FlowControl()
+	FlowControl(bool verbose = true)
 	{
-		printf("flow control initialized\n");
+		this->verbose = verbose;
+		if (verbose)
+			printf("flow control initialized\n");
 		Reset();
 	}
 
@@ -52,14 +78,16 @@ public:
 		{
 			if (rtt > RTT_Threshold)
 			{
-				printf("*** dropping to bad mode ***\n");
+				if (verbose)
+					printf("*** dropping to bad mode ***\n");
 				mode = Bad;
 				if (good_conditions_time < 10.0f && penalty_time < 60.0f)
 				{
 					penalty_time *= 2.0f;
 					if (penalty_time > 60.0f)
 						penalty_time = 60.0f;
-					printf("penalty time increased to %.1f\n", penalty_time);
+					if (verbose)
+						printf("penalty time increased to %.1f\n", penalty_time);
 				}
 				good_conditions_time = 0.0f;
 				penalty_reduction_accumulator = 0.0f;
@@ -74,7 +102,8 @@ public:
 				penalty_time /= 2.0f;
 				if (penalty_time < 1.0f)
 					penalty_time = 1.0f;
-				printf("penalty time reduced to %.1f\n", penalty_time);
+				if (verbose)
+					printf("penalty time reduced to %.1f\n", penalty_time);
 				penalty_reduction_accumulator = 0.0f;
 			}
 		}
@@ -88,7 +117,8 @@ public:
 
 			if (good_conditions_time > penalty_time)
 			{
-				printf("*** upgrading to good mode ***\n");
+				if (verbose)
+					printf("*** upgrading to good mode ***\n");
 				good_conditions_time = 0.0f;
 				penalty_reduction_accumulator = 0.0f;
 				mode = Good;
@@ -112,6 +142,7 @@ private:
 		Bad
 	};
 
+	bool verbose;
 	Mode mode;
 	float penalty_time;
 	float good_conditions_time;
@@ -120,6 +151,194 @@ private:
 
 // ----------------------------------------------
 
+const float SimTick = 0.005f;
+const float SimSampleInterval = 0.1f;
+const int SimBasePort = 20000;
+
+/*
+ * Struct : SimPair
+ * Description :
+ *   One simulated client/server pair. The client streams fixed size packets
+ *   at the rate its flow control allows; the server only acks.
+ */
+struct SimPair
+{
+	SimPair(SimNetwork& network, int index)
+		: clientSocket(network), serverSocket(network),
+		  client(ProtocolId, TimeOut), server(ProtocolId, TimeOut), flowControl(false)
+	{
+		const unsigned short serverPort = (unsigned short)(SimBasePort + index * 2);
+		client.SetTransport(&clientSocket);
+		server.SetTransport(&serverSocket);
+		client.SetAckFrequency(AckEveryPackets, AckMaxDelay);
+		server.SetAckFrequency(AckEveryPackets, AckMaxDelay);
+		client.SetCompactHeader(UseCompactHeader);
+		server.SetCompactHeader(UseCompactHeader);
+		server.Start(serverPort);
+		server.Listen();
+		client.Start(serverPort + 1);
+		client.Connect(SimNetwork::LocalAddress(serverPort));
+	}
+
+	bool HasPending() const
+	{
+		return clientSocket.HasPending() || serverSocket.HasPending();
+	}
+
+	void Receive()
+	{
+		unsigned char packet[PacketSize];
+		while (client.ReceivePacket(packet, sizeof(packet)) > 0)
+		{
+		}
+		int bytes;
+		while ((bytes = server.ReceivePacket(packet, sizeof(packet))) > 0)
+		{
+			delivered += bytes;
+		}
+	}
+
+	void Tick(float deltaTime)
+	{
+		if (client.IsConnected())
+			flowControl.Update(deltaTime, client.GetReliabilitySystem().GetRoundTripTime() * 1000.0f);
+
+		sendAccumulator += deltaTime;
+		const float interval = 1.0f / flowControl.GetSendRate();
+		while (sendAccumulator > interval)
+		{
+			unsigned char packet[PacketSize];
+			memset(packet, 0, sizeof(packet));
+			client.SendPacket(packet, sizeof(packet));
+			sendAccumulator -= interval;
+		}
+
+		client.Update(deltaTime);
+		server.Update(deltaTime);
+	}
+
+	SimSocket clientSocket;
+	SimSocket serverSocket;
+	ReliableConnection client;
+	ReliableConnection server;
+	FlowControl flowControl;
+	float sendAccumulator = 0.0f;
+	unsigned long long delivered = 0;		// payload bytes handed to the server application
+	unsigned long long sampled = 0;			// delivered at the previous trace sample
+};
+
+/*
+ * Function : RunSimulation
+ * Description :
+ *   Runs many connection pairs over a simulated network on a virtual clock.
+ *   Datagrams are delivered at their exact release time and every pair is
+ *   updated once per tick. The same seed always produces the same trace.
+ * Parameters :
+ *   int pairs - The number of client/server pairs.
+ *   float seconds - The simulated duration.
+ *   float tickSeconds - The update step, which is also the RTT measurement resolution.
+ *   unsigned int seed - Seed for every random decision on the links.
+ *   const char* tracePath - CSV file for per pair samples, or NULL.
+ *   const ImpairmentConfig& link - The model applied to every link direction.
+ * Return :
+ *   int - The process exit code.
+ */
+int RunSimulation(int pairs, float seconds, float tickSeconds, unsigned int seed, const char* tracePath, const ImpairmentConfig& link)
+{
+	FILE* trace = nullptr;
+	if (tracePath != nullptr)
+	{
+		trace = fopen(tracePath, "w");
+		if (trace == nullptr)
+		{
+			std::cerr << "Error: Failed opening trace file " << tracePath << std::endl;
+			return EXIT_FAILURE;
+		}
+		fprintf(trace, "time,pair,rtt_ms,rttvar_ms,rto_ms,sent,acked,lost,goodput_kbps\n");
+	}
+
+	SimNetwork network(link, seed);
+	std::vector<std::unique_ptr<SimPair>> simPairs;
+	for (int i = 0; i < pairs; i++)
+	{
+		simPairs.push_back(std::make_unique<SimPair>(network, i));
+	}
+
+	const unsigned long long tick = (unsigned long long)(tickSeconds * 1e9f);
+	const unsigned long long end = (unsigned long long)(seconds * 1e9);
+	const unsigned long long sampleEvery = (unsigned long long)(SimSampleInterval * 1e9f);
+	unsigned long long nextTick = tick;
+	unsigned long long nextSample = sampleEvery;
+	auto wallStart = std::chrono::steady_clock::now();
+
+	while (network.GetTime() < end)
+	{
+		// jump straight to the next delivery or update, whichever comes first
+		const unsigned long long release = network.NextRelease();
+		const unsigned long long next = release < nextTick ? release : nextTick;
+		network.AdvanceTo(next);
+
+		for (auto& pair : simPairs)
+		{
+			if (pair->HasPending())
+				pair->Receive();
+		}
+
+		if (next == nextTick)
+		{
+			for (auto& pair : simPairs)
+			{
+				pair->Tick(tickSeconds);
+			}
+			nextTick += tick;
+		}
+
+		if (next >= nextSample)
+		{
+			for (int i = 0; i < pairs && trace != nullptr; i++)
+			{
+				SimPair& pair = *simPairs[i];
+				ReliabilitySystem& reliability = pair.client.GetReliabilitySystem();
+				fprintf(trace, "%.3f,%d,%.2f,%.2f,%.2f,%u,%u,%u,%.1f\n", nextSample / 1e9, i,
+					reliability.GetRoundTripTime() * 1000.0f, reliability.GetRoundTripTimeVariance() * 1000.0f,
+					reliability.GetRetransmissionTimeout() * 1000.0f, reliability.GetSentPackets(),
+					reliability.GetAckedPackets(), reliability.GetLostPackets(),
+					(pair.delivered - pair.sampled) * 8.0 / SimSampleInterval / 1000.0);
+				pair.sampled = pair.delivered;
+			}
+			nextSample += sampleEvery;
+		}
+	}
+
+	double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+	unsigned long long delivered = 0;
+	unsigned long long sent = 0, lost = 0;
+	double rttSum = 0.0;
+	for (auto& pair : simPairs)
+	{
+		ReliabilitySystem& reliability = pair->client.GetReliabilitySystem();
+		delivered += pair->delivered;
+		sent += reliability.GetSentPackets();
+		lost += reliability.GetLostPackets();
+		rttSum += reliability.GetRoundTripTime();
+	}
+
+	printf("simulated %d pairs for %.1f s in %.2f s wall time (%.0fx real time), seed %u\n",
+		pairs, seconds, wallSeconds, wallSeconds > 0.0 ? seconds / wallSeconds : 0.0, seed);
+	printf("goodput %.1f kbps total, %.1f kbps per pair, mean rtt %.1f ms, lost %llu of %llu (%.2f%%)\n",
+		delivered * 8.0 / seconds / 1000.0, delivered * 8.0 / seconds / 1000.0 / pairs,
+		rttSum / pairs * 1000.0, lost, sent, sent > 0 ? lost * 100.0 / sent : 0.0);
+
+	if (trace != nullptr)
+	{
+		fclose(trace);
+	}
+	return 0;
+}
+
+// ----------------------------------------------
+
 int main(int argc, char* argv[])
 {
 	// parse command line
@@ -134,6 +353,195 @@ int main(int argc, char* argv[])
 	Address address;
 	const char* filename = nullptr;
 
+	// Network impairment options (e.g. --latency 50 --loss 1) may appear anywhere; strip them before
+	// the positional arguments are read
+	ImpairmentConfig impairment;
+	bool impairIngress = false;
+	int simulatePairs = 0;
+	int benchSessions = 0;
+	float benchMbps = 10.0f;
+	float simulateSeconds = 30.0f;
+	float simulateTick = SimTick;
+	unsigned int seed = 1;
+	const char* tracePath = nullptr;
+	int metricsPort = 0;
+	const char* metricsSocket = nullptr;
+	const char* serveRoot = nullptr;
+	const char* getName = nullptr;
+	std::vector<std::pair<unsigned long long, unsigned long long>> getRanges;
+	std::vector<unsigned int> getLocals;
+	int getPaths = 0;
+	std::vector<Address> getSources;
+	int servePort = ServerPort;
+	bool offload = true;
+	bool ioUring = false;
+	bool sqpoll = false;
+	bool lowLatency = false;
+	bool streamFile = false;
+	float coalesceDeadline = MessageCoalescer::DefaultDeadline;
+	int pinCpu = -1;
+	int busyPoll = 0;
+	int positional = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--impair-ingress") == 0)
+		{
+			impairIngress = true;
+		}
+		else if (strcmp(argv[i], "--no-offload") == 0)
+		{
+			offload = false;
+		}
+		else if (strcmp(argv[i], "--io-uring") == 0)
+		{
+			ioUring = true;
+		}
+		else if (strcmp(argv[i], "--sqpoll") == 0)
+		{
+			ioUring = true;
+			sqpoll = true;
+		}
+		else if (strcmp(argv[i], "--stream") == 0)
+		{
+			streamFile = true;
+		}
+		else if (strcmp(argv[i], "--low-latency") == 0)
+		{
+			lowLatency = true;
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--coalesce") == 0)
+		{
+			coalesceDeadline = (float)atof(argv[++i]) / 1000.0f;
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--pin") == 0)
+		{
+			pinCpu = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--busy-poll") == 0)
+		{
+			busyPoll = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--simulate") == 0)
+		{
+			simulatePairs = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--bench") == 0)
+		{
+			benchSessions = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--target-mbps") == 0)
+		{
+			benchMbps = (float)atof(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--duration") == 0)
+		{
+			simulateSeconds = (float)atof(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--tick") == 0)
+		{
+			simulateTick = (float)atof(argv[++i]) / 1000.0f;
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--seed") == 0)
+		{
+			seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--trace") == 0)
+		{
+			tracePath = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--metrics-port") == 0)
+		{
+			metricsPort = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--metrics-socket") == 0)
+		{
+			metricsSocket = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--serve") == 0)
+		{
+			serveRoot = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--get") == 0)
+		{
+			getName = argv[++i];
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--range") == 0)
+		{
+			// inclusive byte positions as in HTTP, "first-" runs to the end of the file
+			unsigned long long first = 0, last = ~0ULL;
+			if (sscanf_s(argv[++i], "%llu-%llu", &first, &last) < 1 || last < first)
+			{
+				std::cerr << "Error: Invalid range " << argv[i] << ", use first-last" << std::endl;
+				return EXIT_FAILURE;
+			}
+			getRanges.emplace_back(first, last == ~0ULL ? last : last - first + 1);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--paths") == 0)
+		{
+			getPaths = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--port") == 0)
+		{
+			servePort = atoi(argv[++i]);
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--source") == 0)
+		{
+			// another server holding the same file, "ip" or "ip:port"
+			int a, b, c, d, p = ServerPort;
+			if (sscanf_s(argv[++i], "%d.%d.%d.%d:%d", &a, &b, &c, &d, &p) < 4)
+			{
+				std::cerr << "Error: Invalid source address " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+			getSources.push_back(Address(a, b, c, d, (unsigned short)p));
+		}
+		else if (i + 1 < argc && strcmp(argv[i], "--local") == 0)
+		{
+			int a, b, c, d;
+			if (sscanf_s(argv[++i], "%d.%d.%d.%d", &a, &b, &c, &d) != 4)
+			{
+				std::cerr << "Error: Invalid local address " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+			getLocals.push_back(Address(a, b, c, d, 0).GetAddress());
+		}
+		else if (i + 1 < argc && impairment.Parse(argv[i], argv[i + 1]))
+		{
+			i++;
+		}
+		else
+		{
+			argv[positional++] = argv[i];
+		}
+	}
+	argc = positional;
+
+	if (simulatePairs > 0)
+	{
+		return RunSimulation(simulatePairs, simulateSeconds, simulateTick, seed, tracePath, impairment);
+	}
+
+	if (benchSessions > 0)
+	{
+		LoadConfig load;
+		load.sessions = benchSessions;
+		load.seconds = simulateSeconds;
+		load.targetMbps = benchMbps;
+		load.packetSize = PacketSize;
+		load.protocolId = ProtocolId;
+		load.impairment = impairment;
+		load.impairIngress = impairIngress;
+		load.compactHeader = UseCompactHeader;
+		if (!InitializeSockets())
+		{
+			printf("failed to initialize sockets\n");
+			return 1;
+		}
+		const bool ok = LoadGenerator(load).Run();
+		ShutdownSockets();
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	// A1: Retrieving additional command line arguments
 	if (argc >= 2)
 	{
@@ -175,10 +583,21 @@ int main(int argc, char* argv[])
 
 			std::cout << "Selected file for transfer:" << filename << std::endl;
 		}
-		else
+		else if (getName == nullptr)
 		{
 			std::cerr << "Error: Missing filename" << std::endl;
-			std::cout << "Usage: " << argv[0] << " <ip_address> <filename>" << std::endl;
+			std::cout << "Usage: " << argv[0] << " <ip_address> <filename> [impairments]" << std::endl;
+			std::cout << "Impairments: --latency ms --jitter ms --loss % --burst-enter % --burst-exit % --burst-loss %" << std::endl;
+			std::cout << "             --reorder % --reorder-delay ms --duplicate % --rate kbps --queue bytes --impair-ingress" << std::endl;
+			std::cout << "Simulation:  " << argv[0] << " --simulate <pairs> [--duration s] [--tick ms] [--seed n] [--trace file.csv] [impairments]" << std::endl;
+			std::cout << "Load test:   " << argv[0] << " --bench <sessions> [--duration s] [--target-mbps per session] [impairments]" << std::endl;
+			std::cout << "Download:    " << argv[0] << " <ip_address> --get <filename> [--range first-last]... [--paths n] [--local ip]... [--source ip[:port]]... [--no-offload] [impairments]" << std::endl;
+			std::cout << "Serve:       " << argv[0] << " --serve <directory> [--port n] [--target-mbps per downloader] [--no-offload] [impairments]" << std::endl;
+			std::cout << "I/O engine:  --io-uring | --sqpoll  (Linux io_uring for the socket and file, sqpoll adds a kernel submission thread)" << std::endl;
+			std::cout << "Latency:     --low-latency [--pin cpu] [--busy-poll us]  (spin on the socket instead of sleeping, flush and ack every packet)" << std::endl;
+			std::cout << "Streaming:   --stream  (read the file while sending instead of loading it first; default from 64 MB)" << std::endl;
+			std::cout << "Coalescing:  --coalesce ms  (longest a small message waits to share a datagram, 0 sends each at once; default 2)" << std::endl;
+			std::cout << "Metrics:     --metrics-port port | --metrics-socket path  (Prometheus text, scrape /metrics)" << std::endl;
 			return EXIT_FAILURE;
 		}
 	}
@@ -191,7 +610,118 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	ImpairedSocket impairedSocket(impairment, impairIngress ? impairment : ImpairmentConfig());
+
+	// Optional io_uring engine for the socket and the file; it falls back to plain calls where unavailable
+	if (ioUring)
+	{
+		IoRing::Get().Start(IoRingEntries, sqpoll);
+	}
+	UringSocket uringSocket;
+
+	// Pull-based downloads: a server for a whole directory, or a client fetching one file by name
+	if ((mode == Server && serveRoot != nullptr) || (mode == Client && getName != nullptr))
+	{
+		DownloadConfig download;
+		download.protocolId = ProtocolId;
+		download.timeout = TimeOut;
+		download.bytesPerSecond = benchMbps * 1e6f / 8.0f;
+		download.compactHeader = UseCompactHeader;
+		download.ackEveryPackets = AckEveryPackets;
+		download.ackMaxDelay = AckMaxDelay;
+		download.offload = offload;
+		bool ok = false;
+		if (mode == Server)
+		{
+			DownloadServer server(download, serveRoot);
+			if (impairment.IsActive())
+			{
+				server.SetTransport(&impairedSocket);
+			}
+			else if (IoRing::Get().IsActive())
+			{
+				server.SetTransport(&uringSocket);
+			}
+			ok = server.Start((unsigned short)servePort);
+			if (ok)
+			{
+				server.Run();
+			}
+		}
+		else
+		{
+			Downloader downloader(download);
+			downloader.AddSource(address);
+			for (const Address& source : getSources)
+			{
+				downloader.AddSource(source);
+			}
+			downloader.SetImpairment(impairment, impairIngress ? impairment : ImpairmentConfig());
+			// one path per local interface, or --paths source ports on any interface
+			for (unsigned int local : getLocals)
+			{
+				downloader.AddPath(local);
+			}
+			for (int i = (int)getLocals.size(); i < getPaths; i++)
+			{
+				downloader.AddPath();
+			}
+			for (const std::pair<unsigned long long, unsigned long long>& range : getRanges)
+			{
+				downloader.AddRange(range.first, range.second);
+			}
+			ok = downloader.Run(getName);
+		}
+		Logger::Get().Flush();
+		ShutdownSockets();
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
 	ReliableConnection connection(ProtocolId, TimeOut);
+	if (impairment.IsActive())
+	{
+		printf("network impairment enabled%s\n", impairIngress ? " in both directions" : "");
+		connection.SetTransport(&impairedSocket);
+	}
+	else if (IoRing::Get().IsActive())
+	{
+		connection.SetTransport(&uringSocket);
+	}
+	connection.SetAckFrequency(AckEveryPackets, AckMaxDelay);
+	connection.SetCompactHeader(UseCompactHeader);
+
+	// Latency mode: the loop spins on the socket between departures instead of sleeping, and every
+	// packet and ack leaves as soon as it is ready
+	BusyPoller poller;
+	if (lowLatency)
+	{
+		connection.SetImmediate(true);
+		connection.SetAckFrequency(1, 0.0f);
+		coalesceDeadline = 0.0f;
+		if (pinCpu >= 0 && !pin_thread(pinCpu))
+		{
+			printf("could not pin to cpu %d\n", pinCpu);
+		}
+	}
+
+	// Optional local exporter for dashboards; it reads the metrics from its own thread
+	ConnectionMetrics& metrics = connection.GetReliabilitySystem().GetMetrics();
+	MetricsExporter exporter;
+	bool exporting = false;
+	if (metricsPort > 0)
+	{
+		exporting = exporter.Start((unsigned short)metricsPort);
+	}
+#if PLATFORM != PLATFORM_WINDOWS
+	else if (metricsSocket != nullptr)
+	{
+		exporting = exporter.Start(metricsSocket);
+	}
+#endif
+	if (exporting)
+	{
+		exporter.Add(mode == Server ? "server" : "client", &metrics);
+	}
 
 	const int port = mode == Server ? ServerPort : ClientPort;
 
@@ -201,25 +731,116 @@ int main(int argc, char* argv[])
 		return 1;
 	}
 
+	if (lowLatency && busyPoll > 0 && !connection.SetBusyPoll(busyPoll, true))
+	{
+		printf("busy polling unavailable, spinning in user space only\n");
+	}
+
 	if (mode == Client)
 		connection.Connect(address);
 	else
 		connection.Listen();
 
+	// A1: Breaking the file in pieces to send, before the handshake so the meta rides in the first datagram
+	FileSlices fileSlices;
+	bool fileLoaded = false;
+	std::unique_ptr<SliceReadAhead> readAhead;
+	if (mode == Client)
+	{
+		// A large file stays on disk, a reader thread keeps its next slices ready for the send loop
+		std::error_code sizeError;
+		const bool streamed = streamFile || std::filesystem::file_size(filename, sizeError) >= StreamFileSize;
+		fileLoaded = fileSlices.Load(filename, streamed);
+		if (fileLoaded && streamed)
+		{
+			readAhead = std::make_unique<SliceReadAhead>();
+			if (!readAhead->Start(fileSlices))
+			{
+				readAhead.reset();
+			}
+		}
+	}
+
 	bool connected = false;
-	float sendAccumulator = 0.0f;
+	// The client's first flight leaves back to back, the meta and an initial window's worth of packets;
+	//  + the chunk list after it is paced like any other data, a large file's list would overrun the receiver
+	Pacer pacer(0.0f, mode == Client ? (1 + InitialWindow) * PacketSize : PacketSize);
+	float pacedRate = 0.0f;
+	unsigned long long frameStart = net::time_now_ns();
 	float statsAccumulator = 0.0f;
 
 	auto transferStartTime = std::chrono::high_resolution_clock::now();
 	bool transferStarted = false;
-	bool transferDone = false;
 
 	FlowControl flowControl;
 
-	FileSlices fileSlices;
-	bool fileLoaded = false;
+	// Small messages, the keep-alives above all, share datagrams for up to the coalescing deadline
+	MessageCoalescer coalescer(connection, coalesceDeadline, PacketSize);
+
 	bool done = false;
 
+	// The server keeps every chunk it receives so later files sharing content are not sent again
+	ChunkStore chunkStore;
+	std::vector<PacketChunkHave> lastHave;
+	int haveRounds = 0;
+
+	// The server lists the slices it is missing, the client fills those gaps before sending new ones
+	PacketRanges nack = { 0 };                  // client: the latest ranges asked for
+	size_t nackRange = 0;                       // client: range being sent again
+	uint64_t nackNext = 0;                      // client: next slice of it
+	size_t nackLimit = 0;                       // client: slices sent once when it arrived, SIZE_MAX until known
+	std::vector<unsigned long long> resentAt;   // client: when each slice was last sent again
+	int resent = 0;                             // client: slices sent again
+	bool allSent = false;                       // client: every needed slice went once
+	bool serverComplete = false;                // client: the server holds the whole file
+	unsigned long long lingerUntil = 0;         // client: stop waiting for a NACK after this
+	unsigned long long nextNack = 0;            // server: when the next NACK or completion notice is due
+	unsigned long long lastSlice = 0;           // server: when a new slice last arrived
+	int completeRounds = 0;                     // server: completion notices still to send
+
+	// Next slice of the latest NACK that the server cannot rebuild, or the total once there is none
+	//  + slices the first pass had not reached when the NACK arrived are left to it
+	//  + a slice sent again within the last round trip may still be on its way, a newer NACK cannot know yet
+	auto nextResend = [&](size_t sent) -> size_t
+	{
+		const unsigned long long now = net::time_now_ns();
+		const float holdOff = std::max(NackInterval, 2.0f * connection.GetReliabilitySystem().GetRoundTripTime());
+		resentAt.resize(fileSlices.GetTotal(), 0);
+		if (nackLimit == SIZE_MAX)
+		{
+			nackLimit = sent;
+		}
+		while (nackRange < nack.count && nackRange < RANGES_PER_PACKET)
+		{
+			const SliceRange& range = nack.ranges[nackRange];
+			nackNext = std::max(nackNext, range.first);
+			if (nackNext >= nackLimit)
+			{
+				break;
+			}
+			if (nackNext >= range.first + range.count)
+			{
+				nackRange++;
+				continue;
+			}
+			const size_t id = (size_t)nackNext++;
+			if (fileSlices.IsSliceNeeded(id) && (resentAt[id] == 0 || now - resentAt[id] >= (unsigned long long)(holdOff * 1000000000.0f)))
+			{
+				resentAt[id] = now;
+				return id;
+			}
+		}
+		return fileSlices.GetTotal();
+	};
+	if (mode == Server)
+	{
+		if (chunkStore.Open(ChunkStoreDir))
+		{
+			printf("chunk store %s holds %d chunks\n", ChunkStoreDir, (int)chunkStore.GetCount());
+			fileSlices.SetChunkStore(&chunkStore);
+		}
+	}
+
 	while (!done)
 	{
 		// update flow control
@@ -235,6 +856,7 @@ int main(int argc, char* argv[])
 		{
 			flowControl.Reset();
 			printf("reset flow control\n");
+			lastHave.clear();
 			connected = false;
 		}
 
@@ -242,12 +864,6 @@ int main(int argc, char* argv[])
 		{
 			printf("client connected to server\n");
 			connected = true;
-			
-			// A1: Breaking the file in pieces to send
-			if (mode == Client)
-			{
-				fileLoaded = fileSlices.Load(filename);
-			}
 		}
 
 		if (!connected && connection.ConnectFailed())
@@ -257,92 +873,323 @@ int main(int argc, char* argv[])
 		}
 		
 		// send and receive packets
+		//  + departures are paced evenly across the frame instead of leaving in one burst
 
-		sendAccumulator += DeltaTime;
+		if (sendRate != pacedRate)
+		{
+			pacer.SetRate(sendRate * PacketSize);
+#ifdef KERNEL_PACING
+			connection.SetPacingRate((unsigned int)(sendRate * (PacketSize + connection.GetHeaderSize())));
+#endif
+			pacedRate = sendRate;
+			ConnectionMetrics::Set(metrics.pacing_rate, (unsigned long long)(sendRate * PacketSize));
+		}
+		// not a congestion window, the flow control has none: what the pacer sends over one round trip
+		ConnectionMetrics::Set(metrics.pacing_window, (unsigned long long)(sendRate * PacketSize * connection.GetReliabilitySystem().GetRoundTripTime()));
+
+		const unsigned long long frameEnd = frameStart + (unsigned long long)(DeltaTime * 1000000000.0f);
 
-		while (sendAccumulator > 1.0f / sendRate)
+		while (true)
 		{
-			// A1: Sending the pieces
-			unsigned char packet[PacketSize];
-			memset(packet, 0, sizeof(packet));
-			static int n = 0;
-			//sprintf_s((char*)packet, PacketSize, "Hello World %d\n", ++n);
-			if (mode == Client && fileLoaded)
+			while (!done && pacer.TryConsume(PacketSize))
 			{
-				// A1: Sending file metadata
-				static bool metaSent = false;
-				if (metaSent == false)
-				{
-					std::cout << std::format("Sending {}, {} bytes, {} in total slices.\n", fileSlices.GetMeta()->filename, fileSlices.GetMeta()->fileSize, fileSlices.GetMeta()->totalSlices);
-					memcpy(packet, fileSlices.GetMeta(), PacketSize);
-					metaSent = true;
-				}
-				else
+				// A1: Sending the pieces
+				unsigned char packet[PacketSize];
+				memset(packet, 0, sizeof(packet));
+				static size_t n = 0;
+				// Most of the time the server has nothing of its own to send, its acks go out as ack-only frames
+				bool hasPayload = mode == Client;
+				// With nothing else to say the client sends a one byte keep-alive
+				packet[0] = TYPE_KEEPALIVE;
+				int packetBytes = 1;
+				//sprintf_s((char*)packet, PacketSize, "Hello World %d\n", ++n);
+				if (mode == Client && fileLoaded)
 				{
-					if (n < fileSlices.GetTotal())
+					// A1: Sending file metadata
+					static bool metaSent = false;
+					static size_t chunkIndex = 0;
+					static bool haveDone = false;
+					static float haveWait = 0.0f;
+					static int chunkRounds = 1;
+					if (metaSent == false)
+					{
+						NET_INFO("Sending %s, %llu bytes, %llu in total slices.", fileSlices.GetMeta()->filename,
+							(unsigned long long)fileSlices.GetMeta()->fileSize, (unsigned long long)fileSlices.GetMeta()->totalSlices);
+						memcpy(packet, fileSlices.GetMeta(), PacketSize);
+						packetBytes = PacketSize;
+						metaSent = true;
+					}
+					// Describe the file as chunks so the server can tell which ones it already holds
+					else if (chunkIndex < fileSlices.GetChunkCount())
+					{
+						chunkIndex += fileSlices.GetChunkList(chunkIndex, reinterpret_cast<PacketChunkList*>(packet));
+						packetBytes = PacketSize;
+					}
+					// The initial window goes out without waiting for the server's chunk report
+					else if (!haveDone && n >= InitialWindow && !fileSlices.IsHaveComplete() && haveWait <= HaveTimeOut)
+					{
+						haveWait += 1.0f / sendRate;
+					}
+					// No report in time: part of the list may have been lost, so it goes again from the start
+					else if (!haveDone && n >= InitialWindow && !fileSlices.IsHaveComplete() && chunkRounds < ChunkListRounds)
 					{
-						std::cout << std::format("Sending {}/{}\n", fileSlices.GetSlice(n)->id + 1, fileSlices.GetMeta()->totalSlices);
-						memcpy(packet, fileSlices.GetSlice(n++), PacketSize);
+						chunkRounds++;
+						haveWait = 0.0f;
+						ConnectionMetrics::Add(metrics.retransmits);
+						chunkIndex = fileSlices.GetChunkList(0, reinterpret_cast<PacketChunkList*>(packet));
+						packetBytes = PacketSize;
+					}
+					else
+					{
+						if (!haveDone && (fileSlices.IsHaveComplete() || haveWait > HaveTimeOut))
+						{
+							size_t needed = fileSlices.ResolveNeeded();
+							printf("server reported %s after %d slices, %d of %d slices needed\n",
+								fileSlices.IsHaveComplete() ? "its chunks" : "nothing in time",
+								(int)n, (int)needed, (int)fileSlices.GetTotal());
+							pacer.SetBurst(PacketSize);
+							haveDone = true;
+						}
+
+						// Slices the server can rebuild from its chunk store are skipped
+						while (n < fileSlices.GetTotal() && !fileSlices.IsSliceNeeded(n))
+						{
+							n++;
+						}
+
+						if (!allSent && n >= fileSlices.GetTotal())
+						{
+							allSent = true;
+							lingerUntil = net::time_now_ns() + (unsigned long long)(LingerTimeOut * 1000000000.0f);
+						}
+
+						// Gaps the server reported go before new slices
+						const size_t resend = nextResend(n);
+						if (resend < fileSlices.GetTotal())
+						{
+							packetBytes = (int)fileSlices.EncodeSlice(resend, packet);
+							resent++;
+							ConnectionMetrics::Add(metrics.retransmits);
+						}
+						else if (n < fileSlices.GetTotal())
+						{
+							// a streamed slice the reader has not reached yet waits for the next send, not for the disk
+							const int taken = readAhead ? readAhead->Take(n, packet) : -1;
+							if (taken != 0)
+							{
+								// per-slice progress would throttle the send loop, so report it at most twice a second
+								NET_LOG_EVERY(0.5f, LogInfo, "Sending %llu/%llu", (unsigned long long)n + 1,
+									(unsigned long long)fileSlices.GetMeta()->totalSlices);
+								packetBytes = taken > 0 ? taken : (int)fileSlices.EncodeSlice(n, packet);
+								n++;
 #ifdef MD5_TEST
-						packet[200] = 33;
+								packet[200] = 33;
 #endif
+							}
+							else
+							{
+								// nothing goes out for the spent tokens, the next try waits for the pacer's next packet
+								hasPayload = false;
+								break;
+							}
+						}
+						// Everything went once, wait for the server to report gaps or completion
+						else if (serverComplete || net::time_now_ns() >= lingerUntil)
+						{
+							NET_INFO("Sent file: %s, %d slices sent again", filename, resent);
+							if (readAhead)
+							{
+								NET_INFO("Read ahead %llu slices, %llu deep at the end, the send loop waited %llu times",
+									readAhead->GetTaken(), (unsigned long long)readAhead->GetDepth(), readAhead->GetStalls());
+								readAhead->Stop();
+							}
+							done = true;
+						}
 					}
-					else
+				}
+				else if (mode == Server)
+				{
+					// Keep answering the chunk query, including for a transfer that completed from the store alone
+					static size_t haveIndex = 0;
+					PacketChunkHave* have = reinterpret_cast<PacketChunkHave*>(packet);
+					const unsigned long long now = net::time_now_ns();
+					// ask again for what is missing at most every couple of round trips, so resent slices can land first
+					const float nackInterval = std::max(NackInterval, 2.0f * connection.GetReliabilitySystem().GetRoundTripTime());
+					const bool nackDue = now >= nextNack;
+					// a quiet sender may have lost the tail of the file, so the whole rest is asked for then
+					const bool tail = now - lastSlice > (unsigned long long)(2.0f * nackInterval * 1000000000.0f);
+					if (nackDue && completeRounds > 0)
+					{
+						PacketRanges* complete = reinterpret_cast<PacketRanges*>(packet);
+						complete->typeFlag = TYPE_RANGES;
+						complete->flags = RANGES_COMPLETE;
+						completeRounds--;
+						nextNack = now + (unsigned long long)(nackInterval * 1000000000.0f);
+						packetBytes = PacketSize;
+						hasPayload = true;
+					}
+					// the report goes before the NACK, at a low rate a NACK is due every time and would starve it
+					else if (fileSlices.IsResolved() && fileSlices.GetChunkCount() > 0 && haveRounds < HaveRounds)
 					{
-						std::cout << std::format("Sent file: {}\n", filename);
-						done = true;
+						if (fileSlices.GetHave(haveIndex, have) == 0)
+						{
+							haveIndex = 0;
+							fileSlices.GetHave(haveIndex, have);
+							haveRounds++;
+						}
+						haveIndex += HAVE_PER_PACKET;
+						packetBytes = PacketSize;
+						hasPayload = true;
+					}
+					else if (nackDue && fileSlices.GetTotal() > 0 && !fileSlices.IsReady() &&
+						fileSlices.GetMissing(reinterpret_cast<PacketRanges*>(packet), tail) > 0)
+					{
+						nextNack = now + (unsigned long long)(nackInterval * 1000000000.0f);
+						packetBytes = PacketSize;
+						hasPayload = true;
+					}
+					else if (!fileSlices.IsResolved() && !lastHave.empty())
+					{
+						haveIndex = haveIndex / HAVE_PER_PACKET % lastHave.size();
+						memcpy(packet, &lastHave[haveIndex], PacketSize);
+						haveIndex = (haveIndex + 1) * HAVE_PER_PACKET;
+						packetBytes = PacketSize;
+						hasPayload = true;
 					}
 				}
+				if (hasPayload)
+				{
+					coalescer.Send(packet, packetBytes);
+				}
 			}
-			connection.SendPacket(packet, sizeof(packet));
-			sendAccumulator -= 1.0f / sendRate;
-		}
-
-		while (true)
-		{
-			unsigned char packet[256];
-
-			int bytes_read = connection.ReceivePacket(packet, sizeof(packet));
+			coalescer.Poll();
 
-			if (bytes_read == 0)
-				break;
-			//printf("%s", packet);
-			if (mode == Server)
+			// A datagram holds one message, or a batch of small ones the sender coalesced
+			auto handle = [&](const unsigned char* packet, int bytes_read)
 			{
-				if (!fileSlices.IsReady())
+				if (mode == Client)
 				{
-					printf("Receiving!\n");
-					bool gotSlice = fileSlices.Deserialize(packet);
-
-					// Record the start time of receiving
-					if (!transferStarted && gotSlice) {
-						transferStartTime = std::chrono::high_resolution_clock::now();
-						transferStarted = true;
+					if (packet[0] == TYPE_HAVE && bytes_read >= (int)sizeof(PacketChunkHave))
+					{
+						fileSlices.ApplyHave(reinterpret_cast<const PacketChunkHave*>(packet));
+					}
+					else if (packet[0] == TYPE_RANGES && bytes_read >= (int)sizeof(PacketRanges))
+					{
+						const PacketRanges* ranges = reinterpret_cast<const PacketRanges*>(packet);
+						if (ranges->flags & RANGES_COMPLETE)
+						{
+							serverComplete = true;
+						}
+						else
+						{
+							nack = *ranges;
+							nackRange = 0;
+							nackNext = 0;
+							nackLimit = SIZE_MAX;
+						}
+						lingerUntil = net::time_now_ns() + (unsigned long long)(LingerTimeOut * 1000000000.0f);
 					}
 				}
-				else
+				else if (mode == Server)
 				{
-					// A1: Verifying the file integrity
-					if (fileSlices.Verify())
+					if (!fileSlices.IsReady())
 					{
-						auto transferEndTime = std::chrono::high_resolution_clock::now();
-						auto transferDuration = std::chrono::duration_cast<std::chrono::milliseconds>(transferEndTime - transferStartTime);
+						NET_TRACE("Receiving!");
+						if (packet[0] == TYPE_META)
+						{
+							lastHave.clear();
+							haveRounds = 0;
+							lastSlice = net::time_now_ns();
+						}
+						// the chunk list coming again means the client missed the report, so it goes again too
+						else if (packet[0] == TYPE_CHUNKS && fileSlices.IsResolved())
+						{
+							haveRounds = 0;
+						}
+						const size_t held = fileSlices.GetHeldCount();
+						bool gotSlice = fileSlices.Deserialize(packet, bytes_read);
+						if (fileSlices.GetHeldCount() != held)
+						{
+							lastSlice = net::time_now_ns();
+						}
+
+						// Record the start time of receiving
+						if (!transferStarted && gotSlice) {
+							transferStartTime = std::chrono::high_resolution_clock::now();
+							transferStarted = true;
+						}
+					}
+					else
+					{
+						// A1: Verifying the file integrity
+						if (fileSlices.Verify())
+						{
+							auto transferEndTime = std::chrono::high_resolution_clock::now();
+							auto transferDuration = std::chrono::duration_cast<std::chrono::milliseconds>(transferEndTime - transferStartTime);
+
+							double transferSeconds = transferDuration.count() / 1000.0;
+							// Calculate file size in bits
+							double fileBits = fileSlices.GetMeta()->fileSize * 8.0;
+							// Calculate transfer speed megabits per second
+							double transferSpeedMbps = (fileBits / 1000000.0) / transferSeconds;
+
+							printf("Transfer completed!\n");
+							completeRounds = CompleteRounds;
+							nextNack = 0;
+							printf("Time taken: %.3f seconds\n", transferSeconds);
+							printf("Speed: %.2f Mbps\n", transferSpeedMbps);
+
+							fileSlices.Save();
+
+							size_t added = fileSlices.StoreChunks();
+							printf("Stored %d new chunks\n", (int)added);
+
+							lastHave.clear();
+							for (size_t first = 0; first < fileSlices.GetChunkCount(); first += HAVE_PER_PACKET)
+							{
+								lastHave.emplace_back();
+								fileSlices.GetHave(first, &lastHave.back());
+							}
+						}
+
+						fileSlices.Reset();
+					}
+				}
+			};
 
-						double transferSeconds = transferDuration.count() / 1000.0;
-						// Calculate file size in bits
-						double fileBits = fileSlices.GetMeta()->fileSize * 8.0;
-						// Calculate transfer speed megabits per second
-						double transferSpeedMbps = (fileBits / 1000000.0) / transferSeconds;
+			bool received = false;
+			while (true)
+			{
+				unsigned char packet[256];
 
-						printf("Transfer completed!\n");
-						printf("Time taken: %.3f seconds\n", transferSeconds);
-						printf("Speed: %.2f Mbps\n", transferSpeedMbps);
+				int bytes_read = connection.ReceivePacket(packet, sizeof(packet));
 
-						fileSlices.Save();
-					}
+				if (bytes_read == 0)
+					break;
+				received = true;
+				//printf("%s", packet);
+				MessageCoalescer::Split(packet, bytes_read, handle);
+			}
 
-					fileSlices.Reset();
-				}
+			if (done)
+				coalescer.Flush();
+			if (done || net::time_now_ns() >= frameEnd)
+				break;
+
+			if (!lowLatency)
+			{
+				// wake in time for the waiting batch as well
+				const unsigned long long flush = coalescer.GetNextFlush();
+				pacer.WaitUntil(PacketSize, flush < frameEnd ? flush : frameEnd);
+			}
+			else if (received)
+			{
+				poller.Ready();
+			}
+			else
+			{
+				const unsigned long long departure = pacer.NextDeparture(PacketSize);
+				poller.Idle(connection, departure < frameEnd ? departure : frameEnd);
 			}
 		}
 
@@ -372,6 +1219,9 @@ int main(int argc, char* argv[])
 		while (statsAccumulator >= 0.25f && connection.IsConnected())
 		{
 			float rtt = connection.GetReliabilitySystem().GetRoundTripTime();
+			float rttvar = connection.GetReliabilitySystem().GetRoundTripTimeVariance();
+			float min_rtt = connection.GetReliabilitySystem().GetMinimumRoundTripTime();
+			float rto = connection.GetReliabilitySystem().GetRetransmissionTimeout();
 
 			unsigned int sent_packets = connection.GetReliabilitySystem().GetSentPackets();
 			unsigned int acked_packets = connection.GetReliabilitySystem().GetAckedPackets();
@@ -380,19 +1230,29 @@ int main(int argc, char* argv[])
 			float sent_bandwidth = connection.GetReliabilitySystem().GetSentBandwidth();
 			float acked_bandwidth = connection.GetReliabilitySystem().GetAckedBandwidth();
 
-			printf("rtt %.1fms, sent %d, acked %d, lost %d (%.1f%%), sent bandwidth = %.1fkbps, acked bandwidth = %.1fkbps\n",
-				rtt * 1000.0f, sent_packets, acked_packets, lost_packets,
+			MetricsSnapshot snapshot;
+			metrics.Read(snapshot);
+
+			printf("rtt %.1fms (var %.1fms, min %.1fms, rto %.1fms, p50 %.1fms, p99 %.1fms, jitter p50 %.1fms), sent %d, acked %d, lost %d (%.1f%%), dup %llu, sent bandwidth = %.1fkbps, acked bandwidth = %.1fkbps\n",
+				rtt * 1000.0f, rttvar * 1000.0f, min_rtt * 1000.0f, rto * 1000.0f,
+				snapshot.rtt.Percentile(0.5) * 1000.0f, snapshot.rtt.Percentile(0.99) * 1000.0f, snapshot.jitter.Percentile(0.5) * 1000.0f,
+				sent_packets, acked_packets, lost_packets,
 				sent_packets > 0.0f ? (float)lost_packets / (float)sent_packets * 100.0f : 0.0f,
-				sent_bandwidth, acked_bandwidth);
+				snapshot.duplicates, sent_bandwidth, acked_bandwidth);
 
 			statsAccumulator -= 0.25f;
 		}
 
 		
 
-		net::wait(DeltaTime);
+		// keep a fixed frame cadence, but do not try to catch up after a stall
+
+		frameStart = frameEnd;
+		if (net::time_now_ns() > frameStart)
+			frameStart = net::time_now_ns();
 	}
 
+	exporter.Stop();
 	ShutdownSockets();
 
 	return 0;
@@ -0,0 +1,241 @@
+/*
+* FILE : Scheduler.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides the scheduler that decides which of several streams
+*   sharing a connection sends next. Streams sit on strict priority levels:
+*   a level is only served when every level before it has nothing to send.
+*   Within a level the streams share what the send budget allows in
+*   proportion to their weights, by deficit round robin, so a stream with
+*   small messages gets its share even next to one with large messages.
+*   The budget itself stays with the caller, who stops picking once flow
+*   or congestion control has nothing left for this tick.
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+/*
+ * Class : SendScheduler
+ * Description :
+ *   Picks the stream whose next message goes out, by strict priority
+ *   between levels and weighted fair share within a level.
+ */
+class SendScheduler
+{
+public:
+	static const int Quantum = 256;         // bytes a stream of weight 1 may send per round
+
+	/*
+	 * Function : AddStream
+	 * Description :
+	 *   Adds a stream. Streams are numbered in the order they are added.
+	 * Parameters :
+	 *   int priority - Its level, lower levels are served first.
+	 *   int weight - Its share of the level's sends, at least 1.
+	 * Return :
+	 *   int - The stream's index.
+	 */
+	int AddStream(int priority = 0, int weight = 1)
+	{
+		m_streams.emplace_back();
+		const int stream = (int)m_streams.size() - 1;
+		Place(stream, priority, weight);
+		return stream;
+	}
+
+	/*
+	 * Function : SetStream
+	 * Description :
+	 *   Moves a stream to another level or changes its weight. What it had
+	 *   saved up in its current round is dropped.
+	 * Parameters :
+	 *   int stream - The stream.
+	 *   int priority - Its new level.
+	 *   int weight - Its new weight, at least 1.
+	 * Return :
+	 *   void
+	 */
+	void SetStream(int stream, int priority, int weight)
+	{
+		Level& level = *FindLevel(m_streams[stream].priority);
+		level.members.erase(std::find(level.members.begin(), level.members.end(), stream));
+		level.next = 0;
+		level.granted = false;
+		if (level.members.empty())
+		{
+			m_levels.erase(m_levels.begin() + (&level - m_levels.data()));
+		}
+		m_streams[stream].deficit = 0;
+		Place(stream, priority, weight);
+	}
+
+	/*
+	 * Function : Pick
+	 * Description :
+	 *   Chooses the stream that sends next and charges it for its message.
+	 *   The first level with anything to send is served, taking its streams
+	 *   in turn; each turn adds weight * Quantum bytes to a stream's
+	 *   allowance and the stream keeps sending while its next message fits
+	 *   in it. A stream that runs dry loses what it saved.
+	 * Parameters :
+	 *   HeadSize&& headSize - Called as headSize(int stream), returns the
+	 *   size of the stream's next message or 0 when it has none. It is
+	 *   called more than once per Pick, so it should be cheap.
+	 * Return :
+	 *   int - The stream to send from, or -1 when none has anything.
+	 */
+	template<typename HeadSize>
+	int Pick(HeadSize&& headSize)
+	{
+		for (Level& level : m_levels)
+		{
+			bool waiting = false;
+			for (int stream : level.members)
+			{
+				if (headSize(stream) > 0)
+				{
+					waiting = true;
+				}
+				else
+				{
+					m_streams[stream].deficit = 0;
+				}
+			}
+			if (!waiting)
+			{
+				continue;
+			}
+			// deficits only grow while a stream waits, so this ends within a few rounds
+			while (true)
+			{
+				const int stream = level.members[level.next];
+				Stream& entry = m_streams[stream];
+				const int size = headSize(stream);
+				if (size > 0)
+				{
+					if (!level.granted)
+					{
+						entry.deficit += entry.weight * Quantum;
+						level.granted = true;
+					}
+					if (entry.deficit >= size)
+					{
+						entry.deficit -= size;
+						entry.bytes += size;
+						return stream;
+					}
+				}
+				level.next = (level.next + 1) % level.members.size();
+				level.granted = false;
+			}
+		}
+		return -1;
+	}
+
+	/*
+	 * Function : Unpick
+	 * Description :
+	 *   Gives back the charge of a pick whose message could not be sent
+	 *   after all, because the budget ran out.
+	 * Parameters :
+	 *   int stream - The stream picked.
+	 *   int bytes - The size it was charged.
+	 * Return :
+	 *   void
+	 */
+	void Unpick(int stream, int bytes)
+	{
+		m_streams[stream].deficit += bytes;
+		m_streams[stream].bytes -= bytes;
+	}
+
+	/*
+	 * Function : GetSentBytes
+	 * Description :
+	 *   Returns how many bytes a stream has been picked for.
+	 * Parameters :
+	 *   int stream - The stream.
+	 * Return :
+	 *   unsigned long long - The number of bytes.
+	 */
+	unsigned long long GetSentBytes(int stream) const
+	{
+		return m_streams[stream].bytes;
+	}
+
+	/*
+	 * Function : Reset
+	 * Description :
+	 *   Forgets every stream's allowance and byte count, keeping the streams.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   void
+	 */
+	void Reset()
+	{
+		for (Stream& stream : m_streams)
+		{
+			stream.deficit = 0;
+			stream.bytes = 0;
+		}
+		for (Level& level : m_levels)
+		{
+			level.next = 0;
+			level.granted = false;
+		}
+	}
+
+private:
+	struct Stream
+	{
+		int priority = 0;
+		int weight = 1;
+		int deficit = 0;                    // bytes it may still send this round
+		unsigned long long bytes = 0;
+	};
+
+	struct Level
+	{
+		int priority = 0;
+		std::vector<int> members;           // streams, in turn order
+		size_t next = 0;                    // whose turn it is
+		bool granted = false;               // whether that stream has had its quantum this turn
+	};
+
+	Level* FindLevel(int priority)
+	{
+		for (Level& level : m_levels)
+		{
+			if (level.priority == priority)
+			{
+				return &level;
+			}
+		}
+		return nullptr;
+	}
+
+	void Place(int stream, int priority, int weight)
+	{
+		m_streams[stream].priority = priority;
+		m_streams[stream].weight = std::max(weight, 1);
+		Level* level = FindLevel(priority);
+		if (level == nullptr)
+		{
+			// levels stay sorted so Pick serves them in order
+			auto at = std::find_if(m_levels.begin(), m_levels.end(),
+				[priority](const Level& other) { return other.priority > priority; });
+			level = &*m_levels.insert(at, Level());
+			level->priority = priority;
+		}
+		level->members.push_back(stream);
+	}
+
+	std::vector<Stream> m_streams;
+	std::vector<Level> m_levels;            // by priority, lowest first
+};
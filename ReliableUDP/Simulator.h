@@ -0,0 +1,236 @@
+/*
+* FILE : Simulator.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides an in-memory datagram network driven by a virtual
+*   clock. `SimSocket` stands in for `net::Socket` underneath a
+*   `Connection`, and every datagram travels over an `ImpairedLink` whose
+*   release times are measured on the simulated clock rather than the wall
+*   clock. Nothing sleeps, so many connections can be run deterministically
+*   and much faster than real time from a single seed.
+*/
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <map>
+#include <deque>
+#include <queue>
+#include <utility>
+
+#include "Net.h"
+#include "NetEmulator.h"
+
+namespace net
+{
+	class SimSocket;
+
+	// the simulated network: a virtual clock, the open endpoints and one impaired link per direction
+
+	class SimNetwork
+	{
+	public:
+
+		SimNetwork( const ImpairmentConfig & link, unsigned int seed )
+		{
+			this->link = link;
+			this->seed = seed;
+			now = 0;
+			order = 0;
+		}
+
+		unsigned long long GetTime() const
+		{
+			return now;
+		}
+
+		// advance the virtual clock, moving every datagram released by then to its destination
+
+		void AdvanceTo( unsigned long long time );
+
+		// earliest pending release time, or ~0 when nothing is in flight
+
+		unsigned long long NextRelease() const
+		{
+			return events.empty() ? ~0ULL : events.top().datagram.release;
+		}
+
+		bool Bind( SimSocket * socket, unsigned short port );
+		void Unbind( unsigned short port );
+		void Submit( const Address & from, const Address & to, const void * data, int size );
+
+		static Address LocalAddress( unsigned short port )
+		{
+			return Address( 127, 0, 0, 1, port );
+		}
+
+	private:
+
+		typedef std::pair<Address, Address> Route;
+
+		ImpairedLink & GetLink( const Route & route )
+		{
+			std::map<Route, ImpairedLink>::iterator itor = links.find( route );
+			if ( itor == links.end() )
+			{
+				// each direction gets its own stream of random numbers, derived from the seed and the route
+				unsigned int route_seed = seed * 2654435761u ^ ( route.first.GetPort() * 40503u ) ^ ( route.second.GetPort() << 16 );
+				itor = links.insert( std::make_pair( route, ImpairedLink() ) ).first;
+				itor->second.Reset( link, route_seed );
+			}
+			return itor->second;
+		}
+
+		// a datagram in flight, addressed to the port it will be delivered to
+
+		struct Event
+		{
+			unsigned short port;
+			ImpairedLink::Datagram datagram;
+
+			bool operator > ( const Event & other ) const
+			{
+				return datagram > other.datagram;
+			}
+		};
+
+		ImpairmentConfig link;
+		unsigned int seed;
+		unsigned long long now;						// virtual time in nanoseconds
+		unsigned long long order;					// global send order, breaks ties between links
+		std::map<unsigned short, SimSocket*> sockets;
+		std::map<Route, ImpairedLink> links;		// loss, bandwidth and delay decisions per direction
+		std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+	};
+
+	// socket bound to a simulated network instead of the operating system
+
+	class SimSocket : public Socket
+	{
+	public:
+
+		SimSocket( SimNetwork & network ) : network( network )
+		{
+			port = 0;
+		}
+
+		~SimSocket()
+		{
+			Close();
+		}
+
+		bool Open( unsigned short port )
+		{
+			assert( !IsOpen() );
+			if ( !network.Bind( this, port ) )
+				return false;
+			this->port = port;
+			return true;
+		}
+
+		void Close()
+		{
+			if ( port != 0 )
+			{
+				network.Unbind( port );
+				port = 0;
+			}
+			inbox.clear();
+		}
+
+		bool IsOpen() const
+		{
+			return port != 0;
+		}
+
+		bool Send( const Address & destination, const void * data, int size )
+		{
+			assert( data );
+			assert( size > 0 );
+			if ( !IsOpen() )
+				return false;
+			network.Submit( SimNetwork::LocalAddress( port ), destination, data, size );
+			return true;
+		}
+
+		int Receive( Address & sender, void * data, int size )
+		{
+			if ( inbox.empty() )
+				return 0;
+			ImpairedLink::Datagram & datagram = inbox.front();
+			const int length = (int) datagram.data.size() < size ? (int) datagram.data.size() : size;
+			memcpy( data, datagram.data.data(), length );
+			sender = datagram.address;
+			inbox.pop_front();
+			return length;
+		}
+
+		bool SetPacingRate( unsigned int bytesPerSecond )
+		{
+			return false;
+		}
+
+		bool HasPending() const
+		{
+			return !inbox.empty();
+		}
+
+		void Deliver( ImpairedLink::Datagram & datagram )
+		{
+			inbox.push_back( std::move( datagram ) );
+		}
+
+	private:
+
+		SimNetwork & network;
+		unsigned short port;
+		std::deque<ImpairedLink::Datagram> inbox;
+	};
+
+	inline bool SimNetwork::Bind( SimSocket * socket, unsigned short port )
+	{
+		if ( port == 0 || sockets.count( port ) )
+			return false;
+		sockets[port] = socket;
+		return true;
+	}
+
+	inline void SimNetwork::Unbind( unsigned short port )
+	{
+		sockets.erase( port );
+	}
+
+	inline void SimNetwork::Submit( const Address & from, const Address & to, const void * data, int size )
+	{
+		// the route's link decides fate and release time (and records the sender the receiver will see),
+		// then its output joins the single network wide event queue
+		ImpairedLink & route = GetLink( Route( from, to ) );
+		route.Submit( from, data, size, now );
+		Event event;
+		event.port = to.GetPort();
+		while ( route.Pop( ~0ULL, event.datagram ) )
+		{
+			event.datagram.order = order++;
+			events.push( event );
+		}
+	}
+
+	inline void SimNetwork::AdvanceTo( unsigned long long time )
+	{
+		assert( time >= now );
+		now = time;
+		while ( !events.empty() && events.top().datagram.release <= now )
+		{
+			Event event = events.top();
+			events.pop();
+			// datagrams to a closed port vanish, as they would on a real network
+			std::map<unsigned short, SimSocket*>::iterator destination = sockets.find( event.port );
+			if ( destination != sockets.end() )
+				destination->second->Deliver( event.datagram );
+		}
+	}
+}
+
+#endif
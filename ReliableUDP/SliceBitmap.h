@@ -0,0 +1,218 @@
+/*
+* FILE : SliceBitmap.h
+* PROJECT : SENG2040 - ASSIGNMENT 1
+* PROGRAMMER : Tian Yang, 8952896
+* FIRST VERSION : 2026-10-19
+* DESCRIPTION :
+*   This file provides the bitmap a receiver keeps of the slices it holds.
+*   Bits are packed 64 to a word, so counting them is a popcount per word
+*   and finding the next missing slice skips 64 slices held at a time,
+*   which is what listing the gaps of a large file for a NACK needs.
+*/
+
+#pragma once
+
+#include <vector>
+#include <bit>
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Class : SliceBitmap
+ * Description :
+ *   One bit per slice of a file, set once the slice is held.
+ */
+class SliceBitmap
+{
+public:
+	/*
+	 * Function : Reset
+	 * Description :
+	 *   Clears the bitmap and sizes it for a file, keeping its storage.
+	 * Parameters :
+	 *   size_t size - The number of slices.
+	 * Return :
+	 *   void
+	 */
+	void Reset(size_t size)
+	{
+		m_words.assign((size + WordBits - 1) / WordBits, 0);
+		m_size = size;
+		m_count = 0;
+	}
+
+	/*
+	 * Function : Set
+	 * Description :
+	 *   Marks a slice as held.
+	 * Parameters :
+	 *   size_t id - The slice.
+	 * Return :
+	 *   bool - Returns true if the slice was not held before.
+	 */
+	bool Set(size_t id)
+	{
+		if (id >= m_size)
+		{
+			return false;
+		}
+		uint64_t& word = m_words[id / WordBits];
+		const uint64_t bit = 1ULL << (id % WordBits);
+		if (word & bit)
+		{
+			return false;
+		}
+		word |= bit;
+		m_count++;
+		return true;
+	}
+
+	/*
+	 * Function : Test
+	 * Description :
+	 *   Checks whether a slice is held.
+	 * Parameters :
+	 *   size_t id - The slice.
+	 * Return :
+	 *   bool - Returns true if it is, false if it is not or is out of range.
+	 */
+	bool Test(size_t id) const
+	{
+		return id < m_size && (m_words[id / WordBits] >> (id % WordBits) & 1) != 0;
+	}
+
+	/*
+	 * Function : Count
+	 * Description :
+	 *   Counts the slices held in [first, last), a popcount per word.
+	 * Parameters :
+	 *   size_t first - The first slice.
+	 *   size_t last - One past the last slice.
+	 * Return :
+	 *   size_t - The number of slices held.
+	 */
+	size_t Count(size_t first, size_t last) const
+	{
+		last = last < m_size ? last : m_size;
+		if (first >= last)
+		{
+			return 0;
+		}
+		size_t count = 0;
+		const size_t firstWord = first / WordBits;
+		const size_t lastWord = (last - 1) / WordBits;
+		for (size_t i = firstWord; i <= lastWord; i++)
+		{
+			uint64_t word = m_words[i];
+			if (i == firstWord)
+			{
+				word &= ~0ULL << (first % WordBits);
+			}
+			if (i == lastWord && last % WordBits != 0)
+			{
+				word &= ~0ULL >> (WordBits - last % WordBits);
+			}
+			count += std::popcount(word);
+		}
+		return count;
+	}
+
+	/*
+	 * Function : FindFirstZero
+	 * Description :
+	 *   Finds the first slice at or after a position that is not held.
+	 * Parameters :
+	 *   size_t from - Where to start looking.
+	 * Return :
+	 *   size_t - The slice, or GetSize() if every one from there is held.
+	 */
+	size_t FindFirstZero(size_t from) const
+	{
+		return Find(from, ~0ULL);
+	}
+
+	/*
+	 * Function : FindFirstOne
+	 * Description :
+	 *   Finds the first slice at or after a position that is held, the end
+	 *   of a gap starting there.
+	 * Parameters :
+	 *   size_t from - Where to start looking.
+	 * Return :
+	 *   size_t - The slice, or GetSize() if none from there is held.
+	 */
+	size_t FindFirstOne(size_t from) const
+	{
+		return Find(from, 0);
+	}
+
+	/*
+	 * Function : GetCount
+	 * Description :
+	 *   Returns how many slices are held.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of bits set.
+	 */
+	size_t GetCount() const
+	{
+		return m_count;
+	}
+
+	/*
+	 * Function : GetSize
+	 * Description :
+	 *   Returns how many slices the bitmap covers.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of bits.
+	 */
+	size_t GetSize() const
+	{
+		return m_size;
+	}
+
+	/*
+	 * Function : IsFull
+	 * Description :
+	 *   Checks whether every slice is held.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - Returns true when every bit is set.
+	 */
+	bool IsFull() const
+	{
+		return m_count == m_size;
+	}
+
+private:
+	static const size_t WordBits = 64;
+
+	// first bit from "from" that differs from the words' "skip" pattern
+	size_t Find(size_t from, uint64_t skip) const
+	{
+		if (from >= m_size)
+		{
+			return m_size;
+		}
+		size_t index = from / WordBits;
+		uint64_t word = (m_words[index] ^ skip) & (~0ULL << (from % WordBits));
+		while (word == 0)
+		{
+			if (++index == m_words.size())
+			{
+				return m_size;
+			}
+			word = m_words[index] ^ skip;
+		}
+		const size_t id = index * WordBits + std::countr_zero(word);
+		return id < m_size ? id : m_size;
+	}
+
+	std::vector<uint64_t> m_words;
+	size_t m_size = 0;
+	size_t m_count = 0;
+};
@@ -7,21 +7,56 @@
 *   This file provides a `FileSlices` class, which facilitates file slicing,
 *   metadata handling, verification, and reconstruction. It enables breaking
 *   a file into smaller packets, computing MD5 hashes for integrity checking,
-*   and reassembling the file from its slices.
+*   and reassembling the file from its slices. Files are also cut into
+*   content-defined chunks so a receiver holding a `ChunkStore` can skip
+*   slices it is able to rebuild locally. The receiver keeps a bitmap of
+*   the slices it holds, so it knows when the file is complete and which
+*   ranges to ask the sender for again. A sender may also stream a file
+*   instead of holding it, reading each slice again when it is sent.
 */
 
 #pragma once
 
 #include <vector>
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
 #include <chrono>
 
 #include "Protocol.h"
+#include "ChunkStore.h"
+#include "SliceBitmap.h"
+#include "IoUring.h"
+#include "Log.h"
 #include "md5.h"
 
+// The bounds-checked CRT functions used here are MSVC only; map them onto the standard ones elsewhere
+#ifndef _MSC_VER
+inline int strcpy_s(char* dest, size_t size, const char* src)
+{
+	if (dest == nullptr || size == 0)
+	{
+		return EINVAL;
+	}
+	snprintf(dest, size, "%s", src);
+	return 0;
+}
+
+inline int fopen_s(FILE** file, const char* filename, const char* mode)
+{
+	*file = fopen(filename, mode);
+	return *file != nullptr ? 0 : errno;
+}
+
+#define sprintf_s snprintf
+#define sscanf_s sscanf
+#endif
+
 /*
  * Class : FileSlices
  * Description :
@@ -37,42 +72,91 @@ public:
 	 * Description :
 	 *   Loads a file and splits it into slices for transmission or storage.
 	 *   Computes MD5 checksum for integrity verification.
+	 *   A streamed file is only read through once for its checksum and
+	 *   chunks; its slices stay on disk and EncodeSlice reads them back, so
+	 *   it can be sent but not verified or saved.
 	 * Parameters :
 	 *   const char* filename - The name of the file to load and slice.
+	 *   bool streamed - (Optional) True to stream the file instead of holding it.
 	 * Return :
 	 *   bool - Returns true if the file is successfully loaded, false otherwise.
 	 */
-	bool Load(const char* filename)
+	bool Load(const char* filename, bool streamed = false)
 	{
 		assert(filename != nullptr);
-		std::ifstream file(filename, std::ios::binary | std::ios::ate);
-		if (!file)
-		{
-			std::cerr << "Error: Failed opening file to read! " << filename << std::endl;
-			return false;
-		}
-
+		std::vector<uint8_t> content;
 		m_meta.typeFlag = TYPE_META;
 		strcpy_s(m_meta.filename, MAX_FILENAME_LENGTH, filename);
-		m_meta.fileSize = file.tellg();
+		m_streamed = streamed;
 
-		FILE* source = nullptr;
-		fopen_s(&source, filename, "rb");
-		md5File(source, m_meta.md5);
-		fclose(source);
+		if (streamed)
+		{
+			if (!Scan(filename))
+			{
+				return false;
+			}
+		}
+		// With the io_uring engine running the file is read once, in blocks kept in flight together
+		else if (net::IoRing::Get().IsActive())
+		{
+			if (!net::IoRing::Get().ReadFile(filename, content))
+			{
+				NET_ERROR("Error: Failed opening file to read! %s", filename);
+				return false;
+			}
+			m_meta.fileSize = content.size();
+			MD5Context ctx;
+			md5Init(&ctx);
+			md5Update(&ctx, content.data(), content.size());
+			md5Finalize(&ctx);
+			memcpy(m_meta.md5, ctx.digest, MD5_HASH_LENGTH);
+		}
+		else
+		{
+			std::ifstream file(filename, std::ios::binary | std::ios::ate);
+			if (!file)
+			{
+				NET_ERROR("Error: Failed opening file to read! %s", filename);
+				return false;
+			}
+			m_meta.fileSize = file.tellg();
 
-		file.seekg(0, std::ios::beg);
+			FILE* source = nullptr;
+			fopen_s(&source, filename, "rb");
+			md5File(source, m_meta.md5);
+			fclose(source);
+
+			file.seekg(0, std::ios::beg);
+			content.resize(m_meta.fileSize);
+			file.read(reinterpret_cast<char*>(content.data()), content.size());
+			file.close();
+		}
 
+		if (m_meta.fileSize > MAX_FILE_SIZE)
+		{
+			NET_ERROR("Error: %s is larger than the %llu bytes a transfer takes", filename, MAX_FILE_SIZE);
+			return false;
+		}
 		m_meta.totalSlices = (m_meta.fileSize + DATA_SIZE - 1) / DATA_SIZE; // Round up
-		m_slices.resize(m_meta.totalSlices);
-		for (size_t i = 0; i < m_meta.totalSlices; i++)
+		if (!streamed)
 		{
-			m_slices[i].typeFlag = TYPE_DATA;
-			m_slices[i].id = i;
+			m_slices.resize(m_meta.totalSlices);
+			for (size_t i = 0; i < m_meta.totalSlices; i++)
+			{
+				m_slices[i].typeFlag = TYPE_DATA;
+				m_slices[i].id = i;
 
-			file.read(m_slices[i].data, DATA_SIZE);
+				size_t size = SliceSize(i);
+				memcpy(m_slices[i].data, content.data() + i * DATA_SIZE, size);
+				memset(m_slices[i].data + size, 0, DATA_SIZE - size);
+			}
+
+			Chunker::Split(content.data(), content.size(), m_chunks);
 		}
-		file.close();
+		m_meta.totalChunks = static_cast<uint32_t>(m_chunks.size());
+		m_chunkKnown.assign(m_chunks.size(), false);
+		m_chunksKnown = 0;
+		m_needed.assign(m_meta.totalSlices, true);
 
 		return true;
 	}
@@ -115,8 +199,7 @@ public:
 				sprintf_s(expectedMD5 + i * 2, 3, "%02x", m_meta.md5[i]);
 				sprintf_s(receivedMD5 + i * 2, 3, "%02x", ctx.digest[i]);
 			}
-			std::cerr << std::format("Error: File integrity check failed!\n")
-				<< std::format("Expected MD5: {}\nReceived MD5: {}", expectedMD5, receivedMD5);
+			NET_ERROR("Error: File integrity check failed!\nExpected MD5: %s\nReceived MD5: %s", expectedMD5, receivedMD5);
 			return false;
 		}
 	}
@@ -137,10 +220,22 @@ public:
 			filename = m_meta.filename;
 		}
 
+		if (net::IoRing::Get().IsActive())
+		{
+			std::vector<uint8_t> content(m_meta.fileSize);
+			ReadRange(0, content.data(), content.size());
+			if (!net::IoRing::Get().WriteFile(filename, content.data(), content.size(), 0, true))
+			{
+				NET_ERROR("Error: Failed opening file to write! %s", filename);
+				return false;
+			}
+			return true;
+		}
+
 		std::ofstream file(filename, std::ios::binary);
 		if (!file)
 		{
-			std::cerr << "Error: Failed opening file to write! " << filename << std::endl;
+			NET_ERROR("Error: Failed opening file to write! %s", filename);
 			return false;
 		}
 		for (size_t i = 0; i < m_slices.size(); i++)
@@ -159,6 +254,116 @@ public:
 		return true;
 	}
 
+	/*
+	 * Function : SaveRange
+	 * Description :
+	 *   Writes one byte range of the file into place in a local copy, creating the copy
+	 *   if needed and leaving the rest of it untouched. Used for partial downloads.
+	 * Parameters :
+	 *   const char* filename - The name of the local copy.
+	 *   uint64_t offset - The first byte to write.
+	 *   uint64_t size - The number of bytes, clipped to the end of the file.
+	 * Return :
+	 *   bool - Returns true if the range is successfully written, false otherwise.
+	 */
+	bool SaveRange(const char* filename, uint64_t offset, uint64_t size) const
+	{
+		if (offset >= m_meta.fileSize)
+		{
+			return true;
+		}
+		size = std::min(size, m_meta.fileSize - offset);
+
+		if (net::IoRing::Get().IsActive())
+		{
+			std::vector<uint8_t> buffer(size);
+			ReadRange(offset, buffer.data(), size);
+			if (!net::IoRing::Get().WriteFile(filename, buffer.data(), size, offset, false))
+			{
+				NET_ERROR("Error: Failed opening file to write! %s", filename);
+				return false;
+			}
+			return true;
+		}
+
+		std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+		if (!file)
+		{
+			file.open(filename, std::ios::binary | std::ios::out);
+		}
+		if (!file)
+		{
+			NET_ERROR("Error: Failed opening file to write! %s", filename);
+			return false;
+		}
+
+		std::vector<uint8_t> buffer(size);
+		ReadRange(offset, buffer.data(), size);
+		file.seekp(offset);
+		file.write(reinterpret_cast<const char*>(buffer.data()), size);
+		return file.good();
+	}
+
+	/*
+	 * Function : HasSlice
+	 * Description :
+	 *   Checks whether a slice is held since the metadata was received,
+	 *   having arrived over the network or been rebuilt from the chunk store.
+	 * Parameters :
+	 *   size_t id - The index of the slice.
+	 * Return :
+	 *   bool - Returns true if the slice is held.
+	 */
+	bool HasSlice(size_t id) const
+	{
+		return m_held.Test(id);
+	}
+
+	/*
+	 * Function : GetHeldCount
+	 * Description :
+	 *   Returns how many slices of the file the receiver holds.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of slices.
+	 */
+	size_t GetHeldCount() const
+	{
+		return m_held.GetCount();
+	}
+
+	/*
+	 * Function : GetMissing
+	 * Description :
+	 *   Fills a NACK with the lowest ranges of slices still missing. Only
+	 *   gaps below the highest slice received are listed, since the ones
+	 *   above may still be on their way, unless the tail is asked for too
+	 *   because the sender has gone quiet.
+	 * Parameters :
+	 *   PacketRanges* nack - Receives the ranges.
+	 *   bool tail - Also list the missing slices past the highest received.
+	 * Return :
+	 *   size_t - The number of ranges listed.
+	 */
+	size_t GetMissing(PacketRanges* nack, bool tail) const
+	{
+		memset(nack, 0, sizeof(PacketRanges));
+		nack->typeFlag = TYPE_RANGES;
+		nack->flags = RANGES_REPLACE;
+		const size_t limit = tail ? m_held.GetSize() : (m_highest == NO_SLICE ? 0 : m_highest);
+		size_t first = m_held.FindFirstZero(0);
+		while (first < limit && nack->count < RANGES_PER_PACKET)
+		{
+			const size_t end = std::min(m_held.FindFirstOne(first), limit);
+			nack->ranges[nack->count].first = first;
+			nack->ranges[nack->count].count = end - first;
+			nack->count++;
+			first = m_held.FindFirstZero(end);
+		}
+		return nack->count;
+	}
+
 	/*
 	 * Function : Reset
 	 * Description :
@@ -173,12 +378,21 @@ public:
 		m_ready = false;
 		m_meta = { 0 };
 		m_slices.clear();
+		m_streamed = false;
+		m_source.close();
+		m_chunks.clear();
+		m_chunkKnown.clear();
+		m_chunksKnown = 0;
+		m_resolved = false;
+		m_needed.clear();
+		m_held.Reset(0);
+		m_highest = NO_SLICE;
 	}
 
 	/*
 	 * Function : IsReady
 	 * Description :
-	 *   Checks if all slices of the file have been received and are ready for reconstruction.
+	 *   Checks if every slice of the file is held, received or rebuilt, and ready for reconstruction.
 	 * Parameters :
 	 *   None
 	 * Return :
@@ -214,7 +428,21 @@ public:
 	 */
 	size_t GetTotal() const
 	{
-		return m_slices.size();
+		return m_streamed ? (size_t)m_meta.totalSlices : m_slices.size();
+	}
+
+	/*
+	 * Function : IsStreamed
+	 * Description :
+	 *   Checks whether the file was loaded streamed, its slices left on disk.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - Returns true if the file is streamed.
+	 */
+	bool IsStreamed() const
+	{
+		return m_streamed;
 	}
 
 	/*
@@ -224,19 +452,84 @@ public:
 	 * Parameters :
 	 *   size_t id - The index of the slice to retrieve.
 	 * Return :
-	 *   const PacketSlice* - A pointer to the requested slice, or NULL if the ID is out of range.
+	 *   const PacketSlice* - A pointer to the requested slice, or NULL if the ID is out of range
+	 *   or the file is streamed.
 	 */
 	const PacketSlice* GetSlice(size_t id) const
 	{
 		if (id >= m_slices.size())
 		{
-			std::cerr << "Slice ID is out of the boundary." << std::endl;
+			NET_ERROR("Slice ID is out of the boundary.");
 			return nullptr;
 		}
 
 		return &m_slices[id];
 	}
 
+	/*
+	 * Function : EncodeSlice
+	 * Description :
+	 *   Writes a slice in its compact wire form: type, varint id, then the data.
+	 * Parameters :
+	 *   size_t id - The index of the slice to encode.
+	 *   uint8_t* out - Destination, with room for PACKET_SIZE bytes.
+	 * Return :
+	 *   size_t - The number of bytes written, or 0 if the ID is out of range.
+	 */
+	size_t EncodeSlice(size_t id, uint8_t* out) const
+	{
+		if (id >= GetTotal())
+		{
+			return 0;
+		}
+		if (!m_streamed)
+		{
+			return EncodeSlice(id, reinterpret_cast<const uint8_t*>(m_slices[id].data), out);
+		}
+
+		// A streamed slice is read back from the file, the read-ahead thread spares the send loop most of these
+		uint8_t data[DATA_SIZE];
+		if (!m_source.is_open())
+		{
+			m_source.open(m_meta.filename, std::ios::binary);
+		}
+		m_source.clear();
+		m_source.seekg(id * DATA_SIZE);
+		m_source.read(reinterpret_cast<char*>(data), SliceSize(id));
+		if (!m_source)
+		{
+			NET_ERROR("Error: Failed reading slice %llu of %s", (unsigned long long)id, m_meta.filename);
+			return 0;
+		}
+		return EncodeSlice(id, data, out);
+	}
+
+	/*
+	 * Function : EncodeSlice
+	 * Description :
+	 *   Writes a slice in its compact wire form from its bytes read elsewhere,
+	 *   padding the last slice of the file with zeros.
+	 * Parameters :
+	 *   size_t id - The index of the slice to encode.
+	 *   const uint8_t* data - The slice's bytes, DATA_SIZE of them or the rest of the file.
+	 *   uint8_t* out - Destination, with room for PACKET_SIZE bytes.
+	 * Return :
+	 *   size_t - The number of bytes written, or 0 if the ID is out of range.
+	 */
+	size_t EncodeSlice(size_t id, const uint8_t* data, uint8_t* out) const
+	{
+		if (id >= GetTotal())
+		{
+			return 0;
+		}
+		out[0] = TYPE_DATA;
+		size_t size = 1 + WriteVarint(out + 1, id);
+		const size_t length = SliceSize(id);
+		memcpy(out + size, data, length);
+		memset(out + size + length, 0, DATA_SIZE - length);
+		return size + DATA_SIZE;
+	}
+
 	/*
 	 * Function : Deserialize
 	 * Description :
@@ -244,48 +537,490 @@ public:
 	 *   Determines if the packet is metadata or a data slice and stores it accordingly.
 	 * Parameters :
 	 *   const unsigned char* data - A pointer to the received packet data.
+	 *   size_t size - The number of bytes received.
 	 * Return :
 	 *   bool - Returns true if the packet is successfully processed, false otherwise.
 	 */
-	bool Deserialize(const unsigned char* data)
+	bool Deserialize(const unsigned char* data, size_t size = PACKET_SIZE)
 	{
 		PacketType typeFlag = static_cast<PacketType>(data[0]);
 		// A1: Receiving the file metadata
 		if (typeFlag == TYPE_META)
 		{
+			if (size < sizeof(PacketMeta))
+			{
+				return false;
+			}
 			const PacketMeta* meta = reinterpret_cast<const PacketMeta*>(data);
+			// the slice and chunk tables are sized from the packet, so a damaged one must not ask for gigabytes
+			if (meta->fileSize > MAX_FILE_SIZE || meta->totalSlices != (meta->fileSize + DATA_SIZE - 1) / DATA_SIZE ||
+				meta->totalChunks > meta->totalSlices + 1)
+			{
+				NET_ERROR("Error: Rejecting metadata for %llu bytes in %llu slices", (unsigned long long)meta->fileSize,
+					(unsigned long long)meta->totalSlices);
+				return false;
+			}
 			m_meta.typeFlag = typeFlag;
 			strcpy_s(m_meta.filename, MAX_FILENAME_LENGTH, meta->filename);
 			m_meta.fileSize = meta->fileSize;
 			m_meta.totalSlices = meta->totalSlices;
 			memcpy(m_meta.md5, meta->md5, MD5_HASH_LENGTH);
+			m_meta.totalChunks = meta->totalChunks;
 
 			m_slices.resize(m_meta.totalSlices);
+			m_needed.assign(m_meta.totalSlices, true);
+			m_held.Reset(m_meta.totalSlices);
+			m_highest = NO_SLICE;
+			m_ready = m_held.IsFull();
+			m_chunks.assign(m_meta.totalChunks, ChunkRef{});
+			m_chunkKnown.assign(m_meta.totalChunks, false);
+			m_chunksKnown = 0;
+			m_resolved = false;
+			if (m_meta.totalChunks == 0)
+			{
+				ResolveChunks();
+			}
 
 			return true;
 		}
 		// A1: Receiving the file pieces
 		else if (typeFlag == TYPE_DATA)
 		{
-			const PacketSlice* slice = reinterpret_cast<const PacketSlice*>(data);
-			m_slices[slice->id].typeFlag = typeFlag;
-			m_slices[slice->id].id = slice->id;
-			memcpy(m_slices[slice->id].data, slice->data, DATA_SIZE);
-			
-			// TODO: replace with list
-			if (slice->id == m_meta.totalSlices - 1)
+			uint64_t id = 0;
+			size_t header = ReadVarint(data + 1, size - 1, id);
+			if (header == 0 || size < 1 + header + DATA_SIZE || id >= m_slices.size())
+			{
+				return false;
+			}
+			PacketSlice* slice = &m_slices[id];
+			slice->typeFlag = typeFlag;
+			slice->id = id;
+			memcpy(slice->data, data + 1 + header, DATA_SIZE);
+			m_held.Set(id);
+			if (m_highest == NO_SLICE || id > m_highest)
+			{
+				m_highest = id;
+			}
+
+			// Complete only once every slice is here, whatever order they came in
+			if (m_held.IsFull())
 			{
 				m_ready = true;
 			}
 
 			return true;
 		}
+		else if (typeFlag == TYPE_CHUNKS)
+		{
+			// a message split out of a batch may be shorter than the list it claims to be
+			if (size < sizeof(PacketChunkList))
+			{
+				return false;
+			}
+			const PacketChunkList* list = reinterpret_cast<const PacketChunkList*>(data);
+			for (size_t i = 0; i < list->count && i < CHUNKS_PER_PACKET; i++)
+			{
+				size_t index = static_cast<size_t>(list->first) + i;
+				if (index >= m_chunks.size() || m_chunkKnown[index])
+				{
+					continue;
+				}
+				m_chunks[index].size = list->entries[i].size;
+				memcpy(m_chunks[index].md5, list->entries[i].md5, MD5_HASH_LENGTH);
+				m_chunkKnown[index] = true;
+				m_chunksKnown++;
+			}
+
+			if (!m_resolved && m_chunksKnown == m_chunks.size())
+			{
+				ResolveChunks();
+			}
+
+			return true;
+		}
 
 		return false;
 	}
 
+	/*
+	 * Function : SetChunkStore
+	 * Description :
+	 *   Attaches the local chunk store used to rebuild known regions and to keep new chunks.
+	 * Parameters :
+	 *   ChunkStore* store - The store to use, or NULL to disable deduplication.
+	 * Return :
+	 *   void
+	 */
+	void SetChunkStore(ChunkStore* store)
+	{
+		m_store = store;
+	}
+
+	/*
+	 * Function : GetChunkList
+	 * Description :
+	 *   Fills a chunk list packet with the entries starting at the given chunk index.
+	 * Parameters :
+	 *   size_t first - The index of the first chunk to describe.
+	 *   PacketChunkList* packet - The packet to fill.
+	 * Return :
+	 *   size_t - The number of entries written, 0 when first is past the end.
+	 */
+	size_t GetChunkList(size_t first, PacketChunkList* packet) const
+	{
+		memset(packet, 0, sizeof(PacketChunkList));
+		packet->typeFlag = TYPE_CHUNKS;
+		packet->first = static_cast<uint32_t>(first);
+		size_t count = 0;
+		while (count < CHUNKS_PER_PACKET && first + count < m_chunks.size())
+		{
+			packet->entries[count].size = m_chunks[first + count].size;
+			memcpy(packet->entries[count].md5, m_chunks[first + count].md5, MD5_HASH_LENGTH);
+			count++;
+		}
+		packet->count = static_cast<uint8_t>(count);
+		return count;
+	}
+
+	/*
+	 * Function : GetHave
+	 * Description :
+	 *   Fills a have packet with the presence bitmap starting at the given chunk index.
+	 *   Only valid on the receiver once the chunk list has been resolved.
+	 * Parameters :
+	 *   size_t first - The index of the first chunk to report.
+	 *   PacketChunkHave* packet - The packet to fill.
+	 * Return :
+	 *   size_t - The number of chunks reported, 0 when first is past the end.
+	 */
+	size_t GetHave(size_t first, PacketChunkHave* packet) const
+	{
+		memset(packet, 0, sizeof(PacketChunkHave));
+		packet->typeFlag = TYPE_HAVE;
+		packet->first = static_cast<uint32_t>(first);
+		size_t count = 0;
+		while (count < HAVE_PER_PACKET && first + count < m_chunks.size())
+		{
+			if (m_chunks[first + count].present)
+			{
+				packet->bitmap[count / 8] |= 1 << (count % 8);
+			}
+			count++;
+		}
+		packet->count = static_cast<uint16_t>(count);
+		return count;
+	}
+
+	/*
+	 * Function : ApplyHave
+	 * Description :
+	 *   Records which chunks the receiver reported it already holds.
+	 * Parameters :
+	 *   const PacketChunkHave* packet - The have packet from the receiver.
+	 * Return :
+	 *   void
+	 */
+	void ApplyHave(const PacketChunkHave* packet)
+	{
+		if (m_chunkKnown.size() != m_chunks.size())
+		{
+			m_chunkKnown.assign(m_chunks.size(), false);
+			m_chunksKnown = 0;
+		}
+
+		for (size_t i = 0; i < packet->count && i < HAVE_PER_PACKET; i++)
+		{
+			size_t index = static_cast<size_t>(packet->first) + i;
+			if (index >= m_chunks.size() || m_chunkKnown[index])
+			{
+				continue;
+			}
+			m_chunks[index].present = (packet->bitmap[i / 8] >> (i % 8)) & 1;
+			m_chunkKnown[index] = true;
+			m_chunksKnown++;
+		}
+	}
+
+	/*
+	 * Function : IsHaveComplete
+	 * Description :
+	 *   Checks whether the receiver has reported on every chunk.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - Returns true once every chunk's presence is known.
+	 */
+	bool IsHaveComplete() const
+	{
+		return m_chunksKnown == m_chunks.size();
+	}
+
+	/*
+	 * Function : ResolveNeeded
+	 * Description :
+	 *   Works out which slices must be sent from the chunks the receiver holds.
+	 *   Chunks whose presence was never reported are treated as missing.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of slices that still have to be sent.
+	 */
+	size_t ResolveNeeded()
+	{
+		MarkNeeded();
+		size_t count = 0;
+		for (size_t i = 0; i < m_needed.size(); i++)
+		{
+			count += m_needed[i] ? 1 : 0;
+		}
+		return count;
+	}
+
+	/*
+	 * Function : IsSliceNeeded
+	 * Description :
+	 *   Checks whether a slice has to be transferred or can be rebuilt by the receiver.
+	 * Parameters :
+	 *   size_t id - The index of the slice.
+	 * Return :
+	 *   bool - Returns true if the slice has to be sent.
+	 */
+	bool IsSliceNeeded(size_t id) const
+	{
+		return id >= m_needed.size() || m_needed[id];
+	}
+
+	/*
+	 * Function : IsResolved
+	 * Description :
+	 *   Checks whether the receiver has matched the whole chunk list against its store.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   bool - Returns true once the chunk list is resolved.
+	 */
+	bool IsResolved() const
+	{
+		return m_resolved;
+	}
+
+	/*
+	 * Function : GetChunkCount
+	 * Description :
+	 *   Returns the number of content-defined chunks in the file.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of chunks.
+	 */
+	size_t GetChunkCount() const
+	{
+		return m_chunks.size();
+	}
+
+	/*
+	 * Function : StoreChunks
+	 * Description :
+	 *   Cuts the reassembled file into chunks and adds the ones not already held
+	 *   to the chunk store. Call it once the file is verified: the chunks are cut
+	 *   from the file itself rather than taken from the sender's chunk list, so
+	 *   a list that never fully arrived does not leave its chunks out.
+	 * Parameters :
+	 *   None
+	 * Return :
+	 *   size_t - The number of chunks added.
+	 */
+	size_t StoreChunks()
+	{
+		if (m_store == nullptr)
+		{
+			return 0;
+		}
+
+		std::vector<uint8_t> content(m_meta.fileSize);
+		ReadRange(0, content.data(), content.size());
+		Chunker::Split(content.data(), content.size(), m_chunks);
+		m_chunkKnown.assign(m_chunks.size(), true);
+		m_chunksKnown = m_chunks.size();
+
+		size_t added = 0;
+		for (ChunkRef& chunk : m_chunks)
+		{
+			if (m_store->Has(chunk.md5))
+			{
+				chunk.present = true;
+			}
+			else if (m_store->Put(chunk.md5, content.data() + chunk.offset, chunk.size))
+			{
+				chunk.present = true;
+				added++;
+			}
+		}
+		return added;
+	}
+
 private:
+	static constexpr size_t NO_SLICE = static_cast<size_t>(-1);
+	static constexpr size_t SCAN_BLOCK = 1024 * 1024;
+
+	// Reads a streamed file through once for its size, MD5 and chunks, a block at a time
+	bool Scan(const char* filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file)
+		{
+			NET_ERROR("Error: Failed opening file to read! %s", filename);
+			return false;
+		}
+
+		MD5Context ctx;
+		md5Init(&ctx);
+		m_chunks.clear();
+		std::vector<uint8_t> block(SCAN_BLOCK + CHUNK_MAX_SIZE);
+		size_t held = 0;        // bytes at the front of the block not cut into chunks yet
+		uint64_t offset = 0;    // where they start in the file
+		bool last = false;
+		while (!last)
+		{
+			file.read(reinterpret_cast<char*>(block.data() + held), block.size() - held);
+			if (file.bad())
+			{
+				NET_ERROR("Error: Failed reading %s", filename);
+				return false;
+			}
+			const size_t read = static_cast<size_t>(file.gcount());
+			md5Update(&ctx, block.data() + held, read);
+			held += read;
+			last = file.eof();
+
+			const size_t cut = Chunker::Append(block.data(), held, offset, last, m_chunks);
+			memmove(block.data(), block.data() + cut, held - cut);
+			offset += cut;
+			held -= cut;
+		}
+		md5Finalize(&ctx);
+		memcpy(m_meta.md5, ctx.digest, MD5_HASH_LENGTH);
+		m_meta.fileSize = offset;
+		return true;
+	}
+
+	size_t SliceSize(size_t id) const
+	{
+		if (id == m_meta.totalSlices - 1)
+		{
+			return m_meta.fileSize - DATA_SIZE * (m_meta.totalSlices - 1);
+		}
+		return DATA_SIZE;
+	}
+
+	// Copies bytes between a contiguous buffer and the slice payloads at a file offset
+	void WriteRange(uint64_t offset, const uint8_t* data, size_t size)
+	{
+		while (size > 0)
+		{
+			size_t id = offset / DATA_SIZE;
+			size_t skip = offset % DATA_SIZE;
+			size_t length = std::min(size, static_cast<size_t>(DATA_SIZE) - skip);
+			memcpy(m_slices[id].data + skip, data, length);
+			m_slices[id].typeFlag = TYPE_DATA;
+			m_slices[id].id = id;
+			offset += length;
+			data += length;
+			size -= length;
+		}
+	}
+
+	void ReadRange(uint64_t offset, uint8_t* data, size_t size) const
+	{
+		while (size > 0)
+		{
+			size_t id = offset / DATA_SIZE;
+			size_t skip = offset % DATA_SIZE;
+			size_t length = std::min(size, static_cast<size_t>(DATA_SIZE) - skip);
+			memcpy(data, m_slices[id].data + skip, length);
+			offset += length;
+			data += length;
+			size -= length;
+		}
+	}
+
+	void MarkNeeded()
+	{
+		m_needed.assign(m_meta.totalSlices, false);
+		for (const ChunkRef& chunk : m_chunks)
+		{
+			if (chunk.present || chunk.size == 0)
+			{
+				continue;
+			}
+			size_t first = chunk.offset / DATA_SIZE;
+			size_t last = (chunk.offset + chunk.size - 1) / DATA_SIZE;
+			for (size_t id = first; id <= last && id < m_needed.size(); id++)
+			{
+				m_needed[id] = true;
+			}
+		}
+	}
+
+	// Receiver side: rebuild every chunk the store holds and find the last slice still to arrive
+	void ResolveChunks()
+	{
+		uint64_t offset = 0;
+		std::vector<uint8_t> buffer;
+		for (ChunkRef& chunk : m_chunks)
+		{
+			chunk.offset = offset;
+			chunk.present = false;
+			offset += chunk.size;
+		}
+
+		// A chunk list that does not add up to the file cannot be trusted
+		if (offset != m_meta.fileSize)
+		{
+			return;
+		}
+
+		for (ChunkRef& chunk : m_chunks)
+		{
+			if (m_store != nullptr && m_store->Has(chunk.md5))
+			{
+				buffer.resize(chunk.size);
+				if (m_store->Get(chunk.md5, buffer.data(), chunk.size))
+				{
+					WriteRange(chunk.offset, buffer.data(), chunk.size);
+					chunk.present = true;
+				}
+			}
+		}
+
+		// Slices rebuilt from the store are held as if they had arrived
+		MarkNeeded();
+		for (size_t id = 0; id < m_needed.size(); id++)
+		{
+			if (!m_needed[id])
+			{
+				m_held.Set(id);
+			}
+		}
+		if (m_held.IsFull())
+		{
+			m_ready = true;
+		}
+		m_resolved = true;
+	}
+
 	bool m_ready = false;
 	PacketMeta m_meta = { 0 };
 	std::vector<PacketSlice> m_slices;
+	bool m_streamed = false;            // slices are read from the file as they are sent, m_slices stays empty
+	mutable std::ifstream m_source;     // where a streamed file's slices are read back from
+
+	ChunkStore* m_store = nullptr;
+	std::vector<ChunkRef> m_chunks;
+	std::vector<bool> m_chunkKnown;     // entry received (receiver) or presence reported (sender)
+	size_t m_chunksKnown = 0;
+	bool m_resolved = false;
+	std::vector<bool> m_needed;         // slices that have to travel over the network
+	SliceBitmap m_held;                 // receiver: slices that came over the network or were rebuilt
+	size_t m_highest = NO_SLICE;        // receiver: highest slice that came over the network
 };
\ No newline at end of file